@@ -0,0 +1,12 @@
+#регистрация замеров mosaic_bench как тестов ctest по списку из самого mosaic_bench (--list)
+#запускается после сборки mosaic_bench: cmake -D BENCH=<mosaic_bench> -D OUTPUT=<файл тестов> -P BenchmarkTests.cmake
+execute_process(COMMAND "${BENCH}" --list OUTPUT_VARIABLE names RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "mosaic_bench --list failed: ${result}")
+endif()
+string(REGEX MATCHALL "[^\r\n]+" names "${names}")
+set(content "")
+foreach(name IN LISTS names)
+    string(APPEND content "add_test([=[${name}]=] \"${BENCH}\" [=[${name}]=])\n")
+endforeach()
+file(WRITE "${OUTPUT}" "${content}")
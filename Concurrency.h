@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//ограниченная потокобезопасная очередь для конвейеров обработки
+//push блокируется при заполнении, pop - при пустой очереди; после close очередь дочитывается до конца
+template <typename T>
+class BoundedQueue {
+private:
+    std::deque<T> items;//элементы очереди
+    size_t capacity;//максимальное кол-во элементов
+    bool closed = false;//новые элементы больше не поступят
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    //добавление элемента, false если очередь закрыта
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    //извлечение элемента, false если очередь закрыта и пуста
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    //закрытие очереди: ожидающие потоки просыпаются
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+//счетный семафор (ограничение кол-ва элементов в обработке)
+class Semaphore {
+private:
+    size_t count;//свободные разрешения
+    std::mutex mutex;
+    std::condition_variable available;
+
+public:
+    explicit Semaphore(size_t count) : count(count) {}
+
+    //захват разрешения
+    void acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return count > 0; });
+        count--;
+    }
+
+    //возврат разрешения
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex);
+        count++;
+        available.notify_one();
+    }
+};
+
+//кол-во рабочих потоков: заданное значение или число ядер процессора
+inline int resolveThreadCount(int requested) {
+    if (requested > 0) return requested;
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? static_cast<int>(hardware) : 1;
+}
+
+//параллельный цикл по индексам [0, count)
+//потоки разбирают блоки по grain индексов через общий счетчик (неравномерная нагрузка выравнивается),
+//первое исключение из fn пробрасывается вызывающему потоку после завершения всех потоков
+template <typename Fn>
+void parallelFor(size_t count, int threads, Fn&& fn, size_t grain = 16) {
+    if (count == 0) return;
+    grain = std::max<size_t>(1, grain);
+    size_t blocks = (count + grain - 1) / grain;
+    size_t workerCount = std::min<size_t>(static_cast<size_t>(resolveThreadCount(threads)), blocks);
+
+    std::atomic<size_t> nextBlock{ 0 };
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&] {
+        try {
+            for (size_t block = nextBlock++; block < blocks; block = nextBlock++) {
+                size_t end = std::min(count, (block + 1) * grain);
+                for (size_t i = block * grain; i < end; ++i) fn(i);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) error = std::current_exception();
+            nextBlock = blocks;
+        }
+    };
+
+    //последний поток - вызывающий
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < workerCount; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+    if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,307 @@
+#include "DistanceKernels.h"
+#include "SimdSupport.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+//одиночные скалярные ядра
+namespace DistanceScalar {
+
+//евклидово расстояние между 4-канальными строками (как cv::norm для cv::Scalar)
+double colorL2(const float* a, const float* b) {
+    double sum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        double d = static_cast<double>(a[i]) - b[i];
+        sum += d * d;
+    }
+    return std::sqrt(sum);
+}
+
+//расстояние Бхаттачарии между гистограммами (та же формула, что в cv::compareHist)
+double bhattacharyya(const float* h1, const float* h2, int bins) {
+    double result = 0.0, s1 = 0.0, s2 = 0.0;
+    for (int i = 0; i < bins; ++i) {
+        double a = h1[i], b = h2[i];
+        result += std::sqrt(a * b);
+        s1 += a;
+        s2 += b;
+    }
+    s1 *= s2;
+    s1 = std::fabs(s1) > FLT_EPSILON ? 1.0 / std::sqrt(s1) : 1.0;
+    return std::sqrt(std::max(1.0 - result * s1, 0.0));
+}
+
+}
+
+namespace {
+
+//завершение формулы Бхаттачарии по накопленным суммам (как в скалярном ядре)
+inline double finishBhattacharyya(double result, double s1, double s2) {
+    s1 *= s2;
+    s1 = std::fabs(s1) > FLT_EPSILON ? 1.0 / std::sqrt(s1) : 1.0;
+    return std::sqrt(std::max(1.0 - result * s1, 0.0));
+}
+
+//сумма бинов гистограммы запроса в том же порядке, что и в скалярном ядре
+inline double histogramSum(const float* hist, int bins) {
+    double sum = 0.0;
+    for (int i = 0; i < bins; ++i) sum += hist[i];
+    return sum;
+}
+
+//скалярные пакетные ядра
+void colorL2Scalar(const float* query, const float* colors, size_t count, double* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = DistanceScalar::colorL2(query, colors + i * 4);
+    }
+}
+
+void colorContrastScalar(const float* queryColor, const float* queryStddev,
+    const float* colors, const float* stddevs, size_t count, double* out) {
+    for (size_t i = 0; i < count; ++i) {
+        double colorDist = DistanceScalar::colorL2(queryColor, colors + i * 4);
+        double stddevDist = DistanceScalar::colorL2(queryStddev, stddevs + i * 4);
+        out[i] = colorDist + 2.0 * stddevDist;
+    }
+}
+
+void bhattacharyyaScalar(const float* query, const float* hists, int bins, int stride, size_t count, double* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = DistanceScalar::bhattacharyya(query, hists + i * stride, bins);
+    }
+}
+
+#ifdef MOSAIC_X86
+
+//цветовые ядра: несколько тайлов в одном регистре (по одному double на тайл),
+//каналы суммируются в том же порядке, что и в скалярном ядре, поэтому результат совпадает побитово
+
+//SSE4.1: 2 тайла за итерацию
+MOSAIC_TARGET("sse4.1")
+inline __m128d colorL2Pair(const float* query, const float* pair) {
+    __m128 t0 = _mm_load_ps(pair);
+    __m128 t1 = _mm_load_ps(pair + 4);
+    __m128 lo = _mm_unpacklo_ps(t0, t1);//c0 c0 c1 c1
+    __m128 hi = _mm_unpackhi_ps(t0, t1);//c2 c2 c3 c3
+    __m128d channels[4] = {
+        _mm_cvtps_pd(lo), _mm_cvtps_pd(_mm_movehl_ps(lo, lo)),
+        _mm_cvtps_pd(hi), _mm_cvtps_pd(_mm_movehl_ps(hi, hi))
+    };
+    __m128d sum = _mm_setzero_pd();
+    for (int c = 0; c < 4; ++c) {
+        __m128d d = _mm_sub_pd(_mm_set1_pd(query[c]), channels[c]);
+        sum = _mm_add_pd(sum, _mm_mul_pd(d, d));
+    }
+    return _mm_sqrt_pd(sum);
+}
+
+MOSAIC_TARGET("sse4.1")
+void colorL2SSE41(const float* query, const float* colors, size_t count, double* out) {
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(out + i, colorL2Pair(query, colors + i * 4));
+    }
+    for (; i < count; ++i) {
+        out[i] = DistanceScalar::colorL2(query, colors + i * 4);
+    }
+}
+
+MOSAIC_TARGET("sse4.1")
+void colorContrastSSE41(const float* queryColor, const float* queryStddev,
+    const float* colors, const float* stddevs, size_t count, double* out) {
+    const __m128d two = _mm_set1_pd(2.0);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d colorDist = colorL2Pair(queryColor, colors + i * 4);
+        __m128d stddevDist = colorL2Pair(queryStddev, stddevs + i * 4);
+        _mm_storeu_pd(out + i, _mm_add_pd(colorDist, _mm_mul_pd(two, stddevDist)));
+    }
+    for (; i < count; ++i) {
+        double colorDist = DistanceScalar::colorL2(queryColor, colors + i * 4);
+        double stddevDist = DistanceScalar::colorL2(queryStddev, stddevs + i * 4);
+        out[i] = colorDist + 2.0 * stddevDist;
+    }
+}
+
+//AVX2: 4 тайла за итерацию (транспонирование 4x4 float, каналы расширяются до double)
+MOSAIC_TARGET("avx2")
+inline __m256d colorL2Quad(const float* query, const float* quad) {
+    __m128 r0 = _mm_load_ps(quad);
+    __m128 r1 = _mm_load_ps(quad + 4);
+    __m128 r2 = _mm_load_ps(quad + 8);
+    __m128 r3 = _mm_load_ps(quad + 12);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    __m128 channels[4] = { r0, r1, r2, r3 };
+    __m256d sum = _mm256_setzero_pd();
+    for (int c = 0; c < 4; ++c) {
+        __m256d d = _mm256_sub_pd(_mm256_set1_pd(query[c]), _mm256_cvtps_pd(channels[c]));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(d, d));
+    }
+    return _mm256_sqrt_pd(sum);
+}
+
+MOSAIC_TARGET("avx2")
+void colorL2AVX2(const float* query, const float* colors, size_t count, double* out) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(out + i, colorL2Quad(query, colors + i * 4));
+    }
+    for (; i < count; ++i) {
+        out[i] = DistanceScalar::colorL2(query, colors + i * 4);
+    }
+}
+
+MOSAIC_TARGET("avx2")
+void colorContrastAVX2(const float* queryColor, const float* queryStddev,
+    const float* colors, const float* stddevs, size_t count, double* out) {
+    const __m256d two = _mm256_set1_pd(2.0);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d colorDist = colorL2Quad(queryColor, colors + i * 4);
+        __m256d stddevDist = colorL2Quad(queryStddev, stddevs + i * 4);
+        _mm256_storeu_pd(out + i, _mm256_add_pd(colorDist, _mm256_mul_pd(two, stddevDist)));
+    }
+    for (; i < count; ++i) {
+        double colorDist = DistanceScalar::colorL2(queryColor, colors + i * 4);
+        double stddevDist = DistanceScalar::colorL2(queryStddev, stddevs + i * 4);
+        out[i] = colorDist + 2.0 * stddevDist;
+    }
+}
+
+//ядра Бхаттачарии: бины одного тайла по регистрам, вычисления в double;
+//отличие от скалярного ядра только в порядке суммирования (погрешность порядка 1e-15 относительно)
+
+MOSAIC_TARGET("sse4.1")
+void bhattacharyyaSSE41(const float* query, const float* hists, int bins, int stride, size_t count, double* out) {
+    double s1 = histogramSum(query, bins);
+    for (size_t i = 0; i < count; ++i) {
+        const float* hist = hists + i * stride;
+        __m128d result0 = _mm_setzero_pd(), result1 = _mm_setzero_pd();
+        __m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+        for (int b = 0; b < bins; b += 4) {
+            __m128 q = _mm_loadu_ps(query + b);
+            __m128 h = _mm_load_ps(hist + b);
+            __m128d qLo = _mm_cvtps_pd(q), qHi = _mm_cvtps_pd(_mm_movehl_ps(q, q));
+            __m128d hLo = _mm_cvtps_pd(h), hHi = _mm_cvtps_pd(_mm_movehl_ps(h, h));
+            result0 = _mm_add_pd(result0, _mm_sqrt_pd(_mm_mul_pd(qLo, hLo)));
+            result1 = _mm_add_pd(result1, _mm_sqrt_pd(_mm_mul_pd(qHi, hHi)));
+            sum0 = _mm_add_pd(sum0, hLo);
+            sum1 = _mm_add_pd(sum1, hHi);
+        }
+        __m128d result = _mm_add_pd(result0, result1);
+        __m128d sum = _mm_add_pd(sum0, sum1);
+        double r = _mm_cvtsd_f64(_mm_add_sd(result, _mm_unpackhi_pd(result, result)));
+        double s2 = _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+        out[i] = finishBhattacharyya(r, s1, s2);
+    }
+}
+
+MOSAIC_TARGET("avx2")
+inline double horizontalSum(__m256d v) {
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+MOSAIC_TARGET("avx2")
+void bhattacharyyaAVX2(const float* query, const float* hists, int bins, int stride, size_t count, double* out) {
+    double s1 = histogramSum(query, bins);
+    for (size_t i = 0; i < count; ++i) {
+        const float* hist = hists + i * stride;
+        __m256d result0 = _mm256_setzero_pd(), result1 = _mm256_setzero_pd();
+        __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+        int b = 0;
+        for (; b + 8 <= bins; b += 8) {
+            __m256d q0 = _mm256_cvtps_pd(_mm_loadu_ps(query + b));
+            __m256d q1 = _mm256_cvtps_pd(_mm_loadu_ps(query + b + 4));
+            __m256d h0 = _mm256_cvtps_pd(_mm_load_ps(hist + b));
+            __m256d h1 = _mm256_cvtps_pd(_mm_load_ps(hist + b + 4));
+            result0 = _mm256_add_pd(result0, _mm256_sqrt_pd(_mm256_mul_pd(q0, h0)));
+            result1 = _mm256_add_pd(result1, _mm256_sqrt_pd(_mm256_mul_pd(q1, h1)));
+            sum0 = _mm256_add_pd(sum0, h0);
+            sum1 = _mm256_add_pd(sum1, h1);
+        }
+        for (; b < bins; b += 4) {
+            __m256d q = _mm256_cvtps_pd(_mm_loadu_ps(query + b));
+            __m256d h = _mm256_cvtps_pd(_mm_load_ps(hist + b));
+            result0 = _mm256_add_pd(result0, _mm256_sqrt_pd(_mm256_mul_pd(q, h)));
+            sum0 = _mm256_add_pd(sum0, h);
+        }
+        double r = horizontalSum(_mm256_add_pd(result0, result1));
+        double s2 = horizontalSum(_mm256_add_pd(sum0, sum1));
+        out[i] = finishBhattacharyya(r, s1, s2);
+    }
+}
+
+//проверка поддержки инструкций процессором и операционной системой
+bool cpuSupports(SimdLevel level) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (level == SimdLevel::AVX2) return __builtin_cpu_supports("avx2");
+    if (level == SimdLevel::SSE41) return __builtin_cpu_supports("sse4.1");
+    return true;
+#elif defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    if (level == SimdLevel::SSE41) return sse41;
+    if (level == SimdLevel::AVX2) {
+        //AVX требует поддержки сохранения регистров ymm со стороны ОС (OSXSAVE + XCR0)
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || maxLeaf < 7) return false;
+        if ((_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+    return true;
+#else
+    return level == SimdLevel::Scalar;
+#endif
+}
+
+#endif
+
+const DistanceKernels scalarKernels = { SimdLevel::Scalar, colorL2Scalar, colorContrastScalar, bhattacharyyaScalar };
+#ifdef MOSAIC_X86
+const DistanceKernels sse41Kernels = { SimdLevel::SSE41, colorL2SSE41, colorContrastSSE41, bhattacharyyaSSE41 };
+const DistanceKernels avx2Kernels = { SimdLevel::AVX2, colorL2AVX2, colorContrastAVX2, bhattacharyyaAVX2 };
+#endif
+
+}
+
+//уровень инструкций, поддерживаемый процессором
+SimdLevel detectSimdLevel() {
+#ifdef MOSAIC_X86
+    if (cpuSupports(SimdLevel::AVX2)) return SimdLevel::AVX2;
+    if (cpuSupports(SimdLevel::SSE41)) return SimdLevel::SSE41;
+#endif
+    return SimdLevel::Scalar;
+}
+
+//имя уровня инструкций
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::SSE41: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+//ядра для заданного уровня
+const DistanceKernels* distanceKernelsFor(SimdLevel level) {
+    if (level == SimdLevel::Scalar) return &scalarKernels;
+#ifdef MOSAIC_X86
+    if (!cpuSupports(level)) return nullptr;
+    if (level == SimdLevel::SSE41) return &sse41Kernels;
+    if (level == SimdLevel::AVX2) return &avx2Kernels;
+#endif
+    return nullptr;
+}
+
+//ядра для лучшего доступного уровня
+const DistanceKernels& distanceKernels() {
+    static const DistanceKernels* best = distanceKernelsFor(detectSimdLevel());
+    return *best;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+//уровень векторных инструкций, доступный ядрам расстояний
+enum class SimdLevel {
+    Scalar,//без векторных инструкций
+    SSE41,//SSE4.1 (2 double на регистр)
+    AVX2//AVX2 (4 double на регистр)
+};
+
+//набор ядер пакетного вычисления расстояний от одной клетки до диапазона тайлов
+//признаки тайлов читаются подряд из строк FeatureStore с заданным шагом (строки тайлов выровнены на 16 байт)
+struct DistanceKernels {
+    SimdLevel level;//уровень инструкций набора
+    //евклидово расстояние 4-канальных строк (шаг 4 float)
+    void (*colorL2)(const float* query, const float* colors, size_t count, double* out);
+    //цвет + 2 * контраст (шаг обеих строк 4 float)
+    void (*colorContrast)(const float* queryColor, const float* queryStddev,
+        const float* colors, const float* stddevs, size_t count, double* out);
+    //расстояние Бхаттачарии гистограмм (bins кратно 4, шаг stride float)
+    void (*bhattacharyya)(const float* query, const float* hists, int bins, int stride, size_t count, double* out);
+};
+
+//одиночные скалярные ядра (эталон: совпадают с cv::norm для cv::Scalar и cv::compareHist)
+namespace DistanceScalar {
+    //евклидово расстояние 4-канальных строк
+    double colorL2(const float* a, const float* b);
+    //расстояние Бхаттачарии двух гистограмм
+    double bhattacharyya(const float* h1, const float* h2, int bins);
+}
+
+//уровень инструкций, поддерживаемый процессором
+SimdLevel detectSimdLevel();
+//имя уровня инструкций
+const char* simdLevelName(SimdLevel level);
+//ядра для заданного уровня (nullptr, если процессор его не поддерживает)
+const DistanceKernels* distanceKernelsFor(SimdLevel level);
+//ядра для лучшего доступного уровня (выбираются один раз при первом вызове)
+const DistanceKernels& distanceKernels();
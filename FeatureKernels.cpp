@@ -0,0 +1,294 @@
+#include "FeatureKernels.h"
+#include "SimdSupport.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace {
+
+//скалярный LBP-код пикселя x (порядок битов как в FeatureUtils::getLBPValue)
+inline uchar lbpCode(const uchar* above, const uchar* row, const uchar* below, int x) {
+    uchar center = row[x];
+    uchar value = 0;
+    value |= (above[x - 1] > center) << 7;
+    value |= (above[x] > center) << 6;
+    value |= (above[x + 1] > center) << 5;
+    value |= (row[x + 1] > center) << 4;
+    value |= (below[x + 1] > center) << 3;
+    value |= (below[x] > center) << 2;
+    value |= (below[x - 1] > center) << 1;
+    value |= (row[x - 1] > center) << 0;
+    return value;
+}
+
+void lbpRowScalar(const uchar* above, const uchar* row, const uchar* below, int width, uchar* codes) {
+    for (int x = 1; x < width - 1; ++x) {
+        codes[x] = lbpCode(above, row, below, x);
+    }
+}
+
+void lbpRowHistogramScalar(const uchar* above, const uchar* row, const uchar* below, int width, uint32_t* hist) {
+    for (int x = 1; x < width - 1; ++x) {
+        hist[lbpCode(above, row, below, x)]++;
+    }
+}
+
+#ifdef MOSAIC_X86
+
+//векторные LBP-ядра: сравнение беззнаковых байтов через сдвиг на 0x80 и знаковое сравнение,
+//маски сравнений с 8 соседями складываются в код по битам; хвост строки считается скалярно
+
+//SSE4.1: 16 пикселей за итерацию
+MOSAIC_TARGET("sse4.1")
+inline __m128i loadBiased16(const uchar* p) {
+    return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_set1_epi8(static_cast<char>(0x80)));
+}
+
+//бит кода для соседа: маска (сосед > центр) с весом бита
+MOSAIC_TARGET("sse4.1")
+inline __m128i lbpBit16(const uchar* neighbour, __m128i center, int shift) {
+    return _mm_and_si128(_mm_cmpgt_epi8(loadBiased16(neighbour), center), _mm_set1_epi8(static_cast<char>(1 << shift)));
+}
+
+MOSAIC_TARGET("sse4.1")
+inline __m128i lbpCodes16(const uchar* above, const uchar* row, const uchar* below, int x) {
+    __m128i center = loadBiased16(row + x);
+    __m128i high = _mm_or_si128(_mm_or_si128(lbpBit16(above + x - 1, center, 7), lbpBit16(above + x, center, 6)),
+        _mm_or_si128(lbpBit16(above + x + 1, center, 5), lbpBit16(row + x + 1, center, 4)));
+    __m128i low = _mm_or_si128(_mm_or_si128(lbpBit16(below + x + 1, center, 3), lbpBit16(below + x, center, 2)),
+        _mm_or_si128(lbpBit16(below + x - 1, center, 1), lbpBit16(row + x - 1, center, 0)));
+    return _mm_or_si128(high, low);
+}
+
+MOSAIC_TARGET("sse4.1")
+void lbpRowSSE41(const uchar* above, const uchar* row, const uchar* below, int width, uchar* codes) {
+    int x = 1;
+    for (; x + 16 <= width - 1; x += 16) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(codes + x), lbpCodes16(above, row, below, x));
+    }
+    for (; x < width - 1; ++x) {
+        codes[x] = lbpCode(above, row, below, x);
+    }
+}
+
+MOSAIC_TARGET("sse4.1")
+void lbpRowHistogramSSE41(const uchar* above, const uchar* row, const uchar* below, int width, uint32_t* hist) {
+    alignas(16) uchar block[16];
+    int x = 1;
+    for (; x + 16 <= width - 1; x += 16) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(block), lbpCodes16(above, row, below, x));
+        for (int i = 0; i < 16; ++i) hist[block[i]]++;
+    }
+    for (; x < width - 1; ++x) {
+        hist[lbpCode(above, row, below, x)]++;
+    }
+}
+
+//AVX2: 32 пикселя за итерацию, остаток от 16 пикселей - одной итерацией SSE4.1
+MOSAIC_TARGET("avx2")
+inline __m256i loadBiased32(const uchar* p) {
+    return _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), _mm256_set1_epi8(static_cast<char>(0x80)));
+}
+
+MOSAIC_TARGET("avx2")
+inline __m256i lbpBit32(const uchar* neighbour, __m256i center, int shift) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(loadBiased32(neighbour), center), _mm256_set1_epi8(static_cast<char>(1 << shift)));
+}
+
+MOSAIC_TARGET("avx2")
+inline __m256i lbpCodes32(const uchar* above, const uchar* row, const uchar* below, int x) {
+    __m256i center = loadBiased32(row + x);
+    __m256i high = _mm256_or_si256(_mm256_or_si256(lbpBit32(above + x - 1, center, 7), lbpBit32(above + x, center, 6)),
+        _mm256_or_si256(lbpBit32(above + x + 1, center, 5), lbpBit32(row + x + 1, center, 4)));
+    __m256i low = _mm256_or_si256(_mm256_or_si256(lbpBit32(below + x + 1, center, 3), lbpBit32(below + x, center, 2)),
+        _mm256_or_si256(lbpBit32(below + x - 1, center, 1), lbpBit32(row + x - 1, center, 0)));
+    return _mm256_or_si256(high, low);
+}
+
+MOSAIC_TARGET("avx2")
+void lbpRowAVX2(const uchar* above, const uchar* row, const uchar* below, int width, uchar* codes) {
+    int x = 1;
+    for (; x + 32 <= width - 1; x += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + x), lbpCodes32(above, row, below, x));
+    }
+    if (x + 16 <= width - 1) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(codes + x), lbpCodes16(above, row, below, x));
+        x += 16;
+    }
+    for (; x < width - 1; ++x) {
+        codes[x] = lbpCode(above, row, below, x);
+    }
+}
+
+MOSAIC_TARGET("avx2")
+void lbpRowHistogramAVX2(const uchar* above, const uchar* row, const uchar* below, int width, uint32_t* hist) {
+    alignas(32) uchar block[32];
+    int x = 1;
+    for (; x + 32 <= width - 1; x += 32) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(block), lbpCodes32(above, row, below, x));
+        for (int i = 0; i < 32; ++i) hist[block[i]]++;
+    }
+    if (x + 16 <= width - 1) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(block), lbpCodes16(above, row, below, x));
+        for (int i = 0; i < 16; ++i) hist[block[i]]++;
+        x += 16;
+    }
+    for (; x < width - 1; ++x) {
+        hist[lbpCode(above, row, below, x)]++;
+    }
+}
+
+#endif
+
+const FeatureKernels scalarKernels = { SimdLevel::Scalar, lbpRowScalar, lbpRowHistogramScalar };
+#ifdef MOSAIC_X86
+const FeatureKernels sse41Kernels = { SimdLevel::SSE41, lbpRowSSE41, lbpRowHistogramSSE41 };
+const FeatureKernels avx2Kernels = { SimdLevel::AVX2, lbpRowAVX2, lbpRowHistogramAVX2 };
+#endif
+
+}
+
+//ядра для заданного уровня (уровни упорядочены: поддержка старшего означает поддержку младших)
+const FeatureKernels* featureKernelsFor(SimdLevel level) {
+    if (level == SimdLevel::Scalar) return &scalarKernels;
+#ifdef MOSAIC_X86
+    if (static_cast<int>(level) > static_cast<int>(detectSimdLevel())) return nullptr;
+    if (level == SimdLevel::SSE41) return &sse41Kernels;
+    if (level == SimdLevel::AVX2) return &avx2Kernels;
+#endif
+    return nullptr;
+}
+
+//ядра для лучшего доступного уровня
+const FeatureKernels& featureKernels() {
+    static const FeatureKernels* best = featureKernelsFor(detectSimdLevel());
+    return *best;
+}
+
+//гистограмма LBP-кодов изображения: по строкам с указателями на соседние строки
+void computeLBPHistogram(const cv::Mat& gray, uint32_t* hist, const FeatureKernels& kernels) {
+    for (int y = 1; y < gray.rows - 1; ++y) {
+        kernels.lbpRowHistogram(gray.ptr<uchar>(y - 1), gray.ptr<uchar>(y), gray.ptr<uchar>(y + 1), gray.cols, hist);
+    }
+}
+
+//яркость строки: коэффициенты cv::cvtColor для 8-битного BGR с фиксированной точкой (сдвиг 14 бит)
+void grayRow(const cv::Mat& image, int y, int* out) {
+    const uchar* src = image.ptr<uchar>(y);
+    const int width = image.cols;
+    if (image.channels() == 3) {
+        for (int x = 0; x < width; ++x, src += 3) {
+            out[x + 1] = (src[0] * 1868 + src[1] * 9617 + src[2] * 4899 + (1 << 13)) >> 14;
+        }
+    }
+    else {
+        for (int x = 0; x < width; ++x) out[x + 1] = src[x];
+    }
+    out[0] = out[2];
+    out[width + 1] = out[width - 1];
+}
+
+namespace {
+
+//угол вектора в градусах [0, 360) полиномом 7-й степени по отношению меньшей проекции к большей
+//(та же аппроксимация, что у cv::fastAtan2)
+inline float fastAtanDegrees(float y, float x) {
+    const float p1 = 0.9997878412794807f * 57.29577951308232f;
+    const float p3 = -0.3258083974640975f * 57.29577951308232f;
+    const float p5 = 0.1555786518463281f * 57.29577951308232f;
+    const float p7 = -0.04432655554792128f * 57.29577951308232f;
+    float ax = std::fabs(x), ay = std::fabs(y);
+    float a;
+    if (ax >= ay) {
+        float c = ay / (ax + 1e-10f), c2 = c * c;
+        a = (((p7 * c2 + p5) * c2 + p3) * c2 + p1) * c;
+    }
+    else {
+        float c = ax / (ay + 1e-10f), c2 = c * c;
+        a = 90.0f - (((p7 * c2 + p5) * c2 + p3) * c2 + p1) * c;
+    }
+    if (x < 0) a = 180.0f - a;
+    if (y < 0) a = 360.0f - a;
+    return a;
+}
+
+}
+
+//Собель по строкам с отраженными краями: элемент x + 1 строки - пиксель x
+void gradientRow(const int* above, const int* row, const int* below, int width, bool fastAtan, float* magnitude, uchar* bin) {
+    const int bins = FeatureStore::gradientBins;
+    const float angleStep = 360.0f / bins;
+    for (int x = 1; x <= width; ++x) {
+        int dx = (above[x + 1] - above[x - 1]) + 2 * (row[x + 1] - row[x - 1]) + (below[x + 1] - below[x - 1]);
+        int dy = (below[x - 1] - above[x - 1]) + 2 * (below[x] - above[x]) + (below[x + 1] - above[x + 1]);
+        float gx = static_cast<float>(dx), gy = static_cast<float>(dy);
+        float angle;
+        if (fastAtan) {
+            angle = fastAtanDegrees(gy, gx);
+        }
+        else {
+            angle = std::atan2(gy, gx) * 180.0f / 3.14159265f;
+            if (angle < 0) angle += 360.0f;
+        }
+        int b = static_cast<int>(angle / angleStep);
+        magnitude[x - 1] = std::sqrt(gx * gx + gy * gy);
+        bin[x - 1] = static_cast<uchar>(std::max(0, std::min(b, bins - 1)));
+    }
+}
+
+namespace {
+
+//проход по строкам градиента изображения: три скользящие строки яркости (верхний и нижний края отражаются);
+//output(y) возвращает пару указателей на строку величин и бинов, consume(y) вызывается после ее заполнения
+template <typename Output, typename Consume>
+void forEachGradientRow(const cv::Mat& image, bool fastAtan, Output output, Consume consume) {
+    const int width = image.cols, height = image.rows;
+    std::vector<int> lines(3 * (width + 2));
+    int* above = lines.data();
+    int* row = above + width + 2;
+    int* below = row + width + 2;
+    grayRow(image, 0, row);
+    grayRow(image, 1, below);
+    std::copy(below, below + width + 2, above);
+    for (int y = 0; y < height; ++y) {
+        if (y > 0) {
+            std::swap(above, row);
+            std::swap(row, below);
+            //нижняя строка за краем изображения - отражение предпоследней (она уже в above)
+            if (y + 1 < height) grayRow(image, y + 1, below);
+            else std::copy(above, above + width + 2, below);
+        }
+        std::pair<float*, uchar*> out = output(y);
+        gradientRow(above, row, below, width, fastAtan, out.first, out.second);
+        consume(out.first, out.second);
+    }
+}
+
+}
+
+//гистограмма градиентов: величина и бин считаются построчно в небольшие буферы и сразу добавляются к гистограмме
+void computeGradientHistogram(const cv::Mat& image, float* hist, bool fastAtan) {
+    if (image.cols < 2 || image.rows < 2) return;
+    std::vector<float> magnitude(image.cols);
+    std::vector<uchar> bin(image.cols);
+    forEachGradientRow(image, fastAtan,
+        [&](int) { return std::make_pair(magnitude.data(), bin.data()); },
+        [&](const float* magnitudeRow, const uchar* binRow) {
+            for (int x = 0; x < image.cols; ++x) hist[binRow[x]] += magnitudeRow[x];
+        });
+}
+
+//плоскости градиента: строки пишутся прямо в выходные матрицы
+void computeGradientPlanes(const cv::Mat& image, cv::Mat& magnitude, cv::Mat& bin, bool fastAtan) {
+    magnitude.create(image.rows, image.cols, CV_32F);
+    bin.create(image.rows, image.cols, CV_8U);
+    if (image.cols < 2 || image.rows < 2) {
+        magnitude.setTo(cv::Scalar(0));
+        bin.setTo(cv::Scalar(0));
+        return;
+    }
+    forEachGradientRow(image, fastAtan,
+        [&](int y) { return std::make_pair(magnitude.ptr<float>(y), bin.ptr<uchar>(y)); },
+        [](const float*, const uchar*) {});
+}
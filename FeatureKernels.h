@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include "DistanceKernels.h"
+#include "FeatureStore.h"
+
+//набор векторных ядер вычисления признаков изображения
+struct FeatureKernels {
+    SimdLevel level;//уровень инструкций набора
+    //LBP-коды строки: codes[x] для внутренних пикселей x в [1, width-1) по строкам above/row/below
+    void (*lbpRow)(const uchar* above, const uchar* row, const uchar* below, int width, uchar* codes);
+    //то же с накоплением кодов сразу в гистограмму hist[256] (коды не записываются в память изображения)
+    void (*lbpRowHistogram)(const uchar* above, const uchar* row, const uchar* below, int width, uint32_t* hist);
+};
+
+//ядра для заданного уровня (nullptr, если процессор его не поддерживает)
+const FeatureKernels* featureKernelsFor(SimdLevel level);
+//ядра для лучшего доступного уровня
+const FeatureKernels& featureKernels();
+
+//гистограмма LBP-кодов внутренних пикселей изображения в оттенках серого (CV_8U),
+//счетчики добавляются к hist[256]; коды совпадают с FeatureUtils::getLBPValue
+void computeLBPHistogram(const cv::Mat& gray, uint32_t* hist, const FeatureKernels& kernels = featureKernels());
+
+//яркость строки y изображения CV_8UC1/CV_8UC3 (для цветного - как cv::cvtColor с COLOR_BGR2GRAY)
+//с отражением краев как BORDER_REFLECT_101: out[x + 1] - пиксель x, out[0] и out[width + 1] - отраженные соседи
+//(ширина не меньше 2)
+void grayRow(const cv::Mat& image, int y, int* out);
+
+//величина и бин направления градиента Собеля 3x3 для пикселей строки по трем строкам яркости из grayRow
+//(как Sobel + cartToPolar в градусах + деление угла на 360/FeatureStore::gradientBins), все в регистрах;
+//fastAtan - полиномиальная аппроксимация угла (ошибка около 0.01 градуса) вместо std::atan2
+void gradientRow(const int* above, const int* row, const int* below, int width, bool fastAtan, float* magnitude, uchar* bin);
+
+//гистограмма направлений градиентов изображения CV_8UC1/CV_8UC3 за один проход без промежуточных матриц:
+//яркость хранится в трех скользящих строках, величины градиента добавляются к hist[FeatureStore::gradientBins];
+//отличие от FeatureUtils::computeGradientHist на Sobel/cartToPolar - только у пикселей, угол которых лежит
+//на границе бина в пределах точности cartToPolar, после нормировки не более 1e-2 по сумме модулей разностей бинов
+void computeGradientHistogram(const cv::Mat& image, float* hist, bool fastAtan = false);
+
+//плоскости величины (CV_32F) и бина направления (CV_8U) градиента изображения CV_8UC1/CV_8UC3 тем же проходом
+void computeGradientPlanes(const cv::Mat& image, cv::Mat& magnitude, cv::Mat& bin, bool fastAtan = false);
@@ -0,0 +1,124 @@
+#include "FeatureStore.h"
+#include <algorithm>
+#include <cstring>
+
+//класс FeatureStore
+//шаг строки для вида признака
+int FeatureStore::strideOf(FeatureKind kind) {
+    switch (kind) {
+    case FeatureColor: return colorStride;
+    case FeatureStdDev: return stddevStride;
+    case FeatureGradient: return gradientStride;
+    case FeatureTexture: return textureStride;
+    default: return 0;
+    }
+}
+
+//полезный размер строки для вида признака
+int FeatureStore::sizeOf(FeatureKind kind) {
+    switch (kind) {
+    case FeatureColor: return colorSize;
+    case FeatureStdDev: return stddevSize;
+    case FeatureGradient: return gradientBins;
+    case FeatureTexture: return textureBins;
+    default: return 0;
+    }
+}
+
+//строка признака по виду
+float* FeatureStore::data(FeatureKind kind, size_t row) {
+    switch (kind) {
+    case FeatureColor: return color(row);
+    case FeatureStdDev: return stddev(row);
+    case FeatureGradient: return gradient(row);
+    case FeatureTexture: return texture(row);
+    default: return nullptr;
+    }
+}
+
+const float* FeatureStore::data(FeatureKind kind, size_t row) const {
+    return const_cast<FeatureStore*>(this)->data(kind, row);
+}
+
+//изменение выделенного кол-ва строк для всех выделенных видов
+void FeatureStore::reallocate(size_t newCapacity) {
+    capacity = newCapacity;
+    if (kinds & FeatureColor) colors.resize(capacity * colorStride, 0.0f);
+    if (kinds & FeatureStdDev) stddevs.resize(capacity * stddevStride, 0.0f);
+    if (kinds & FeatureGradient) gradients.resize(capacity * gradientStride, 0.0f);
+    if (kinds & FeatureTexture) textures.resize(capacity * textureStride, 0.0f);
+}
+
+//выделение массивов для видов из маски
+void FeatureStore::require(unsigned mask) {
+    unsigned added = mask & ~kinds;
+    if (!added) return;
+    if (added & FeatureColor) colors.assign(capacity * colorStride, 0.0f);
+    if (added & FeatureStdDev) stddevs.assign(capacity * stddevStride, 0.0f);
+    if (added & FeatureGradient) gradients.assign(capacity * gradientStride, 0.0f);
+    if (added & FeatureTexture) textures.assign(capacity * textureStride, 0.0f);
+    kinds |= added;
+}
+
+//изменение кол-ва строк
+void FeatureStore::resize(size_t newRows) {
+    if (newRows > capacity) {
+        reallocate(newRows);
+    }
+    else if (newRows < rows) {
+        //освобождаемые строки обнуляются, чтобы повторно добавленные строки были чистыми
+        for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+            if (!(kinds & bit)) continue;
+            FeatureKind kind = static_cast<FeatureKind>(bit);
+            size_t stride = strideOf(kind);
+            std::memset(data(kind, newRows), 0, (rows - newRows) * stride * sizeof(float));
+        }
+    }
+    rows = newRows;
+}
+
+//резервирование строк без изменения размера
+void FeatureStore::reserve(size_t newRows) {
+    if (newRows > capacity) {
+        reallocate(newRows);
+    }
+}
+
+//добавление обнуленной строки (емкость растет вдвое)
+size_t FeatureStore::addRow() {
+    if (rows == capacity) {
+        reallocate(std::max<size_t>(16, capacity * 2));
+    }
+    return rows++;
+}
+
+//удаление всех строк и видов признаков
+void FeatureStore::clear() {
+    rows = 0;
+    capacity = 0;
+    kinds = 0;
+    colors = AlignedFloats();
+    stddevs = AlignedFloats();
+    gradients = AlignedFloats();
+    textures = AlignedFloats();
+}
+
+//копирование строки другого хранилища
+void FeatureStore::copyRow(const FeatureStore& source, size_t sourceRow, size_t row) {
+    unsigned common = kinds & source.kinds;
+    for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+        if (!(common & bit)) continue;
+        FeatureKind kind = static_cast<FeatureKind>(bit);
+        std::memcpy(data(kind, row), source.data(kind, sourceRow), strideOf(kind) * sizeof(float));
+    }
+}
+
+//память, занятая признаками, в байтах
+size_t FeatureStore::memoryBytes(unsigned mask) const {
+    size_t bytes = 0;
+    if (mask & FeatureColor) bytes += colors.capacity() * sizeof(float);
+    if (mask & FeatureStdDev) bytes += stddevs.capacity() * sizeof(float);
+    if (mask & FeatureGradient) bytes += gradients.capacity() * sizeof(float);
+    if (mask & FeatureTexture) bytes += textures.capacity() * sizeof(float);
+    return bytes;
+}
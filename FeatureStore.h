@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+//виды признаков (битовая маска): метрика сообщает, какие признаки ей нужны
+enum FeatureKind : unsigned {
+    FeatureColor = 1u << 0,//средний цвет
+    FeatureStdDev = 1u << 1,//стандартное отклонение (контрастность)
+    FeatureGradient = 1u << 2,//гистограмма направлений градиентов
+    FeatureTexture = 1u << 3,//гистограмма LBP-кодов
+    FeatureAll = FeatureColor | FeatureStdDev | FeatureGradient | FeatureTexture
+};
+
+//аллокатор с выравниванием (для загрузки признаков векторными инструкциями)
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) {
+        void* ptr = ::operator new(count * sizeof(T), std::align_val_t(Alignment));
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) {
+        ::operator delete(ptr, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+//выровненный массив float
+using AlignedFloats = std::vector<float, AlignedAllocator<float>>;
+
+//хранилище признаков в виде структуры массивов
+//каждый вид признака - отдельный сплошной выровненный массив float; строка i - признаки i-го тайла (или клетки),
+//шаг строки дополнен нулями до кратного 4 float, поэтому строка целиком читается векторными инструкциями
+class FeatureStore {
+public:
+    static constexpr int colorSize = 4;//каналы среднего цвета (B, G, R, 0)
+    static constexpr int stddevSize = 4;//каналы отклонения (B, G, R, 0)
+    static constexpr int gradientBins = 36;//бины гистограммы градиентов
+    static constexpr int textureBins = 256;//бины гистограммы LBP
+    static constexpr int colorStride = 4;//шаг строки среднего цвета
+    static constexpr int stddevStride = 4;//шаг строки отклонения
+    static constexpr int gradientStride = 40;//шаг строки гистограммы градиентов (36 -> 40)
+    static constexpr int textureStride = 256;//шаг строки гистограммы LBP
+
+private:
+    size_t rows = 0;//кол-во строк
+    size_t capacity = 0;//выделенное кол-во строк
+    unsigned kinds = 0;//выделенные виды признаков
+    AlignedFloats colors;//средние цвета (rows * colorStride)
+    AlignedFloats stddevs;//отклонения (rows * stddevStride)
+    AlignedFloats gradients;//гистограммы градиентов (rows * gradientStride)
+    AlignedFloats textures;//гистограммы LBP (rows * textureStride)
+
+    //изменение выделенного кол-ва строк для всех выделенных видов
+    void reallocate(size_t newCapacity);
+
+public:
+    //шаг строки для вида признака
+    static int strideOf(FeatureKind kind);
+    //полезный размер строки для вида признака
+    static int sizeOf(FeatureKind kind);
+
+    //кол-во строк
+    size_t size() const { return rows; }
+    //выделенные виды признаков
+    unsigned allocatedKinds() const { return kinds; }
+    //проверка наличия всех видов из маски
+    bool has(unsigned mask) const { return (kinds & mask) == mask; }
+
+    //выделение массивов для видов из маски (новые значения обнуляются)
+    void require(unsigned mask);
+    //изменение кол-ва строк (новые строки обнуляются)
+    void resize(size_t newRows);
+    //резервирование строк без изменения размера
+    void reserve(size_t newRows);
+    //добавление обнуленной строки, возвращает ее индекс
+    size_t addRow();
+    //удаление всех строк и видов признаков
+    void clear();
+    //копирование строки другого хранилища (виды, выделенные в обоих)
+    void copyRow(const FeatureStore& source, size_t sourceRow, size_t row);
+
+    //память, занятая признаками вида (или всеми видами маски), в байтах
+    size_t memoryBytes(unsigned mask = FeatureAll) const;
+
+    //доступ к строкам признаков
+    float* color(size_t row) { return colors.data() + row * colorStride; }
+    const float* color(size_t row) const { return colors.data() + row * colorStride; }
+    float* stddev(size_t row) { return stddevs.data() + row * stddevStride; }
+    const float* stddev(size_t row) const { return stddevs.data() + row * stddevStride; }
+    float* gradient(size_t row) { return gradients.data() + row * gradientStride; }
+    const float* gradient(size_t row) const { return gradients.data() + row * gradientStride; }
+    float* texture(size_t row) { return textures.data() + row * textureStride; }
+    const float* texture(size_t row) const { return textures.data() + row * textureStride; }
+
+    //строка признака по виду
+    float* data(FeatureKind kind, size_t row);
+    const float* data(FeatureKind kind, size_t row) const;
+};
@@ -0,0 +1,216 @@
+#include "ImageBands.h"
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <vector>
+
+//класс MatBandReader
+bool MatBandReader::read(int y, int rows, cv::Mat& band) {
+    if (y < 0 || rows < 0 || y + rows > image.rows) return false;
+    band = image.rowRange(y, y + rows).clone();
+    return true;
+}
+
+//класс MatBandWriter
+bool MatBandWriter::open(const cv::Size& size, int type) {
+    result.create(size.height, size.width, type);
+    written = 0;
+    return true;
+}
+
+bool MatBandWriter::write(const cv::Mat& band) {
+    if (band.type() != result.type() || band.cols != result.cols || written + band.rows > result.rows) return false;
+    band.copyTo(result.rowRange(written, written + band.rows));
+    written += band.rows;
+    return true;
+}
+
+//класс PpmBandReader
+namespace {
+
+//следующее число заголовка PNM (пробелы и комментарии # до конца строки пропускаются)
+bool readHeaderNumber(std::ifstream& in, int& value) {
+    int c = in.get();
+    while (in && (std::isspace(c) || c == '#')) {
+        if (c == '#') {
+            while (in && c != '\n') c = in.get();
+        }
+        c = in.get();
+    }
+    if (!in || !std::isdigit(c)) return false;
+    long long number = 0;
+    while (in && std::isdigit(c)) {
+        number = number * 10 + (c - '0');
+        if (number > 1000000000) return false;
+        c = in.get();
+    }
+    value = static_cast<int>(number);
+    //после числа - ровно один пробельный символ (после maxval с него начинаются пиксели)
+    return in && std::isspace(c);
+}
+
+}
+
+bool PpmBandReader::open(const fs::path& path) {
+    in.close();
+    in.clear();
+    in.open(path, std::ios::binary);
+    if (!in) return false;
+    char magic[2] = {};
+    in.read(magic, 2);
+    int width = 0, height = 0, maxValue = 0;
+    if (!in || magic[0] != 'P' || magic[1] != '6' ||
+        !readHeaderNumber(in, width) || !readHeaderNumber(in, height) || !readHeaderNumber(in, maxValue) ||
+        width <= 0 || height <= 0 || maxValue != 255) {
+        in.close();
+        return false;
+    }
+    imageSize = cv::Size(width, height);
+    dataOffset = in.tellg();
+    return true;
+}
+
+//строки файла хранятся в порядке RGB, изображение возвращается в BGR
+bool PpmBandReader::read(int y, int rows, cv::Mat& band) {
+    if (!in.is_open() || y < 0 || rows < 0 || y + rows > imageSize.height) return false;
+    band.create(rows, imageSize.width, CV_8UC3);
+    const std::streamoff rowBytes = static_cast<std::streamoff>(imageSize.width) * 3;
+    in.clear();
+    in.seekg(dataOffset + y * rowBytes);
+    for (int r = 0; r < rows; ++r) {
+        uchar* row = band.ptr<uchar>(r);
+        in.read(reinterpret_cast<char*>(row), rowBytes);
+        if (!in) return false;
+        for (int x = 0; x < imageSize.width; ++x) std::swap(row[3 * x], row[3 * x + 2]);
+    }
+    return true;
+}
+
+//класс TiffBandWriter
+namespace {
+
+template <typename T>
+void writeValue(std::ofstream& out, T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+}
+
+uint64_t TiffBandWriter::storeValues(const std::vector<uint64_t>& values, size_t typeSize) {
+    //значения в поле размещаются с младших байтов (порядок байтов little-endian)
+    if (values.size() * typeSize <= (bigTiff ? 8u : 4u)) {
+        uint64_t packed = 0;
+        for (size_t i = 0; i < values.size(); ++i) packed |= values[i] << (8 * typeSize * i);
+        return packed;
+    }
+    uint64_t position = static_cast<uint64_t>(out.tellp());
+    for (uint64_t value : values) out.write(reinterpret_cast<const char*>(&value), typeSize);
+    return position;
+}
+
+void TiffBandWriter::writeTag(uint16_t tag, uint16_t type, uint64_t count, uint64_t value) {
+    writeValue(out, tag);
+    writeValue(out, type);
+    if (bigTiff) {
+        writeValue(out, count);
+        writeValue(out, value);
+    }
+    else {
+        writeValue(out, static_cast<uint32_t>(count));
+        writeValue(out, static_cast<uint32_t>(value));
+    }
+}
+
+bool TiffBandWriter::open(const cv::Size& size, int type) {
+    if (type != CV_8UC3 && type != CV_8UC1) return false;
+    if (size.width <= 0 || size.height <= 0) return false;
+    channels = type == CV_8UC3 ? 3 : 1;
+    imageSize = size;
+    written = 0;
+    //пиксели + таблицы полос + каталог должны адресоваться 32-битными смещениями, иначе - BigTIFF
+    uint64_t total = 8 + static_cast<uint64_t>(size.width) * size.height * channels + 8ull * size.height + 512;
+    bigTiff = forceBigTiff || total > 0xFFFFFFFFull;
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    //заголовок: порядок байтов "II", 42 (BigTIFF: 43, размер смещения 8 и 0), смещение каталога (заполняется в close)
+    out.write("II", 2);
+    if (bigTiff) {
+        writeValue(out, static_cast<uint16_t>(43));
+        writeValue(out, static_cast<uint16_t>(8));
+        writeValue(out, static_cast<uint16_t>(0));
+        writeValue(out, static_cast<uint64_t>(0));
+    }
+    else {
+        writeValue(out, static_cast<uint16_t>(42));
+        writeValue(out, static_cast<uint32_t>(0));
+    }
+    rowBuffer.resize(static_cast<size_t>(size.width) * channels);
+    return static_cast<bool>(out);
+}
+
+bool TiffBandWriter::write(const cv::Mat& band) {
+    if (!out.is_open() || band.cols != imageSize.width || band.channels() != channels || band.depth() != CV_8U ||
+        written + band.rows > imageSize.height) return false;
+    for (int r = 0; r < band.rows; ++r) {
+        const uchar* row = band.ptr<uchar>(r);
+        if (channels == 3) {
+            for (int x = 0; x < imageSize.width; ++x) {
+                rowBuffer[3 * x] = row[3 * x + 2];
+                rowBuffer[3 * x + 1] = row[3 * x + 1];
+                rowBuffer[3 * x + 2] = row[3 * x];
+            }
+            out.write(reinterpret_cast<const char*>(rowBuffer.data()), rowBuffer.size());
+        }
+        else {
+            out.write(reinterpret_cast<const char*>(row), imageSize.width);
+        }
+    }
+    written += band.rows;
+    return static_cast<bool>(out);
+}
+
+//таблицы полос (смещения и размеры строк), значения BitsPerSample и каталог с тегами по возрастанию номера
+bool TiffBandWriter::close() {
+    if (!out.is_open()) return false;
+    bool complete = written == imageSize.height;
+    const uint64_t dataOffset = bigTiff ? 16 : 8;
+    const uint64_t rowBytes = static_cast<uint64_t>(imageSize.width) * channels;
+    const uint64_t rows = static_cast<uint64_t>(imageSize.height);
+    //значения за пределами каталога начинаются с четного смещения
+    if (out.tellp() % 2) out.put(0);
+
+    std::vector<uint64_t> values(rows);
+    for (uint64_t r = 0; r < rows; ++r) values[r] = dataOffset + r * rowBytes;
+    uint64_t offsetsField = storeValues(values, bigTiff ? 8 : 4);
+    std::fill(values.begin(), values.end(), rowBytes);
+    uint64_t countsField = storeValues(values, 4);
+    uint64_t bitsField = storeValues(std::vector<uint64_t>(channels, 8), 2);
+    if (out.tellp() % 2) out.put(0);
+
+    uint64_t directory = static_cast<uint64_t>(out.tellp());
+    if (bigTiff) writeValue(out, static_cast<uint64_t>(10));
+    else writeValue(out, static_cast<uint16_t>(10));
+    writeTag(256, 4, 1, static_cast<uint64_t>(imageSize.width));//ImageWidth
+    writeTag(257, 4, 1, rows);//ImageLength
+    writeTag(258, 3, channels, bitsField);//BitsPerSample
+    writeTag(259, 3, 1, 1);//Compression: нет
+    writeTag(262, 3, 1, channels == 3 ? 2 : 1);//PhotometricInterpretation: RGB или BlackIsZero
+    writeTag(273, bigTiff ? 16 : 4, rows, offsetsField);//StripOffsets
+    writeTag(277, 3, 1, static_cast<uint64_t>(channels));//SamplesPerPixel
+    writeTag(278, 4, 1, 1);//RowsPerStrip
+    writeTag(279, 4, rows, countsField);//StripByteCounts
+    writeTag(284, 3, 1, 1);//PlanarConfiguration: каналы чередуются
+    if (bigTiff) writeValue(out, static_cast<uint64_t>(0));
+    else writeValue(out, static_cast<uint32_t>(0));
+
+    if (bigTiff) {
+        out.seekp(8);
+        writeValue(out, directory);
+    }
+    else {
+        out.seekp(4);
+        writeValue(out, static_cast<uint32_t>(directory));
+    }
+    out.close();
+    return complete && !out.fail();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <opencv2/opencv.hpp>
+
+namespace fs = std::filesystem;
+
+//источник изображения, читаемого горизонтальными полосами (строки можно читать повторно и в любом порядке)
+class ImageBandReader {
+public:
+    virtual ~ImageBandReader() = default;
+    //размер всего изображения
+    virtual cv::Size size() const = 0;
+    //тип пикселей (CV_8UC3 - BGR)
+    virtual int type() const = 0;
+    //чтение строк [y, y + rows) в band (отдельная матрица rows x width), false при ошибке чтения
+    virtual bool read(int y, int rows, cv::Mat& band) = 0;
+};
+
+//приемник изображения, записываемого полосами сверху вниз
+class ImageBandWriter {
+public:
+    virtual ~ImageBandWriter() = default;
+    //начало записи изображения заданного размера и типа
+    virtual bool open(const cv::Size& size, int type) = 0;
+    //запись следующих band.rows строк
+    virtual bool write(const cv::Mat& band) = 0;
+    //завершение записи (все строки должны быть записаны)
+    virtual bool close() = 0;
+};
+
+//полосы изображения, уже находящегося в памяти
+class MatBandReader : public ImageBandReader {
+private:
+    cv::Mat image;//изображение (без копирования)
+
+public:
+    explicit MatBandReader(const cv::Mat& image) : image(image) {}
+    cv::Size size() const override { return image.size(); }
+    int type() const override { return image.type(); }
+    bool read(int y, int rows, cv::Mat& band) override;
+};
+
+//сборка полос в изображение в памяти
+class MatBandWriter : public ImageBandWriter {
+private:
+    cv::Mat result;//собранное изображение
+    int written = 0;//кол-во записанных строк
+
+public:
+    bool open(const cv::Size& size, int type) override;
+    bool write(const cv::Mat& band) override;
+    bool close() override { return written == result.rows; }
+    //собранное изображение
+    const cv::Mat& image() const { return result; }
+};
+
+//двоичный PPM (P6, 8 бит на канал): строки читаются прямо из файла по смещению, без загрузки всего изображения
+class PpmBandReader : public ImageBandReader {
+private:
+    std::ifstream in;//открытый файл
+    cv::Size imageSize;//размер изображения
+    std::streamoff dataOffset = 0;//смещение первой строки пикселей
+
+public:
+    //открытие файла и разбор заголовка, false если файл не двоичный 8-битный PPM
+    bool open(const fs::path& path);
+    cv::Size size() const override { return imageSize; }
+    int type() const override { return CV_8UC3; }
+    bool read(int y, int rows, cv::Mat& band) override;
+};
+
+//запись несжатого TIFF (8 бит на канал, BGR или оттенки серого) по мере поступления строк:
+//каждая строка - отдельная полоса TIFF, таблицы полос и каталог пишутся в конце файла;
+//файл до 4 ГБ - классический TIFF, больше (крупные мозаики с увеличением) - BigTIFF с 64-битными смещениями
+class TiffBandWriter : public ImageBandWriter {
+private:
+    fs::path path;//путь к файлу
+    std::ofstream out;//выходной файл
+    cv::Size imageSize;//размер изображения
+    int channels = 0;//кол-во каналов
+    int written = 0;//кол-во записанных строк
+    std::vector<uchar> rowBuffer;//строка в порядке каналов RGB
+    bool forceBigTiff = false;//BigTIFF при любом размере
+    bool bigTiff = false;//текущий файл пишется в формате BigTIFF
+
+    //запись значений тега: в поле каталога, если помещаются (4 байта в TIFF, 8 в BigTIFF), иначе в файл
+    //перед каталогом; возвращает значение поля (сами значения или их смещение)
+    uint64_t storeValues(const std::vector<uint64_t>& values, size_t typeSize);
+    //запись элемента каталога: тег, тип (3 - SHORT, 4 - LONG, 16 - LONG8), кол-во значений и поле значения
+    void writeTag(uint16_t tag, uint16_t type, uint64_t count, uint64_t value);
+
+public:
+    //bigTiff - писать BigTIFF и для файлов меньше 4 ГБ
+    explicit TiffBandWriter(const fs::path& path, bool bigTiff = false) : path(path), forceBigTiff(bigTiff) {}
+    bool open(const cv::Size& size, int type) override;
+    bool write(const cv::Mat& band) override;
+    bool close() override;
+    //файл пишется в формате BigTIFF (известно после open)
+    bool isBigTiff() const { return bigTiff; }
+    //размер записываемого изображения (известен после open)
+    cv::Size size() const { return imageSize; }
+};
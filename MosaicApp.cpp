@@ -2,7 +2,8 @@
 
 //класс GUI
 //инициализация
-GUI::GUI() : window(sf::VideoMode::getFullscreenModes()[0], "Mosaic Creator", sf::Style::Fullscreen) {
+GUI::GUI() : window(sf::VideoMode::getFullscreenModes()[0], "Mosaic Creator", sf::Style::Fullscreen),
+    session(std::make_shared<MosaicGenerator>()) {
     initializeColors();
     loadFont();
     //устанавливаем текущие значения
@@ -11,7 +12,7 @@ GUI::GUI() : window(sf::VideoMode::getFullscreenModes()[0], "Mosaic Creator", sf
     currentRotationAngle = 0;
     setupUI();
     //инициализация состояний и значений
-    checkboxStates = std::vector<bool>(5, false);
+    checkboxStates = std::vector<bool>(6, false);
     buttonStates = std::vector<bool>(3, false);
     metricButtonStates = std::vector<bool>(4, false);
     //активируем первую кнопку (по умолчанию метрика Color)
@@ -24,9 +25,27 @@ GUI::GUI() : window(sf::VideoMode::getFullscreenModes()[0], "Mosaic Creator", sf
     setupLoadingScreen();
 }
 
+//при закрытии окна во время генерации задача отменяется и рабочий поток дожидается
+GUI::~GUI() {
+    cancelGeneration();
+    if (generationThread.joinable()) {
+        generationThread.join();
+    }
+}
+
 void GUI::run() {
     while (window.isOpen()) {
         handleEvents();
+        //результат фоновой генерации забирается в GUI-потоке (текстуры SFML создаются здесь)
+        if (previewReady) {
+            showPreview();
+        }
+        if (generationFinished) {
+            finishGeneration();
+        }
+        if (showLoading) {
+            updateProgress();
+        }
         render();
         if (showMessageFlag && messageTimer.getElapsedTime() > messageDuration) {
             showMessageFlag = false;
@@ -67,6 +86,8 @@ void GUI::setupUI() {
     createCheckbox("Color correction", 20, 760);
     createCheckbox("Seam smoothing", 20, 830);
     createCheckbox("Alpha-blend", 20, 900);
+    //чекбокс предпросмотра - под кнопкой создания мозаики
+    createCheckbox("Live preview", 20, 188);
 
     //скрытое поле ввода угла поворота
     rotationAngleLabel = createText("Rotation Angle: " + std::to_string(currentRotationAngle), 20, 720, 18);
@@ -258,7 +279,7 @@ void GUI::showMessage(const std::string& message, bool isError) {
 //функция для Loading...
 void GUI::setupLoadingScreen() {
     //фон для загрузки
-    loadingBackground.setSize(sf::Vector2f(200, 80));
+    loadingBackground.setSize(sf::Vector2f(460, 150));
     loadingBackground.setFillColor(sf::Color(31, 65, 114, 90)); //с прозрачностью
     loadingBackground.setOutlineThickness(2);
     loadingBackground.setOutlineColor(sf::Color(31, 65, 114));
@@ -266,9 +287,17 @@ void GUI::setupLoadingScreen() {
     //текст загрузки
     loadingText.setFont(font);
     loadingText.setString("Loading...");
-    loadingText.setCharacterSize(24);
+    loadingText.setCharacterSize(20);
     loadingText.setFillColor(sf::Color::White);
 
+    //полоса прогресса: рамка и заполнение
+    progressBarFrame.setSize(sf::Vector2f(400, 20));
+    progressBarFrame.setFillColor(sf::Color::Transparent);
+    progressBarFrame.setOutlineThickness(2);
+    progressBarFrame.setOutlineColor(sf::Color::White);
+    progressBarFill.setSize(sf::Vector2f(0, 20));
+    progressBarFill.setFillColor(sf::Color(253, 240, 240));
+
     //центрируем оба элемента
     centerLoadingScreen();
 }
@@ -282,7 +311,11 @@ void GUI::centerLoadingScreen() {
 
     sf::FloatRect textBounds = loadingText.getLocalBounds();
     loadingText.setPosition(windowWidth / 2 - textBounds.width / 2,
-        windowHeight / 2 - textBounds.height / 2);
+        windowHeight / 2 - loadingBackground.getSize().y / 2 + 15);
+
+    progressBarFrame.setPosition(windowWidth / 2 - progressBarFrame.getSize().x / 2,
+        windowHeight / 2 + loadingBackground.getSize().y / 2 - 40);
+    progressBarFill.setPosition(progressBarFrame.getPosition());
 }
 
 //создание основной кнопки интерфейса
@@ -417,6 +450,8 @@ void GUI::handleButtonClick(int buttonIndex) {
                 displayPath = "..." + displayPath.substr(displayPath.length() - 37);
             }
             selectedFolderText.setString("Folder: " + displayPath);
+            //повторный выбор папки перечитывает тайлы (содержимое могло измениться)
+            session->clearTiles();
 
             int imageCount = 0;//счетчик кол-ва изображений в папке
             try {
@@ -464,116 +499,11 @@ void GUI::handleButtonClick(int buttonIndex) {
             break;
         }
 
-        showLoading = true;//показываем экран загрузки
-        render();//принудительная отрисовка, чтоб отобразилась загрузка
-        //создаем генератор мозаики и конфигурацию
-        MosaicGenerator gen;
+        //настройки копируются в задачу, генерация идет в рабочем потоке, окно продолжает отрисовываться
         Config cfg;
-        //устанавливаем параметры из текущих настроек GUI
-        cfg.tileSize = currentTileSize;
-        cfg.gridStep = currentStepSize;
-        cfg.repeats = checkboxStates[0];
-        cfg.rotation = checkboxStates[1];
-        cfg.metric = getSelectedMetric();
-
-        if (cfg.repeats) {
-            if (currentMaxRepeats == "MAX") {
-                cfg.maxRepeats = std::numeric_limits<int>::max();
-            }
-            else {
-                cfg.maxRepeats = std::stoi(currentMaxRepeats);
-                if (cfg.maxRepeats <= 0) cfg.maxRepeats = 1;
-            }
-        }
-        else {
-            cfg.maxRepeats = std::numeric_limits<int>::max();
-        }
-
-        if (cfg.rotation) {
-            cfg.rotationAngle = currentRotationAngle;
-        }
-        else {
-            cfg.rotationAngle = 0.0;
-        }
-        //настройка пост-обработки
         PostProcessConfig postCfg;
-        postCfg.gridSize = cfg.gridStep;
-        //добавляем эффекты пост-обработки из чекбоксов
-        if (checkboxStates[2]) postCfg.addEffect("color_correction", 0.5);
-        if (checkboxStates[3]) postCfg.addEffect("seam_smoothing", 0.7);
-        if (checkboxStates[4]) postCfg.addEffect("alpha_blend", 0.5);
-        //сеттер конфигурации пост-обработки
-        gen.setPostProcessConfig(postCfg);
-
-        std::string tilesDir = selectedTilesFolderPath;
-        std::string inputImage = selectedImagePath;
-        //загружаем тайлы для мозаики
-        if (!gen.loadTiles(tilesDir, cfg.tileSize, cfg.rotation, cfg.rotationAngle)) {
-            showMessage("ERROR: Failed to load tiles from: " + tilesDir, true);
-            showLoading = false;
-            break;
-        }
-        //проверяем, что тайлы загружены
-        if (gen.getTilesCount() == 0) {
-            showMessage("ERROR: Loaded 0 tiles. Check path and size.", true);
-            showLoading = false;
-            break;
-        }
-        //загружаем исходное изображение
-        cv::Mat source = cv::imread(inputImage);
-        if (source.empty()) {
-            showMessage("ERROR: Cannot load source image: " + inputImage, true);
-            showLoading = false;
-            break;
-        }
-        //создаем мозаику
-        cv::Mat result;
-        try {
-            result = gen.createMosaic(source, cfg);
-        }
-        catch (const std::exception& e) {
-            showMessage("ERROR during generation: " + std::string(e.what()), true);
-            showLoading = false;
-            break;
-        }
-
-        showLoading = false;//скрываем экран загрузки
-        render();
-
-        if (!result.empty()) {
-            //конвертируем из BGR (OpenCV) в RGBA (SFML)
-            cv::Mat resultRGBA;
-            cv::cvtColor(result, resultRGBA, cv::COLOR_BGR2RGBA);
-            //создаем текстуру для отображения результата
-            sf::Texture newMosaicTexture;
-            if (newMosaicTexture.create(resultRGBA.cols, resultRGBA.rows)) {
-                newMosaicTexture.update(resultRGBA.data);
-                mosaicTexture = newMosaicTexture;
-                mosaicSprite.setTexture(mosaicTexture, true);
-                //вычисляем масштаб для отображения
-                float scaleX = 400.0f / mosaicTexture.getSize().x;
-                float scaleY = 300.0f / mosaicTexture.getSize().y;
-                float scale = std::min(scaleX, scaleY); //сохраняем пропорции
-
-                mosaicSprite.setScale(scale, scale);//применяем масштаб
-                mosaicSprite.setPosition(350, 140);//положение изображения
-
-                currentMosaicResult = result.clone();//сохраняем результат
-
-                viewMosaicButton.setFillColor(buttonColor);
-
-                showMosaicImage = true;//показываем мозаику
-                showOriginalImage = false;//скрываем исходное изображение
-
-                showMessage("Mosaic created successfully!");
-            }
-            else {
-                showMessage("ERROR: Cannot create mosaic texture!", true);
-            }
-        }
-        else {
-            showMessage("ERROR: Mosaic generation failed (empty result).", true);
-        }
+        collectSettings(cfg, postCfg);
+        startGeneration(cfg, postCfg, checkboxStates[5]);
         break;
     }
     case 3: {//Download - сохранение результата
@@ -606,6 +536,281 @@ void GUI::handleButtonClick(int buttonIndex) {
     }
 }
 
+//настройки генерации и постобработки из текущего состояния интерфейса
+void GUI::collectSettings(Config& cfg, PostProcessConfig& postCfg) const {
+    //устанавливаем параметры из текущих настроек GUI
+    cfg.tileSize = currentTileSize;
+    cfg.gridStep = currentStepSize;
+    cfg.repeats = checkboxStates[0];
+    cfg.rotation = checkboxStates[1];
+    cfg.metric = getSelectedMetric();
+
+    if (cfg.repeats) {
+        if (currentMaxRepeats == "MAX") {
+            cfg.maxRepeats = std::numeric_limits<int>::max();
+        }
+        else {
+            cfg.maxRepeats = std::stoi(currentMaxRepeats);
+            if (cfg.maxRepeats <= 0) cfg.maxRepeats = 1;
+        }
+    }
+    else {
+        cfg.maxRepeats = std::numeric_limits<int>::max();
+    }
+
+    if (cfg.rotation) {
+        cfg.rotationAngle = currentRotationAngle;
+    }
+    else {
+        cfg.rotationAngle = 0.0;
+    }
+    //настройка пост-обработки
+    postCfg.gridSize = cfg.gridStep;
+    //добавляем эффекты пост-обработки из чекбоксов
+    if (checkboxStates[2]) postCfg.addEffect("color_correction", 0.5);
+    if (checkboxStates[3]) postCfg.addEffect("seam_smoothing", 0.7);
+    if (checkboxStates[4]) postCfg.addEffect("alpha_blend", 0.5);
+}
+
+//запуск фоновой генерации в сессии: рабочий поток загружает тайлы, только если изменились папка, размер
+//или поворот, и создает мозаику (в режиме предпросмотра - сначала уровни уменьшенного изображения);
+//GUI-поток следит за ходом через activeGenerator и забирает результат в finishGeneration
+void GUI::startGeneration(const Config& cfg, const PostProcessConfig& postCfg, bool preview) {
+    activeGenerator = session;
+    activeGenerator->resetProgress();
+    generationFinished = false;
+    generationResult.release();
+    generationError.clear();
+    generationNotice.clear();
+    generationCancelled = false;
+    generationPreview = preview;
+    restartPending = false;
+    previewReady = false;
+    showLoading = true;//показываем экран загрузки
+
+    std::shared_ptr<MosaicGenerator> gen = activeGenerator;
+    std::string tilesDir = selectedTilesFolderPath;
+    std::string inputImage = selectedImagePath;
+    generationThread = std::thread([this, gen, cfg, postCfg, tilesDir, inputImage, preview] {
+        cv::Mat result;
+        std::string error;
+        std::string notice;
+        bool cancelled = false;
+        try {
+            //сеттер конфигурации пост-обработки
+            gen->setPostProcessConfig(postCfg);
+            //метрика задается до загрузки тайлов, чтобы признаки брались из дискового кэша;
+            //для уже загруженных тайлов при генерации досчитываются только недостающие виды признаков
+            gen->setMetric(cfg.metric);
+            //загружаем тайлы для мозаики, если сессия еще не держит их с такими параметрами
+            bool loadNeeded = !gen->hasTiles(tilesDir, cfg.tileSize, cfg.rotation, cfg.rotationAngle);
+            if (loadNeeded && !gen->loadTiles(tilesDir, cfg.tileSize, cfg.rotation, cfg.rotationAngle)) {
+                cancelled = gen->getProgress().cancelled;
+                if (!cancelled) error = "ERROR: Failed to load tiles from: " + tilesDir;
+            }
+            //проверяем, что тайлы загружены
+            else if (gen->getTilesCount() == 0) {
+                error = "ERROR: Loaded 0 tiles. Check path and size.";
+            }
+            else {
+                //ошибка записи кэша тайлов не мешает генерации, о ней сообщается вместе с результатом
+                if (loadNeeded && gen->lastCacheSaveFailed()) {
+                    notice = "Warning: tile cache could not be saved.";
+                }
+                //загружаем исходное изображение
+                cv::Mat source = cv::imread(inputImage);
+                if (source.empty()) {
+                    error = "ERROR: Cannot load source image: " + inputImage;
+                }
+                else {
+                    //уровни предпросмотра от грубого к полному: каждый уровень выкладывается для отображения
+                    std::vector<int> factors = preview ? MosaicGenerator::previewFactors(source.size(), cfg.gridStep) : std::vector<int>{ 1 };
+                    for (size_t level = 0; level + 1 < factors.size(); ++level) {
+                        cv::Mat coarse = gen->createPreview(source, cfg, factors[level]);
+                        {
+                            std::lock_guard<std::mutex> lock(generationMutex);
+                            previewResult = std::move(coarse);
+                            previewStatus = "Preview " + std::to_string(level + 1) + "/" + std::to_string(factors.size()) + ", refining...";
+                        }
+                        previewReady = true;
+                    }
+                    //создаем мозаику
+                    result = gen->createMosaic(source, cfg);
+                }
+            }
+        }
+        catch (const GenerationCancelled&) {
+            cancelled = true;
+        }
+        catch (const std::exception& e) {
+            error = "ERROR during generation: " + std::string(e.what());
+        }
+        {
+            std::lock_guard<std::mutex> lock(generationMutex);
+            generationResult = std::move(result);
+            generationError = error;
+            generationNotice = notice;
+            generationCancelled = cancelled;
+        }
+        generationFinished = true;
+    });
+}
+
+//запрос отмены текущей задачи (рабочий поток завершится на ближайшей проверке)
+void GUI::cancelGeneration() {
+    restartPending = false;
+    if (activeGenerator) {
+        activeGenerator->cancel();
+    }
+}
+
+//смена настройки: в режиме предпросмотра текущая задача отменяется, а после ее завершения запускается новая
+void GUI::onSettingsChanged() {
+    if (!checkboxStates[5] || selectedImagePath.empty() || selectedTilesFolderPath.empty()) return;
+    if (isGenerating()) {
+        cancelGeneration();
+        restartPending = true;
+        return;
+    }
+    Config cfg;
+    PostProcessConfig postCfg;
+    collectSettings(cfg, postCfg);
+    startGeneration(cfg, postCfg, true);
+}
+
+//отображение уровня предпросмотра: экран загрузки скрывается, уточнение продолжается в фоне
+void GUI::showPreview() {
+    previewReady = false;
+    cv::Mat preview;
+    std::string status;
+    {
+        std::lock_guard<std::mutex> lock(generationMutex);
+        preview = std::move(previewResult);
+        status = previewStatus;
+    }
+    if (preview.empty()) return;
+    showLoading = false;
+    showMosaicResult(std::move(preview), status);
+}
+
+//завершение задачи: поток присоединяется, мозаика забирается перемещением (без копирования пикселей)
+void GUI::finishGeneration() {
+    if (generationThread.joinable()) {
+        generationThread.join();
+    }
+    generationFinished = false;
+    previewReady = false;
+    activeGenerator.reset();
+    showLoading = false;//скрываем экран загрузки
+
+    cv::Mat result;
+    std::string error;
+    std::string notice;
+    bool cancelled;
+    {
+        std::lock_guard<std::mutex> lock(generationMutex);
+        result = std::move(generationResult);
+        error = std::move(generationError);
+        notice = std::move(generationNotice);
+        cancelled = generationCancelled;
+    }
+    //задача отменена сменой настройки - предпросмотр перезапускается с новыми настройками
+    if (cancelled && restartPending) {
+        restartPending = false;
+        onSettingsChanged();
+    }
+    else if (cancelled) {
+        showMessage("Mosaic generation cancelled");
+    }
+    else if (!error.empty()) {
+        showMessage(error, true);
+    }
+    else if (!notice.empty()) {
+        showMosaicResult(std::move(result), "Mosaic created successfully! " + notice);
+    }
+    else {
+        showMosaicResult(std::move(result));
+    }
+}
+
+//отображение готовой мозаики (или уровня предпросмотра) и сохранение ее для скачивания
+void GUI::showMosaicResult(cv::Mat result, const std::string& message) {
+    if (result.empty()) {
+        showMessage("ERROR: Mosaic generation failed (empty result).", true);
+        return;
+    }
+    //конвертируем из BGR (OpenCV) в RGBA (SFML)
+    cv::Mat resultRGBA;
+    cv::cvtColor(result, resultRGBA, cv::COLOR_BGR2RGBA);
+    //создаем текстуру для отображения результата
+    sf::Texture newMosaicTexture;
+    if (!newMosaicTexture.create(resultRGBA.cols, resultRGBA.rows)) {
+        showMessage("ERROR: Cannot create mosaic texture!", true);
+        return;
+    }
+    newMosaicTexture.update(resultRGBA.data);
+    mosaicTexture = newMosaicTexture;
+    mosaicSprite.setTexture(mosaicTexture, true);
+    //вычисляем масштаб для отображения
+    float scaleX = 400.0f / mosaicTexture.getSize().x;
+    float scaleY = 300.0f / mosaicTexture.getSize().y;
+    float scale = std::min(scaleX, scaleY); //сохраняем пропорции
+
+    mosaicSprite.setScale(scale, scale);//применяем масштаб
+    mosaicSprite.setPosition(350, 140);//положение изображения
+
+    currentMosaicResult = std::move(result);//сохраняем результат (матрица уже принадлежит GUI-потоку)
+
+    viewMosaicButton.setFillColor(buttonColor);
+
+    showMosaicImage = true;//показываем мозаику
+    showOriginalImage = false;//скрываем исходное изображение
+
+    showMessage(message);
+}
+
+//обновление текста и полосы прогресса по ходу генерации
+void GUI::updateProgress() {
+    if (!activeGenerator) return;
+    const GenerationProgress& progress = activeGenerator->getProgress();
+    float fraction = 0.0f;
+    std::string status;
+    switch (progress.stage.load()) {
+    case GenerationStage::LoadingTiles: {
+        size_t found = progress.tilesFound, loaded = progress.tilesLoaded;
+        fraction = found > 0 ? static_cast<float>(loaded) / found : 0.0f;
+        status = "Loading tiles: " + std::to_string(loaded) + " / " + std::to_string(found);
+        break;
+    }
+    case GenerationStage::Matching: {
+        size_t total = progress.cellsTotal, matched = progress.cellsMatched;
+        fraction = total > 0 ? static_cast<float>(matched) / total : 0.0f;
+        status = "Matching cells: " + std::to_string(matched) + " / " + std::to_string(total);
+        break;
+    }
+    case GenerationStage::Rendering:
+        fraction = 1.0f;
+        status = "Rendering mosaic...";
+        break;
+    case GenerationStage::PostProcessing:
+        fraction = 1.0f;
+        status = "Post-processing...";
+        break;
+    default:
+        status = "Loading...";
+        break;
+    }
+    if (progress.cancelled) {
+        status = "Cancelling...";
+    }
+    else {
+        status += "\nEsc or Create Mosaic - cancel";
+    }
+    loadingText.setString(status);
+    progressBarFill.setSize(sf::Vector2f(progressBarFrame.getSize().x * std::min(1.0f, fraction), progressBarFrame.getSize().y));
+    centerLoadingScreen();
+}
+
 //обработка клика по чекбоксу
 void GUI::handleCheckboxClick(int checkboxIndex) {
     //инвертируем состояние чекбокса
@@ -633,6 +838,10 @@ void GUI::handleCheckboxClick(int checkboxIndex) {
             maxRepeatsLabel.setString("Max Repeats: " + currentMaxRepeats);
         }
     }
+    //чекбокс предпросмотра сам задачу не перезапускает
+    if (checkboxIndex != 5) {
+        onSettingsChanged();
+    }
 }
 
 //обработка клика по кнопке выбора метрики
@@ -645,6 +854,7 @@ void GUI::handleMetricButtonClick(int metricIndex) {
     //активируем выбранную кнопку
     metricButtonStates[metricIndex] = true;
     metricButtons[metricIndex].setFillColor(sf::Color(180, 100, 100));
+    onSettingsChanged();
 }
 
 //запуск диалогового окна для ввода максимального количества повторов
@@ -804,6 +1014,7 @@ void GUI::updateTileSize() {
         currentTileSize = 20;
     }
     tileSizeLabel.setString("Tile Size: " + std::to_string(currentTileSize));
+    onSettingsChanged();
 }
 
 //обновление шага выборки мозаики
@@ -813,6 +1024,7 @@ void GUI::updateStepSize() {
         currentStepSize = 20;
     }
     stepSizeLabel.setString("Step Size: " + std::to_string(currentStepSize));
+    onSettingsChanged();
 }
 
 //обновление шага выборки мозаики
@@ -822,6 +1034,7 @@ void GUI::updateRotationAngle() {
         currentRotationAngle = 0;
     }
     rotationAngleLabel.setString("Rotation Angle: " + std::to_string(currentRotationAngle));
+    onSettingsChanged();
 }
 
 //обработка событий
@@ -831,14 +1044,30 @@ void GUI::handleEvents() {
         //обработка закрытия окна
         if (event.type == sf::Event::Closed)
             window.close();
-        //обработка нажатия клавиши Escape для закрытия окна
-        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape)
-            window.close();
+        //обработка нажатия клавиши Escape: отмена генерации или закрытие окна
+        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape) {
+            if (isGenerating()) {
+                cancelGeneration();
+            }
+            else {
+                window.close();
+            }
+        }
+        //во время генерации интерфейс не меняет настройки (кроме предпросмотра, который при смене настройки
+        //перезапускается), основные кнопки не работают, повторный клик по Create Mosaic отменяет задачу
+        if (isGenerating() && event.type == sf::Event::MouseButtonPressed) {
+            sf::Vector2i mousePos = sf::Mouse::getPosition(window);
+            if (buttons[2].getGlobalBounds().contains(mousePos.x, mousePos.y)) {
+                cancelGeneration();
+                continue;
+            }
+            if (!generationPreview) continue;
+        }
         //обработка нажатия кнопки мыши
         if (event.type == sf::Event::MouseButtonPressed) {
             sf::Vector2i mousePos = sf::Mouse::getPosition(window);
             //клик по основным кнопкам интерфейса
-            for (int i = 0; i < buttons.size(); ++i) {
+            for (int i = 0; i < buttons.size() && !isGenerating(); ++i) {
                 if (buttons[i].getGlobalBounds().contains(mousePos.x, mousePos.y)) {
                     handleButtonClick(i);
                     break;
@@ -877,6 +1106,7 @@ void GUI::handleEvents() {
                 if (newValue != currentMaxRepeats) {
                     currentMaxRepeats = newValue;
                     maxRepeatsLabel.setString("Max Repeats: " + currentMaxRepeats);
+                    onSettingsChanged();
                 }
             }
             //клик по кнопке просмотра оригинального изображения
@@ -988,6 +1218,8 @@ void GUI::render() {
     if (showLoading) {
         window.draw(loadingBackground);
         window.draw(loadingText);
+        window.draw(progressBarFrame);
+        window.draw(progressBarFill);
     }
     //отрисовка метки разрешения
     window.draw(resolutionLabel);
@@ -4,6 +4,10 @@
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include "MosaicProcessor.h"
 #include "PostProcessor.h"
@@ -64,8 +68,30 @@ private:
     //элементы загрузки
     sf::Text loadingText;
     sf::RectangleShape loadingBackground;
+    sf::RectangleShape progressBarFrame;
+    sf::RectangleShape progressBarFill;
     bool showLoading = false;
 
+    //фоновая генерация мозаики: рабочий поток загружает тайлы и создает мозаику,
+    //GUI-поток читает ход генерации и забирает результат по готовности
+    std::thread generationThread;
+    std::shared_ptr<MosaicGenerator> session;//генератор сессии: тайлы и признаки по метрикам сохраняются между запусками
+    std::shared_ptr<MosaicGenerator> activeGenerator;//генератор текущей задачи (ход и отмена)
+    std::atomic<bool> generationFinished{ false };//рабочий поток завершился
+    std::mutex generationMutex;//защита результата задачи
+    cv::Mat generationResult;//готовая мозаика (передается GUI-потоку без копирования пикселей)
+    std::string generationError;//сообщение об ошибке задачи (пусто - успех или отмена)
+    std::string generationNotice;//предупреждение успешной задачи (показывается вместе с результатом)
+    bool generationCancelled = false;//задача завершилась отменой
+
+    //живой предпросмотр: рабочий поток сначала создает мозаики уменьшенного изображения и выкладывает их по одной,
+    //затем уточняет до полной; смена настройки отменяет задачу и перезапускает ее с новыми настройками
+    bool generationPreview = false;//текущая задача - предпросмотр
+    bool restartPending = false;//задача отменена сменой настройки и будет перезапущена
+    std::atomic<bool> previewReady{ false };//выложен новый уровень предпросмотра
+    cv::Mat previewResult;//мозаика последнего уровня предпросмотра (защищена generationMutex)
+    std::string previewStatus;//описание уровня предпросмотра (защищено generationMutex)
+
     //пути к данным
     std::string selectedImagePath;
     std::string selectedTilesFolderPath;
@@ -102,6 +128,7 @@ private:
 
 public:
     GUI();
+    ~GUI();
     void run();
 
 private:
@@ -135,6 +162,21 @@ private:
     void updateRotationAngle();
     void updateResolutionFormat();
 
+    //фоновая генерация
+    bool isGenerating() const { return generationThread.joinable(); }
+    void startGeneration(const Config& cfg, const PostProcessConfig& postCfg, bool preview);
+    void cancelGeneration();
+    //завершение задачи в GUI-потоке: текстура результата или сообщение об ошибке
+    void finishGeneration();
+    void showMosaicResult(cv::Mat result, const std::string& message = "Mosaic created successfully!");
+    void updateProgress();
+    //отображение очередного уровня предпросмотра
+    void showPreview();
+    //реакция на смену настройки в режиме предпросмотра: перезапуск задачи с новыми настройками
+    void onSettingsChanged();
+    //настройки генерации и постобработки из текущего состояния интерфейса
+    void collectSettings(Config& cfg, PostProcessConfig& postCfg) const;
+
     //вспомогательные методы
     std::string getSelectedMetric() const;
     std::string runMaxRepeatsInput(const std::string& initialValue);
@@ -0,0 +1,1399 @@
+//бенчмарки ядра генерации мозаики
+//запуск: mosaic_bench [имя_бенчмарка ...] (без аргументов - все бенчмарки)
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MosaicProcessor.h"
+#include "SpatialIndex.h"
+#include "DistanceKernels.h"
+#include "TileAssignment.h"
+#include "SourceFeatureMap.h"
+#include "FeatureKernels.h"
+#include "TileRenderCache.h"
+#include "TileAtlas.h"
+#include "TileLibrary.h"
+#include "ImageBands.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+//время выполнения функции в миллисекундах
+double measureMs(const std::function<void()>& fn) {
+    auto start = Clock::now();
+    fn();
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+//случайные признаки цвета и контраста (как у тайлов 0..255)
+FeatureStore randomColorFeatures(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<float> color(0.0f, 255.0f);
+    std::uniform_real_distribution<float> contrast(0.0f, 80.0f);
+    FeatureStore result;
+    result.require(FeatureColor | FeatureStdDev);
+    result.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            result.color(i)[c] = color(rng);
+            result.stddev(i)[c] = contrast(rng);
+        }
+    }
+    return result;
+}
+
+//линейный поиск ближайшего тайла (как в исходном createRawMosaic)
+int linearNearest(const IMetric& metric, const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+    const std::vector<int>& usage, int maxRepeats) {
+    int bestIndex = -1;
+    double bestDistance = std::numeric_limits<double>::max();
+    for (int i = 0; i < static_cast<int>(tiles.size()); ++i) {
+        if (usage[i] < maxRepeats) {
+            double dist = metric.distance(cells, cell, tiles, i);
+            if (dist < bestDistance) {
+                bestDistance = dist;
+                bestIndex = i;
+            }
+        }
+    }
+    return bestIndex;
+}
+
+//сравнение VP-дерева с линейным поиском для метрик color и color_contrast
+//проверяет совпадение выбранных тайлов, в т.ч. с ограничением повторов
+bool benchSpatialIndex() {
+    std::mt19937 rng(12345);
+    const size_t tileCount = 20000;
+    const size_t cellCount = 20000;
+    FeatureStore tiles = randomColorFeatures(tileCount, rng);
+    FeatureStore cells = randomColorFeatures(cellCount, rng);
+
+    bool ok = true;
+    std::vector<std::unique_ptr<IMetric>> metrics;
+    metrics.push_back(std::make_unique<ColorMetric>());
+    metrics.push_back(std::make_unique<ColorContrastMetric>());
+
+    for (const auto& metric : metrics) {
+        for (int maxRepeats : { std::numeric_limits<int>::max(), 1 }) {
+            std::vector<int> linearPicks(cellCount), indexPicks(cellCount);
+            std::vector<int> usage(tileCount, 0);
+
+            double linearMs = measureMs([&] {
+                for (size_t c = 0; c < cellCount; ++c) {
+                    int best = linearNearest(*metric, cells, c, tiles, usage, maxRepeats);
+                    linearPicks[c] = best;
+                    if (best >= 0) usage[best]++;
+                }
+            });
+
+            VPTreeIndex index;
+            double buildMs = measureMs([&] { index.build(tiles, *metric); });
+            std::fill(usage.begin(), usage.end(), 0);
+            double indexMs = measureMs([&] {
+                for (size_t c = 0; c < cellCount; ++c) {
+                    int best = index.nearest(cells, c);
+                    indexPicks[c] = best;
+                    if (best >= 0 && ++usage[best] >= maxRepeats) index.remove(best);
+                }
+            });
+
+            size_t mismatches = 0;
+            for (size_t c = 0; c < cellCount; ++c) {
+                if (linearPicks[c] != indexPicks[c]) mismatches++;
+            }
+            ok = ok && mismatches == 0;
+
+            std::cout << std::left << std::setw(16) << metric->getName()
+                << " repeats=" << std::setw(6) << (maxRepeats == 1 ? "1" : "max")
+                << std::fixed << std::setprecision(1)
+                << " linear " << std::setw(9) << linearMs << " ms"
+                << "  vp-tree " << std::setw(7) << indexMs << " ms (build " << buildMs << " ms)"
+                << "  speedup x" << std::setprecision(1) << linearMs / std::max(indexMs, 1e-3)
+                << "  mismatches " << mismatches << std::endl;
+        }
+    }
+    return ok;
+}
+
+//случайные гистограммы с кластерной структурой (как у реальных наборов тайлов):
+//смесь 64 прототипов (распределение Дирихле) с логнормальным шумом, нормировка L1
+FeatureStore randomHistogramFeatures(size_t count, FeatureKind kind, std::mt19937& rng) {
+    const int bins = FeatureStore::sizeOf(kind);
+    const int prototypeCount = 64;
+    std::exponential_distribution<float> exponential(1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.35f);
+    std::uniform_int_distribution<int> pick(0, prototypeCount - 1);
+
+    std::vector<std::vector<float>> prototypes(prototypeCount, std::vector<float>(bins));
+    for (auto& prototype : prototypes) {
+        for (auto& value : prototype) value = exponential(rng);
+    }
+
+    FeatureStore result;
+    result.require(kind);
+    result.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const auto& prototype = prototypes[pick(rng)];
+        float* hist = result.data(kind, i);
+        float sum = 0.0f;
+        for (int b = 0; b < bins; ++b) {
+            hist[b] = prototype[b] * std::exp(noise(rng));
+            sum += hist[b];
+        }
+        for (int b = 0; b < bins; ++b) hist[b] /= sum;
+    }
+    return result;
+}
+
+//полнота приближенного поиска (IVF) относительно полного перебора для gradient и texture
+//на фиксированном наборе; при просмотре всех кластеров полнота обязана быть 100%
+bool benchApproximateSearch() {
+    const size_t tileCount = 10000;
+    const size_t cellCount = 1000;
+    bool ok = true;
+
+    std::vector<std::unique_ptr<IMetric>> metrics;
+    metrics.push_back(std::make_unique<GradientMetric>());
+    metrics.push_back(std::make_unique<TextureMetric>());
+
+    for (const auto& metric : metrics) {
+        std::mt19937 rng(777);
+        FeatureKind kind = static_cast<FeatureKind>(metric->featureMask());
+        FeatureStore tiles = randomHistogramFeatures(tileCount, kind, rng);
+        FeatureStore cells = randomHistogramFeatures(cellCount, kind, rng);
+
+        std::vector<int> exact(cellCount);
+        std::vector<int> usage(tileCount, 0);
+        double bruteMs = measureMs([&] {
+            for (size_t c = 0; c < cellCount; ++c) {
+                exact[c] = linearNearest(*metric, cells, c, tiles, usage, std::numeric_limits<int>::max());
+            }
+        });
+        std::cout << std::left << std::setw(10) << metric->getName()
+            << " brute force " << std::fixed << std::setprecision(1) << bruteMs << " ms" << std::endl;
+
+        IVFIndex index;
+        double buildMs = measureMs([&] { index.build(tiles, *metric); });
+        std::cout << "           ivf build " << buildMs << " ms, lists " << index.listCount() << std::endl;
+
+        for (int probes : { 1, 2, 4, 8, 16, 32, index.listCount() }) {
+            index.setProbes(probes);
+            size_t hits = 0;
+            double ivfMs = measureMs([&] {
+                for (size_t c = 0; c < cellCount; ++c) {
+                    if (index.nearest(cells, c) == exact[c]) hits++;
+                }
+            });
+            double recall = static_cast<double>(hits) / cellCount;
+            if (probes == index.listCount() && hits != cellCount) ok = false;
+            std::cout << "           probes " << std::setw(4) << probes
+                << " recall@1 " << std::setprecision(3) << recall
+                << "  " << std::setprecision(1) << ivfMs << " ms"
+                << "  speedup x" << bruteMs / std::max(ivfMs, 1e-3) << std::endl;
+        }
+    }
+    return ok;
+}
+
+//пакетные ядра расстояний на каждом доступном уровне инструкций против поочередных вызовов distance;
+//цветовые ядра обязаны совпадать побитово, гистограммные - с точностью 1e-9 (после масштаба x1000)
+bool benchDistanceKernels() {
+    const size_t cellCount = 200;
+    bool ok = true;
+    std::cout << "detected " << simdLevelName(detectSimdLevel()) << std::endl;
+
+    std::vector<std::unique_ptr<IMetric>> metrics;
+    metrics.push_back(std::make_unique<ColorMetric>());
+    metrics.push_back(std::make_unique<ColorContrastMetric>());
+    metrics.push_back(std::make_unique<GradientMetric>());
+    metrics.push_back(std::make_unique<TextureMetric>());
+
+    for (const auto& metric : metrics) {
+        std::mt19937 rng(4242);
+        unsigned mask = metric->featureMask();
+        bool histogram = (mask & (FeatureGradient | FeatureTexture)) != 0;
+        //нечетное кол-во тайлов проверяет хвост пакета
+        size_t tileCount = histogram ? 5001 : 50001;
+        FeatureStore tiles, cells;
+        if (histogram) {
+            tiles = randomHistogramFeatures(tileCount, static_cast<FeatureKind>(mask), rng);
+            cells = randomHistogramFeatures(cellCount, static_cast<FeatureKind>(mask), rng);
+        }
+        else {
+            tiles = randomColorFeatures(tileCount, rng);
+            cells = randomColorFeatures(cellCount, rng);
+        }
+
+        std::vector<double> reference(cellCount * tileCount);
+        double referenceMs = measureMs([&] {
+            for (size_t c = 0; c < cellCount; ++c) {
+                for (size_t t = 0; t < tileCount; ++t) {
+                    reference[c * tileCount + t] = metric->distance(cells, c, tiles, t);
+                }
+            }
+        });
+        std::cout << std::left << std::setw(16) << metric->getName()
+            << " distance() " << std::fixed << std::setprecision(1) << referenceMs << " ms" << std::endl;
+
+        for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2 }) {
+            const DistanceKernels* kernels = distanceKernelsFor(level);
+            if (!kernels) {
+                std::cout << "                 " << std::setw(7) << simdLevelName(level) << " not supported" << std::endl;
+                continue;
+            }
+            std::vector<double> batch(cellCount * tileCount);
+            double batchMs = measureMs([&] {
+                for (size_t c = 0; c < cellCount; ++c) {
+                    double* out = batch.data() + c * tileCount;
+                    if (mask == FeatureColor) {
+                        kernels->colorL2(cells.color(c), tiles.color(0), tileCount, out);
+                    }
+                    else if (mask == (FeatureColor | FeatureStdDev)) {
+                        kernels->colorContrast(cells.color(c), cells.stddev(c), tiles.color(0), tiles.stddev(0), tileCount, out);
+                    }
+                    else {
+                        FeatureKind kind = static_cast<FeatureKind>(mask);
+                        kernels->bhattacharyya(cells.data(kind, c), tiles.data(kind, 0),
+                            FeatureStore::sizeOf(kind), FeatureStore::strideOf(kind), tileCount, out);
+                        for (size_t t = 0; t < tileCount; ++t) out[t] *= 1000.0;
+                    }
+                }
+            });
+
+            double maxError = 0.0;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                maxError = std::max(maxError, std::fabs(batch[i] - reference[i]));
+            }
+            double tolerance = histogram ? 1e-9 : 0.0;
+            ok = ok && maxError <= tolerance;
+
+            std::cout << "                 " << std::setw(7) << simdLevelName(level)
+                << std::setprecision(1) << batchMs << " ms"
+                << "  speedup x" << referenceMs / std::max(batchMs, 1e-3)
+                << "  max error " << std::scientific << std::setprecision(2) << maxError << std::fixed << std::endl;
+        }
+
+        //метод метрики (лучший уровень) совпадает с ядром этого уровня
+        std::vector<double> viaMetric(tileCount);
+        metric->distanceBatch(cells, 0, tiles, 0, tileCount, viaMetric.data());
+        for (size_t t = 0; t < tileCount; ++t) {
+            if (std::fabs(viaMetric[t] - reference[t]) > (histogram ? 1e-9 : 0.0)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    return ok;
+}
+
+//k лучших тайлов каждой клетки полным перебором (как MosaicGenerator::findCandidates без индекса)
+CandidateLists bruteForceCandidates(const IMetric& metric, const FeatureStore& cells, const FeatureStore& tiles, int k) {
+    CandidateLists candidates;
+    candidates.k = std::min<int>(k, static_cast<int>(tiles.size()));
+    candidates.items.resize(cells.size() * candidates.k);
+    candidates.counts.assign(cells.size(), candidates.k);
+    std::vector<double> distances(tiles.size());
+    std::vector<std::pair<double, int>> found(tiles.size());
+    for (size_t c = 0; c < cells.size(); ++c) {
+        metric.distanceBatch(cells, c, tiles, 0, tiles.size(), distances.data());
+        for (size_t t = 0; t < tiles.size(); ++t) found[t] = { distances[t], static_cast<int>(t) };
+        std::partial_sort(found.begin(), found.begin() + candidates.k, found.end());
+        std::copy(found.begin(), found.begin() + candidates.k, candidates.of(c));
+    }
+    return candidates;
+}
+
+//оптимальная стоимость назначения динамикой по состояниям занятости тайлов (только для малых задач)
+double optimalAssignmentCost(const CandidateLists& candidates, int tileCount, int capacity, double fallbackCost) {
+    int states = 1;
+    for (int t = 0; t < tileCount; ++t) states *= capacity + 1;
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<double> cost(states, infinity), next(states);
+    cost[0] = 0.0;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        std::fill(next.begin(), next.end(), infinity);
+        for (int state = 0; state < states; ++state) {
+            if (cost[state] == infinity) continue;
+            next[state] = std::min(next[state], cost[state] + fallbackCost);
+            const auto* list = candidates.of(c);
+            for (int j = 0; j < candidates.counts[c]; ++j) {
+                int tile = list[j].second, weight = 1;
+                for (int t = 0; t < tile; ++t) weight *= capacity + 1;
+                if ((state / weight) % (capacity + 1) == capacity) continue;
+                next[state + weight] = std::min(next[state + weight], cost[state] + list[j].first);
+            }
+        }
+        cost.swap(next);
+    }
+    return *std::min_element(cost.begin(), cost.end());
+}
+
+//стоимость назначения по спискам кандидатов (клетки без тайла стоят fallbackCost)
+double candidateAssignmentCost(const CandidateLists& candidates, const std::vector<int>& assignment, double fallbackCost) {
+    double total = 0.0;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        double cost = fallbackCost;
+        const auto* list = candidates.of(c);
+        for (int j = 0; j < candidates.counts[c]; ++j) {
+            if (list[j].second == assignment[c]) cost = list[j].first;
+        }
+        total += cost;
+    }
+    return total;
+}
+
+//глобальное назначение (аукцион) против жадного прохода по строкам
+//на малых задачах аукцион сверяется с точным оптимумом (допуск epsilon на клетку),
+//на больших - сравниваются время и суммарное расстояние с жадным назначением
+bool benchGlobalAssignment() {
+    bool ok = true;
+    ColorMetric metric;
+
+    //точность на малых задачах
+    std::mt19937 rng(99);
+    double worstGap = 0.0;
+    int incomplete = 0;
+    for (int trial = 0; trial < 300; ++trial) {
+        const int tileCount = 6;
+        const int capacity = 1 + trial % 2;
+        const size_t cellCount = 5 + trial % 9;
+        FeatureStore tiles = randomColorFeatures(tileCount, rng);
+        FeatureStore cells = randomColorFeatures(cellCount, rng);
+        CandidateLists candidates = bruteForceCandidates(metric, cells, tiles, tileCount);
+        double fallbackCost = 150.0;
+        AuctionAssignment auction;
+        std::vector<int> assignment = auction.solve(candidates, tileCount, capacity, fallbackCost);
+        std::vector<int> usage(tileCount, 0);
+        for (int tile : assignment) {
+            if (tile >= 0 && ++usage[tile] > capacity) ok = false;
+        }
+        double gap = candidateAssignmentCost(candidates, assignment, fallbackCost) -
+            optimalAssignmentCost(candidates, tileCount, capacity, fallbackCost);
+        worstGap = std::max(worstGap, gap);
+        if (!auction.isComplete()) incomplete++;
+        else if (gap > 1e-3 * fallbackCost * cellCount + 1e-9) ok = false;
+    }
+    ok = ok && incomplete == 0;
+    std::cout << "small instances: worst gap to optimum " << std::fixed << std::setprecision(4) << worstGap
+        << ", stopped by bid limit " << incomplete << std::endl;
+
+    //время и качество на больших задачах
+    const size_t tileCount = 6000;
+    const size_t cellCount = 10000;
+    FeatureStore tiles = randomColorFeatures(tileCount, rng);
+    FeatureStore cells = randomColorFeatures(cellCount, rng);
+    for (int maxRepeats : { 1, 2 }) {
+        std::vector<int> greedy(cellCount, -1);
+        std::vector<int> usage(tileCount, 0);
+        double greedyMs = measureMs([&] {
+            for (size_t c = 0; c < cellCount; ++c) {
+                int best = linearNearest(metric, cells, c, tiles, usage, maxRepeats);
+                greedy[c] = best;
+                if (best >= 0) usage[best]++;
+            }
+        });
+
+        std::vector<int> global;
+        size_t bids = 0;
+        double globalMs = measureMs([&] {
+            CandidateLists candidates = bruteForceCandidates(metric, cells, tiles, 16);
+            double fallbackCost = 1.0;
+            for (const auto& item : candidates.items) fallbackCost = std::max(fallbackCost, 2.0 * item.first + 1.0);
+            AuctionAssignment auction;
+            global = auction.solve(candidates, tileCount, maxRepeats, fallbackCost);
+            bids = auction.getBidCount();
+            //клетки без кандидата - ближайший доступный тайл
+            std::fill(usage.begin(), usage.end(), 0);
+            for (int tile : global) {
+                if (tile >= 0) usage[tile]++;
+            }
+            for (size_t c = 0; c < cellCount; ++c) {
+                if (global[c] >= 0) continue;
+                global[c] = linearNearest(metric, cells, c, tiles, usage, maxRepeats);
+                if (global[c] >= 0) usage[global[c]]++;
+            }
+        });
+
+        //суммарное расстояние и расстояние худших 5% клеток (нижняя часть изображения при жадном проходе)
+        auto summarize = [&](const std::vector<int>& assignment, double& total, double& tail, size_t& empty) {
+            std::vector<double> distances;
+            total = 0.0;
+            empty = 0;
+            for (size_t c = 0; c < cellCount; ++c) {
+                if (assignment[c] < 0) {
+                    empty++;
+                    continue;
+                }
+                distances.push_back(metric.distance(cells, c, tiles, assignment[c]));
+                total += distances.back();
+            }
+            std::sort(distances.begin(), distances.end());
+            size_t tailCount = std::max<size_t>(1, distances.size() / 20);
+            tail = std::accumulate(distances.end() - tailCount, distances.end(), 0.0) / tailCount;
+        };
+        double greedyTotal, greedyTail, globalTotal, globalTail;
+        size_t greedyEmpty, globalEmpty;
+        summarize(greedy, greedyTotal, greedyTail, greedyEmpty);
+        summarize(global, globalTotal, globalTail, globalEmpty);
+        ok = ok && globalEmpty <= greedyEmpty && globalTotal <= greedyTotal;
+
+        std::cout << "repeats=" << maxRepeats << std::setprecision(1)
+            << "  greedy " << std::setw(8) << greedyMs << " ms, total " << greedyTotal << ", worst 5% " << greedyTail
+            << ", empty " << greedyEmpty << std::endl
+            << "           global " << std::setw(8) << globalMs << " ms, total " << globalTotal << ", worst 5% " << globalTail
+            << ", empty " << globalEmpty << ", bids " << bids << std::endl;
+    }
+    return ok;
+}
+
+//случайное 8-битное изображение: плавный фон с шумом (похоже на фотографию по статистике клеток)
+cv::Mat randomImage(int rows, int cols, int channels, std::mt19937& rng) {
+    std::normal_distribution<float> noise(0.0f, 12.0f);
+    cv::Mat image(rows, cols, CV_MAKETYPE(CV_8U, channels));
+    for (int y = 0; y < rows; ++y) {
+        uchar* row = image.ptr<uchar>(y);
+        for (int x = 0; x < cols; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                float base = 128.0f + 100.0f * std::sin(0.013f * x * (c + 1) + 0.007f * y);
+                row[x * channels + c] = static_cast<uchar>(std::max(0.0f, std::min(255.0f, base + noise(rng))));
+            }
+        }
+    }
+    return image;
+}
+
+//средний цвет и отклонение клеток по интегральным изображениям карты против cv::mean / computeStdDev по ROI
+//для сетки без перекрытия и с перекрытием (шаг клетки меньше ее размера)
+bool benchSourceFeatureMap() {
+    std::mt19937 rng(2024);
+    cv::Mat image = randomImage(1500, 2000, 3, rng);
+    bool ok = true;
+
+    SourceFeatureMap map;
+    double buildMs = measureMs([&] { map.build(image, FeatureColor | FeatureStdDev); });
+    std::cout << "build " << std::fixed << std::setprecision(1) << buildMs << " ms" << std::endl;
+
+    for (int step : { 30, 10 }) {
+        const int cellSize = 30;
+        std::vector<cv::Rect> regions;
+        for (int y = 0; y + cellSize <= image.rows; y += step) {
+            for (int x = 0; x + cellSize <= image.cols; x += step) regions.emplace_back(x, y, cellSize, cellSize);
+        }
+        std::vector<cv::Scalar> roiMean(regions.size()), roiStd(regions.size()), mapMean(regions.size()), mapStd(regions.size());
+        double roiMs = measureMs([&] {
+            for (size_t i = 0; i < regions.size(); ++i) {
+                roiMean[i] = cv::mean(image(regions[i]));
+                roiStd[i] = FeatureUtils::computeStdDev(image(regions[i]));
+            }
+        });
+        double mapMs = measureMs([&] {
+            for (size_t i = 0; i < regions.size(); ++i) {
+                mapMean[i] = map.mean(regions[i]);
+                mapStd[i] = map.stddev(regions[i]);
+            }
+        });
+        double maxError = 0.0;
+        for (size_t i = 0; i < regions.size(); ++i) {
+            for (int c = 0; c < 4; ++c) {
+                maxError = std::max(maxError, std::fabs(roiMean[i][c] - mapMean[i][c]));
+                maxError = std::max(maxError, std::fabs(roiStd[i][c] - mapStd[i][c]));
+            }
+        }
+        ok = ok && maxError < 1e-6;
+        std::cout << "cells " << std::setw(6) << regions.size() << " step " << std::setw(2) << step
+            << std::setprecision(1) << "  roi " << std::setw(7) << roiMs << " ms  map " << std::setw(6) << mapMs << " ms"
+            << "  speedup x" << roiMs / std::max(mapMs, 1e-3)
+            << "  max error " << std::scientific << std::setprecision(2) << maxError << std::fixed << std::endl;
+    }
+    return ok;
+}
+
+//гистограммы градиентов и LBP по плоскостям карты против FeatureUtils по ROI каждой клетки
+//если клетка - все изображение, результаты обязаны совпадать; на сетке клеток отличия только от пикселей
+//на краях клеток (карта использует настоящих соседей), их величина выводится для сведения
+bool benchCellFeatureMaps() {
+    std::mt19937 rng(31337);
+    bool ok = true;
+    const int gradientBins = FeatureStore::gradientBins;
+    const int textureBins = FeatureStore::textureBins;
+
+    //совпадение на изображениях из одной клетки
+    double maxError = 0.0;
+    std::uniform_int_distribution<int> side(3, 64);
+    for (int trial = 0; trial < 50; ++trial) {
+        cv::Mat image = randomImage(side(rng), side(rng), trial % 2 ? 3 : 1, rng);
+        cv::Rect whole(0, 0, image.cols, image.rows);
+        SourceFeatureMap map;
+        map.build(image, FeatureGradient | FeatureTexture);
+        std::vector<float> gradient(gradientBins), texture(textureBins);
+        map.gradientHistogram(whole, gradient.data());
+        map.textureHistogram(whole, texture.data());
+        cv::Mat gradientRef = FeatureUtils::computeGradientHist(image);
+        cv::Mat textureRef = FeatureUtils::computeLBPFeatures(image);
+        for (int b = 0; b < gradientBins; ++b) maxError = std::max(maxError, std::fabs(static_cast<double>(gradient[b]) - gradientRef.at<float>(b)));
+        for (int b = 0; b < textureBins; ++b) maxError = std::max(maxError, std::fabs(static_cast<double>(texture[b]) - textureRef.at<float>(b)));
+    }
+    ok = ok && maxError <= 1e-6;
+    std::cout << "whole-image cells: max error " << std::scientific << std::setprecision(2) << maxError << std::fixed << std::endl;
+
+    //время на сетке клеток
+    cv::Mat image = randomImage(1500, 2000, 3, rng);
+    std::vector<cv::Rect> regions;
+    for (int y = 0; y < image.rows; y += 30) {
+        for (int x = 0; x < image.cols; x += 30) {
+            regions.emplace_back(x, y, std::min(30, image.cols - x), std::min(30, image.rows - y));
+        }
+    }
+    FeatureStore roiFeatures, mapFeatures;
+    roiFeatures.require(FeatureGradient | FeatureTexture);
+    mapFeatures.require(FeatureGradient | FeatureTexture);
+    roiFeatures.resize(regions.size());
+    mapFeatures.resize(regions.size());
+
+    GradientMetric gradientMetric;
+    TextureMetric textureMetric;
+    double roiMs = measureMs([&] {
+        for (size_t i = 0; i < regions.size(); ++i) {
+            gradientMetric.computeCellFeatures(image(regions[i]), roiFeatures, i);
+            textureMetric.computeCellFeatures(image(regions[i]), roiFeatures, i);
+        }
+    });
+    SourceFeatureMap map;
+    double buildMs = 0.0;
+    double mapMs = measureMs([&] {
+        buildMs = measureMs([&] { map.build(image, FeatureGradient | FeatureTexture); });
+        for (size_t i = 0; i < regions.size(); ++i) {
+            gradientMetric.computeCellFeatures(map, regions[i], mapFeatures, i);
+            textureMetric.computeCellFeatures(map, regions[i], mapFeatures, i);
+        }
+    });
+    double gradientDiff = 0.0, textureDiff = 0.0;
+    for (size_t i = 0; i < regions.size(); ++i) {
+        gradientDiff += gradientMetric.distance(roiFeatures, i, mapFeatures, i);
+        textureDiff += textureMetric.distance(roiFeatures, i, mapFeatures, i);
+    }
+    std::cout << "cells " << regions.size() << std::setprecision(1)
+        << "  roi " << roiMs << " ms  map " << mapMs << " ms (build " << buildMs << " ms)"
+        << "  speedup x" << roiMs / std::max(mapMs, 1e-3) << std::endl
+        << "mean distance roi vs map: gradient " << gradientDiff / regions.size()
+        << ", texture " << textureDiff / regions.size() << std::endl;
+    return ok;
+}
+
+//векторные LBP-ядра против FeatureUtils::getLBPValue: коды и гистограммы обязаны совпадать точно
+//(в т.ч. на узких изображениях, где работает только хвост строки), время - на наборе тайлов и большом изображении
+bool benchLBPKernel() {
+    std::mt19937 rng(2718);
+    bool ok = true;
+    const int bins = FeatureStore::textureBins;
+    const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2 };
+
+    //эталонная гистограмма по getLBPValue
+    auto referenceHistogram = [](const cv::Mat& gray, uint32_t* hist) {
+        for (int i = 1; i < gray.rows - 1; ++i) {
+            for (int j = 1; j < gray.cols - 1; ++j) hist[FeatureUtils::getLBPValue(gray, i, j)]++;
+        }
+    };
+
+    std::uniform_int_distribution<int> side(1, 80);
+    size_t mismatches = 0;
+    for (int trial = 0; trial < 200; ++trial) {
+        cv::Mat gray = randomImage(side(rng), side(rng), 1, rng);
+        //участки одинаковой яркости проверяют сравнение "больше или равно"
+        if (trial % 4 == 0) gray(cv::Rect(0, 0, gray.cols, gray.rows / 2)).setTo(cv::Scalar(128));
+        std::vector<uint32_t> reference(bins, 0);
+        referenceHistogram(gray, reference.data());
+        for (SimdLevel level : levels) {
+            const FeatureKernels* kernels = featureKernelsFor(level);
+            if (!kernels) continue;
+            std::vector<uint32_t> hist(bins, 0);
+            computeLBPHistogram(gray, hist.data(), *kernels);
+            if (hist != reference) mismatches++;
+            std::vector<uchar> codes(gray.cols, 0);
+            for (int i = 1; i < gray.rows - 1; ++i) {
+                kernels->lbpRow(gray.ptr<uchar>(i - 1), gray.ptr<uchar>(i), gray.ptr<uchar>(i + 1), gray.cols, codes.data());
+                for (int j = 1; j < gray.cols - 1; ++j) {
+                    if (codes[j] != FeatureUtils::getLBPValue(gray, i, j)) mismatches++;
+                }
+            }
+        }
+    }
+    ok = ok && mismatches == 0;
+    std::cout << "random images: mismatches " << mismatches << std::endl;
+
+    std::vector<cv::Mat> tiles;
+    for (int i = 0; i < 2000; ++i) tiles.push_back(randomImage(64, 64, 1, rng));
+    cv::Mat large = randomImage(2000, 3000, 1, rng);
+    std::vector<uint32_t> hist(bins);
+    double tilesRef = measureMs([&] {
+        for (const auto& tile : tiles) referenceHistogram(tile, hist.data());
+    });
+    double largeRef = measureMs([&] { referenceHistogram(large, hist.data()); });
+    std::cout << std::fixed << std::setprecision(1) << "getLBPValue  tiles " << std::setw(7) << tilesRef
+        << " ms  image " << std::setw(7) << largeRef << " ms" << std::endl;
+    for (SimdLevel level : levels) {
+        const FeatureKernels* kernels = featureKernelsFor(level);
+        if (!kernels) {
+            std::cout << std::left << std::setw(13) << simdLevelName(level) << std::right << "not supported" << std::endl;
+            continue;
+        }
+        double tilesMs = measureMs([&] {
+            for (const auto& tile : tiles) computeLBPHistogram(tile, hist.data(), *kernels);
+        });
+        double largeMs = measureMs([&] { computeLBPHistogram(large, hist.data(), *kernels); });
+        std::cout << std::left << std::setw(13) << simdLevelName(level) << std::right
+            << "tiles " << std::setw(7) << tilesMs << " ms  image " << std::setw(7) << largeMs << " ms"
+            << "  speedup x" << tilesRef / std::max(tilesMs, 1e-3) << " / x" << largeRef / std::max(largeMs, 1e-3) << std::endl;
+    }
+    return ok;
+}
+
+//гистограмма градиентов по матрицам Sobel/cartToPolar (прежняя реализация computeGradientHist, без нормировки)
+void referenceGradientHistogram(const cv::Mat& image, float* hist) {
+    cv::Mat gray, gradX, gradY, magnitude, angle;
+    if (image.channels() == 3) cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    else gray = image;
+    gray.convertTo(gray, CV_32F);
+    cv::Sobel(gray, gradX, CV_32F, 1, 0, 3);
+    cv::Sobel(gray, gradY, CV_32F, 0, 1, 3);
+    cv::cartToPolar(gradX, gradY, magnitude, angle, true);
+    const int bins = FeatureStore::gradientBins;
+    for (int y = 0; y < angle.rows; ++y) {
+        for (int x = 0; x < angle.cols; ++x) {
+            int bin = static_cast<int>(angle.at<float>(y, x) / (360.0f / bins));
+            hist[std::max(0, std::min(bin, bins - 1))] += magnitude.at<float>(y, x);
+        }
+    }
+}
+
+//сумма модулей разностей нормированных гистограмм
+double histogramL1Difference(const float* a, const float* b, int bins) {
+    double totalA = 0.0, totalB = 0.0, diff = 0.0;
+    for (int i = 0; i < bins; ++i) {
+        totalA += a[i];
+        totalB += b[i];
+    }
+    for (int i = 0; i < bins; ++i) {
+        diff += std::fabs((totalA > 0 ? a[i] / totalA : 0.0) - (totalB > 0 ? b[i] / totalB : 0.0));
+    }
+    return diff;
+}
+
+//однопроходное ядро гистограммы градиентов против Sobel/cartToPolar
+//допуск: сумма модулей разностей нормированных гистограмм не больше 1e-2 (бин меняют только пиксели,
+//угол которых лежит на границе бина в пределах точности вычисления угла)
+bool benchGradientKernel() {
+    std::mt19937 rng(1618);
+    const int bins = FeatureStore::gradientBins;
+    bool ok = true;
+
+    for (bool fastAtan : { false, true }) {
+        double maxDiff = 0.0;
+        std::uniform_int_distribution<int> side(3, 96);
+        for (int trial = 0; trial < 200; ++trial) {
+            cv::Mat image = randomImage(side(rng), side(rng), trial % 2 ? 3 : 1, rng);
+            //плавный градиент с постоянным направлением проверяет попадание углов точно на границы бинов
+            if (trial % 5 == 0) {
+                for (int y = 0; y < image.rows; ++y) {
+                    for (int x = 0; x < image.cols * image.channels(); ++x) image.ptr<uchar>(y)[x] = static_cast<uchar>((x + y) % 256);
+                }
+            }
+            std::vector<float> reference(bins, 0.0f), fused(bins, 0.0f);
+            referenceGradientHistogram(image, reference.data());
+            computeGradientHistogram(image, fused.data(), fastAtan);
+            maxDiff = std::max(maxDiff, histogramL1Difference(reference.data(), fused.data(), bins));
+        }
+        ok = ok && maxDiff <= 1e-2;
+        std::cout << (fastAtan ? "fast atan " : "atan2     ") << "max L1 difference " << std::scientific << std::setprecision(2)
+            << maxDiff << std::fixed << std::endl;
+    }
+
+    std::vector<cv::Mat> tiles;
+    for (int i = 0; i < 1000; ++i) tiles.push_back(randomImage(64, 64, 3, rng));
+    cv::Mat large = randomImage(1500, 2000, 3, rng);
+    std::vector<float> hist(bins);
+    double tilesRef = measureMs([&] { for (const auto& tile : tiles) referenceGradientHistogram(tile, hist.data()); });
+    double largeRef = measureMs([&] { referenceGradientHistogram(large, hist.data()); });
+    std::cout << std::setprecision(1) << "sobel+cartToPolar tiles " << std::setw(7) << tilesRef
+        << " ms  image " << std::setw(7) << largeRef << " ms" << std::endl;
+    for (bool fastAtan : { false, true }) {
+        double tilesMs = measureMs([&] { for (const auto& tile : tiles) computeGradientHistogram(tile, hist.data(), fastAtan); });
+        double largeMs = measureMs([&] { computeGradientHistogram(large, hist.data(), fastAtan); });
+        std::cout << (fastAtan ? "fused, fast atan  " : "fused, atan2      ") << "tiles " << std::setw(7) << tilesMs
+            << " ms  image " << std::setw(7) << largeMs << " ms"
+            << "  speedup x" << tilesRef / std::max(tilesMs, 1e-3) << " / x" << largeRef / std::max(largeMs, 1e-3) << std::endl;
+    }
+    return ok;
+}
+
+//отрисовка мозаики из кэша отрисовок против масштабирования тайла в каждой клетке
+//результат обязан совпадать попиксельно; время - первая отрисовка (с заполнением атласов) и повторная
+bool benchTileRender() {
+    std::mt19937 rng(5150);
+    bool ok = true;
+    const int gridStep = 30;
+    cv::Mat source(1500 + 17, 2000 + 11, CV_8UC3);
+    std::vector<cv::Rect> regions;
+    for (int y = 0; y < source.rows; y += gridStep) {
+        for (int x = 0; x < source.cols; x += gridStep) {
+            regions.emplace_back(x, y, std::min(gridStep, source.cols - x), std::min(gridStep, source.rows - y));
+        }
+    }
+
+    for (int tileSize : { gridStep, 48 }) {
+        std::vector<Tile> tiles(500);
+        for (auto& tile : tiles) tile.image = randomImage(tileSize, tileSize, 3, rng);
+        std::uniform_int_distribution<int> pick(-1, static_cast<int>(tiles.size()) - 1);
+        std::vector<int> assignment(regions.size());
+        for (int& tile : assignment) tile = pick(rng);
+
+        cv::Mat reference(source.rows, source.cols, CV_8UC3, cv::Scalar(0, 0, 0));
+        double resizeMs = measureMs([&] {
+            for (size_t cell = 0; cell < regions.size(); ++cell) {
+                if (assignment[cell] < 0) continue;
+                cv::Mat finalTile;
+                cv::resize(tiles[assignment[cell]].image, finalTile, regions[cell].size(), 0, 0, cv::INTER_CUBIC);
+                finalTile.copyTo(reference(regions[cell]));
+            }
+        });
+
+        TileRenderCache cache;
+        cv::Mat cached(source.rows, source.cols, CV_8UC3, cv::Scalar(0, 0, 0));
+        auto render = [&] {
+            cache.prepare(tiles, regions, assignment, 1);
+            for (size_t cell = 0; cell < regions.size(); ++cell) {
+                if (assignment[cell] >= 0 && !cache.place(tiles, assignment[cell], cached, regions[cell])) ok = false;
+            }
+        };
+        double firstMs = measureMs(render);
+        double againMs = measureMs(render);
+
+        size_t mismatches = 0;
+        for (int y = 0; y < source.rows; ++y) {
+            if (std::memcmp(reference.ptr<uchar>(y), cached.ptr<uchar>(y), source.cols * 3) != 0) mismatches++;
+        }
+        ok = ok && mismatches == 0;
+        std::cout << "tile " << tileSize << " cell " << gridStep << std::fixed << std::setprecision(1)
+            << "  resize " << std::setw(6) << resizeMs << " ms  cache " << std::setw(6) << firstMs
+            << " ms (again " << againMs << " ms)  atlas sizes " << cache.getSizeCount()
+            << " memory " << cache.getMemoryBytes() / (1024.0 * 1024.0) << " MB  mismatched rows " << mismatches << std::endl;
+
+        //назначение с другим размером клетки: атласы прежних размеров и тайлы вне назначения освобождаются
+        cache.prepare(tiles, { cv::Rect(0, 0, 40, 40) }, { 0 }, 1);
+        ok = ok && cache.getSizeCount() == 1 && cache.getMemoryBytes() == 40 * 40 * 3 + tiles.size() * sizeof(int);
+    }
+    return ok;
+}
+
+//тайлы в атласе против отдельных матриц: совпадение пикселей, время размещения и чтения в случайном порядке
+bool benchTileAtlas() {
+    std::mt19937 rng(8086);
+    const int tileCount = 20000, tileSize = 30;
+    std::vector<cv::Mat> separate;
+    separate.reserve(tileCount);
+    for (int i = 0; i < tileCount; ++i) separate.push_back(randomImage(tileSize, tileSize, 3, rng));
+
+    TileAtlas atlas;
+    std::vector<cv::Mat> headers;
+    headers.reserve(tileCount);
+    double addMs = measureMs([&] {
+        for (const auto& image : separate) headers.push_back(atlas.add(image));
+    });
+    size_t mismatches = 0;
+    for (int i = 0; i < tileCount; ++i) {
+        for (int y = 0; y < tileSize; ++y) {
+            if (std::memcmp(separate[i].ptr<uchar>(y), headers[i].ptr<uchar>(y), tileSize * 3) != 0) mismatches++;
+        }
+    }
+
+    //чтение тайлов в порядке случайного назначения (как при размещении в мозаике)
+    std::vector<int> order(200000);
+    std::uniform_int_distribution<int> pick(0, tileCount - 1);
+    for (int& tile : order) tile = pick(rng);
+    auto readAll = [&](const std::vector<cv::Mat>& images) {
+        uint64_t checksum = 0;
+        for (int tile : order) {
+            const cv::Mat& image = images[tile];
+            for (int y = 0; y < image.rows; ++y) {
+                const uchar* row = image.ptr<uchar>(y);
+                for (int x = 0; x < image.cols * 3; ++x) checksum += row[x];
+            }
+        }
+        return checksum;
+    };
+    uint64_t separateSum = 0, atlasSum = 0;
+    double separateMs = measureMs([&] { separateSum = readAll(separate); });
+    double atlasMs = measureMs([&] { atlasSum = readAll(headers); });
+
+    std::cout << "tiles " << tileCount << " chunks " << atlas.getChunkCount() << std::fixed << std::setprecision(1)
+        << "  memory " << atlas.getMemoryBytes() / (1024.0 * 1024.0) << " MB  add " << addMs << " ms" << std::endl
+        << "read separate " << separateMs << " ms  atlas " << atlasMs << " ms  mismatched rows " << mismatches << std::endl;
+    return mismatches == 0 && separateSum == atlasSum && atlas.size() == static_cast<size_t>(tileCount);
+}
+
+//библиотека тайлов: запись, открытие отображением и загрузка в генератор
+//изображения и признаки обязаны совпадать с записанными; время открытия не зависит от размера изображений
+bool benchTileLibrary() {
+    std::mt19937 rng(1234);
+    const int tileCount = 5000, tileSize = 30;
+    fs::path file = fs::temp_directory_path() / "mosaic_bench.mosaiclib";
+    ColorContrastMetric metric;
+    unsigned mask = metric.featureMask();
+
+    std::vector<cv::Mat> images;
+    FeatureStore features;
+    features.require(mask);
+    features.resize(tileCount);
+    for (int i = 0; i < tileCount; ++i) {
+        images.push_back(randomImage(tileSize, tileSize, 3, rng));
+        metric.computeTileFeatures(images.back(), features, i);
+    }
+
+    TileLibraryWriter writer;
+    bool ok = writer.open(file, tileSize, 0, metric.getName(), mask);
+    double writeMs = measureMs([&] {
+        for (int i = 0; ok && i < tileCount; ++i) ok = writer.add(images[i], features, i);
+        ok = writer.finish() && ok;
+    });
+
+    TileLibrary library;
+    double openMs = measureMs([&] { ok = library.open(file) && ok; });
+    size_t mismatches = 0;
+    FeatureStore loaded;
+    loaded.require(mask);
+    loaded.resize(tileCount);
+    double readMs = measureMs([&] {
+        for (int i = 0; ok && i < static_cast<int>(library.size()); ++i) {
+            cv::Mat tile = library.tile(i);
+            for (int y = 0; y < tileSize; ++y) {
+                if (std::memcmp(tile.ptr<uchar>(y), images[i].ptr<uchar>(y), tileSize * 3) != 0) mismatches++;
+            }
+            library.readFeatures(i, loaded, i);
+            if (metric.distance(loaded, i, features, i) != 0.0) mismatches++;
+        }
+    });
+    ok = ok && library.size() == static_cast<size_t>(tileCount) && library.metricName() == metric.getName();
+
+    MosaicGenerator generator;
+    generator.setMetric(metric.getName());
+    double loadMs = measureMs([&] { ok = generator.loadTileLibrary(file) && ok; });
+    ok = ok && generator.getTilesCount() == static_cast<size_t>(tileCount) && mismatches == 0;
+    generator.clearTiles();
+    library.close();
+
+    //поврежденный файл не открывается
+    {
+        std::fstream damaged(file, std::ios::binary | std::ios::in | std::ios::out);
+        damaged.seekp(0);
+        damaged.write("XXXX", 4);
+    }
+    ok = ok && !library.open(file);
+    fs::remove(file);
+
+    std::cout << "tiles " << tileCount << std::fixed << std::setprecision(1) << "  write " << writeMs << " ms  open "
+        << openMs << " ms  read " << readMs << " ms  generator load " << loadMs << " ms  mismatches " << mismatches << std::endl;
+    return ok;
+}
+
+//библиотека из случайных тайлов для генератора (признаки считаются генератором при загрузке)
+fs::path writeRandomLibrary(const std::string& name, int tileCount, int tileSize, std::mt19937& rng) {
+    fs::path file = fs::temp_directory_path() / name;
+    TileLibraryWriter writer;
+    FeatureStore none;
+    none.resize(1);
+    writer.open(file, tileSize, 0, "", 0);
+    for (int i = 0; i < tileCount; ++i) writer.add(randomImage(tileSize, tileSize, 3, rng), none, 0);
+    writer.finish();
+    return file;
+}
+
+//количество различающихся байтов двух изображений одного размера
+size_t countDifferentBytes(const cv::Mat& a, const cv::Mat& b) {
+    if (a.size() != b.size() || a.type() != b.type()) return std::numeric_limits<size_t>::max();
+    size_t diff = 0;
+    for (int y = 0; y < a.rows; ++y) {
+        const uchar* pa = a.ptr<uchar>(y);
+        const uchar* pb = b.ptr<uchar>(y);
+        for (size_t x = 0; x < a.cols * a.elemSize(); ++x) diff += pa[x] != pb[x];
+    }
+    return diff;
+}
+
+//смещение строки row в несжатом TIFF или BigTIFF, записанном TiffBandWriter (по тегу StripOffsets), 0 при ошибке
+uint64_t tiffRowOffset(const fs::path& file, int row) {
+    std::ifstream in(file, std::ios::binary);
+    auto read = [&](size_t bytes) {
+        uint64_t value = 0;
+        in.read(reinterpret_cast<char*>(&value), bytes);
+        return value;
+    };
+    in.seekg(2);
+    bool big = read(2) == 43;
+    in.seekg(big ? 8 : 4);
+    uint64_t directory = read(big ? 8 : 4);
+    in.seekg(directory);
+    uint64_t entries = read(big ? 8 : 2);
+    for (uint64_t i = 0; in && i < entries; ++i) {
+        uint64_t tag = read(2), type = read(2), count = read(big ? 8 : 4), field = read(big ? 8 : 4);
+        if (tag != 273) continue;
+        size_t typeSize = type == 16 ? 8 : 4;
+        if (count * typeSize <= (big ? 8u : 4u)) return field;
+        in.seekg(field + row * typeSize);
+        uint64_t offset = read(typeSize);
+        return in ? offset : 0;
+    }
+    return 0;
+}
+
+//потоковая генерация по полосам против createMosaic: результат обязан совпадать побайтно
+//(жадное назначение, все эффекты постобработки, в т.ч. требующие статистики и контекста соседних строк);
+//проверяются также чтение PPM и запись TIFF по полосам
+bool benchStreaming() {
+    std::mt19937 rng(4711);
+    bool ok = true;
+    fs::path library = writeRandomLibrary("mosaic_stream.mosaiclib", 400, 30, rng);
+    cv::Mat source = randomImage(437, 611, 3, rng);
+
+    PostProcessConfig post;
+    post.addEffect("alpha_blend");
+    post.addEffect("color_correction");
+    post.addEffect("seam_smoothing");
+    for (const char* metricName : { "color", "texture" }) {
+        for (int maxRepeats : { std::numeric_limits<int>::max(), 2 }) {
+            MosaicGenerator generator;
+            generator.setMetric(metricName);
+            generator.loadTileLibrary(library);
+            generator.setPostProcessConfig(post);
+            Config cfg;
+            cfg.metric = metricName;
+            cfg.maxRepeats = maxRepeats;
+            cv::Mat reference;
+            double fullMs = measureMs([&] { reference = generator.createMosaic(source, cfg); });
+            for (int bandRows : { 30, 100 }) {
+                MatBandReader reader(source);
+                MatBandWriter writer;
+                double streamMs = measureMs([&] { generator.createMosaicStreaming(reader, writer, cfg, bandRows); });
+                size_t diff = countDifferentBytes(reference, writer.image());
+                ok = ok && diff == 0;
+                std::cout << std::left << std::setw(8) << metricName << std::right << " repeats "
+                    << (maxRepeats == std::numeric_limits<int>::max() ? std::string("any") : std::to_string(maxRepeats))
+                    << " band " << std::setw(3) << bandRows << std::fixed << std::setprecision(1)
+                    << "  full " << std::setw(6) << fullMs << " ms  streaming " << std::setw(6) << streamMs
+                    << " ms  different bytes " << diff << std::endl;
+            }
+        }
+    }
+    fs::remove(library);
+
+    //PPM -> полосы -> TIFF
+    fs::path ppm = fs::temp_directory_path() / "mosaic_stream.ppm";
+    fs::path tiff = fs::temp_directory_path() / "mosaic_stream.tif";
+    {
+        std::ofstream out(ppm, std::ios::binary);
+        out << "P6\n# test\n" << source.cols << " " << source.rows << "\n255\n";
+        for (int y = 0; y < source.rows; ++y) {
+            const uchar* row = source.ptr<uchar>(y);
+            for (int x = 0; x < source.cols; ++x) {
+                out.put(static_cast<char>(row[3 * x + 2])).put(static_cast<char>(row[3 * x + 1])).put(static_cast<char>(row[3 * x]));
+            }
+        }
+    }
+    //классический TIFF и BigTIFF (который пишется для файлов больше 4 ГБ): строки в порядке RGB по таблице полос
+    for (bool bigTiff : { false, true }) {
+        PpmBandReader reader;
+        TiffBandWriter writer(tiff, bigTiff);
+        ok = reader.open(ppm) && reader.size() == source.size() && writer.open(reader.size(), reader.type()) && ok;
+        ok = ok && writer.isBigTiff() == bigTiff;
+        size_t diff = 0;
+        for (int top = 0; ok && top < source.rows; top += 64) {
+            cv::Mat band;
+            int rows = std::min(64, source.rows - top);
+            ok = reader.read(top, rows, band) && writer.write(band);
+            if (ok) diff += countDifferentBytes(band, source.rowRange(top, top + rows));
+        }
+        ok = writer.close() && ok && diff == 0;
+        uint64_t rowOffset = tiffRowOffset(tiff, 5);
+        ok = ok && rowOffset == (bigTiff ? 16u : 8u) + static_cast<uint64_t>(source.cols) * 3 * 5;
+        std::ifstream in(tiff, std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(rowOffset));
+        char rgb[3] = {};
+        in.read(rgb, 3);
+        ok = ok && in && static_cast<uchar>(rgb[0]) == source.at<cv::Vec3b>(5, 0)[2] && static_cast<uchar>(rgb[2]) == source.at<cv::Vec3b>(5, 0)[0];
+        std::cout << "ppm -> " << (bigTiff ? "bigtiff" : "tiff") << " bands: different bytes " << diff << (ok ? "" : "  FAILED") << std::endl;
+    }
+    fs::remove(ppm);
+    fs::remove(tiff);
+    return ok;
+}
+
+//мозаика с увеличением (клетка 30 пикселей исходного изображения -> тайл 64 пикселя в результате):
+//размер результата и потоковая генерация против createMosaic (побайтно, в т.ч. с обрезанными клетками на краях)
+bool benchOutputScale() {
+    std::mt19937 rng(2024);
+    bool ok = true;
+    fs::path library = writeRandomLibrary("mosaic_scale.mosaiclib", 300, 64, rng);
+    PostProcessConfig post;
+    post.addEffect("alpha_blend");
+    post.addEffect("color_correction");
+    post.addEffect("seam_smoothing");
+    MosaicGenerator generator;
+    generator.loadTileLibrary(library);
+    generator.setPostProcessConfig(post);
+    Config cfg;
+    cfg.outputTileSize = 64;
+    for (cv::Size sourceSize : { cv::Size(600, 420), cv::Size(611, 437) }) {
+        cv::Mat source = randomImage(sourceSize.height, sourceSize.width, 3, rng);
+        cv::Size expected(sourceSize.width / 30 * 64 + sourceSize.width % 30 * 64 / 30,
+            sourceSize.height / 30 * 64 + sourceSize.height % 30 * 64 / 30);
+        cv::Mat reference;
+        double fullMs = measureMs([&] { reference = generator.createMosaic(source, cfg); });
+        ok = ok && reference.size() == expected;
+        for (int bandRows : { 128, 300 }) {
+            MatBandReader reader(source);
+            MatBandWriter writer;
+            double streamMs = measureMs([&] { generator.createMosaicStreaming(reader, writer, cfg, bandRows); });
+            size_t diff = countDifferentBytes(reference, writer.image());
+            ok = ok && writer.image().size() == expected && diff == 0;
+            std::cout << sourceSize.width << "x" << sourceSize.height << " -> " << reference.cols << "x" << reference.rows
+                << " band " << std::setw(3) << bandRows << std::fixed << std::setprecision(1)
+                << "  full " << std::setw(6) << fullMs << " ms  streaming " << std::setw(6) << streamMs
+                << " ms  different bytes " << diff << std::endl;
+        }
+    }
+    fs::remove(library);
+    return ok;
+}
+
+//слитая постобработка на месте против последовательного apply каждого эффекта с копиями:
+//результат обязан совпадать побайтно при любом порядке эффектов; печатается выделенная память
+bool benchPostProcess() {
+    std::mt19937 rng(99);
+    bool ok = true;
+    cv::Mat mosaic = randomImage(900, 1200, 3, rng);
+    cv::Mat original = randomImage(300, 400, 3, rng);
+    const std::vector<std::vector<std::string>> orders = {
+        { "alpha_blend" }, { "color_correction" }, { "seam_smoothing" },
+        { "color_correction", "seam_smoothing", "alpha_blend" },
+        { "alpha_blend", "color_correction" },
+        { "seam_smoothing", "alpha_blend", "color_correction" },
+    };
+    for (const auto& order : orders) {
+        PostProcessConfig config;
+        for (const auto& name : order) config.addEffect(name);
+        PostProcessPipeline pipeline;
+        pipeline.setup(config);
+
+        cv::Mat reference = mosaic;
+        size_t referenceBytes = 0;
+        double referenceMs = measureMs([&] {
+            for (size_t i = 0; i < pipeline.size(); ++i) {
+                reference = pipeline.effect(i).apply(reference, original);
+                referenceBytes += reference.total() * reference.elemSize();
+            }
+        });
+        cv::Mat fused;
+        double fusedMs = measureMs([&] { fused = pipeline.process(mosaic, original); });
+        size_t diff = countDifferentBytes(reference, fused);
+        ok = ok && diff == 0;
+
+        std::string names;
+        for (const auto& name : order) names += (names.empty() ? "" : "+") + name;
+        std::cout << names << std::fixed << std::setprecision(1) << "\n  sequential " << std::setw(6) << referenceMs
+            << " ms (results " << referenceBytes / (1024.0 * 1024.0) << " MB)  fused " << std::setw(6) << fusedMs
+            << " ms (allocated " << pipeline.getLastAllocatedBytes() / (1024.0 * 1024.0) << " MB)  different bytes " << diff << std::endl;
+    }
+    return ok;
+}
+
+//прежнее сглаживание швов: размытие и смешивание всего изображения, копирование по маске швов
+cv::Mat referenceSeamSmoothing(const cv::Mat& mosaic, int gridSize, double intensity) {
+    cv::Mat mask = cv::Mat::zeros(mosaic.size(), CV_8UC1);
+    int lineWidth = 1 + static_cast<int>(intensity * 2);
+    for (int x = gridSize; x < mosaic.cols; x += gridSize) {
+        int startX = std::max(0, x - lineWidth / 2);
+        int endX = std::min(mosaic.cols, startX + lineWidth);
+        cv::rectangle(mask, cv::Rect(startX, 0, endX - startX, mosaic.rows), cv::Scalar(255), -1);
+    }
+    for (int y = gridSize; y < mosaic.rows; y += gridSize) {
+        int startY = std::max(0, y - lineWidth / 2);
+        int endY = std::min(mosaic.rows, startY + lineWidth);
+        cv::rectangle(mask, cv::Rect(0, startY, mosaic.cols, endY - startY), cv::Scalar(255), -1);
+    }
+    int blurSize = 3 + static_cast<int>(intensity * 5);
+    if (blurSize % 2 == 0) blurSize++;
+    blurSize = std::max(3, std::min(blurSize, std::min(mosaic.rows, mosaic.cols)));
+    cv::Mat blurred, blended, smoothed = mosaic.clone();
+    cv::GaussianBlur(mosaic, blurred, cv::Size(blurSize, blurSize), intensity * 2.0);
+    cv::addWeighted(mosaic, 1.0 - intensity * 0.7, blurred, intensity * 0.7, 0, blended);
+    blended.copyTo(smoothed, mask);
+    return smoothed;
+}
+
+//сглаживание только полос швов против размытия всего изображения: результат обязан совпадать побайтно
+//(в т.ч. при сетке мельче ширины шва, когда швы сливаются, и при размерах, не кратных сетке)
+bool benchSeamSmoothing() {
+    std::mt19937 rng(31);
+    bool ok = true;
+    for (cv::Size size : { cv::Size(1500, 1000), cv::Size(517, 389) }) {
+        cv::Mat mosaic = randomImage(size.height, size.width, 3, rng);
+        for (int gridSize : { 30, 64, 7, 2 }) {
+            //интенсивность из конфигурации доходит до эффекта (ширина швов и ядро размытия)
+            for (double intensity : { 0.5, 0.9 }) {
+                PostProcessConfig config;
+                config.gridSize = gridSize;
+                config.addEffect("seam_smoothing", intensity);
+                PostProcessPipeline pipeline;
+                pipeline.setup(config);
+                cv::Mat reference, strips;
+                double fullMs = measureMs([&] { reference = referenceSeamSmoothing(mosaic, gridSize, intensity); });
+                double stripMs = measureMs([&] { strips = pipeline.process(mosaic, mosaic); });
+                size_t diff = countDifferentBytes(reference, strips);
+                ok = ok && diff == 0;
+                std::cout << size.width << "x" << size.height << " grid " << std::setw(2) << gridSize << std::fixed << std::setprecision(1)
+                    << " intensity " << intensity << "  full image " << std::setw(6) << fullMs << " ms  seam strips " << std::setw(6) << stripMs
+                    << " ms  allocated " << pipeline.getLastAllocatedBytes() / (1024.0 * 1024.0) << " MB  different bytes " << diff << std::endl;
+            }
+        }
+    }
+    return ok;
+}
+
+//ход генерации и кооперативная отмена: счетчики доходят до итога, отмена из другого потока
+//прерывает генерацию исключением GenerationCancelled, после сброса генератор снова работает
+bool benchProgressCancel() {
+    std::mt19937 rng(5);
+    bool ok = true;
+    fs::path library = writeRandomLibrary("mosaic_progress.mosaiclib", 500, 30, rng);
+    cv::Mat source = randomImage(1500, 2000, 3, rng);
+    MosaicGenerator generator;
+    generator.setMetric("texture");
+    ok = generator.loadTileLibrary(library) && ok;
+    const GenerationProgress& progress = generator.getProgress();
+    ok = ok && progress.tilesLoaded == 500 && progress.tilesFound == 500;
+
+    Config cfg;
+    cfg.metric = "texture";
+    double fullMs = measureMs([&] { generator.createMosaic(source, cfg); });
+    ok = ok && progress.cellsTotal == progress.cellsMatched && progress.cellsTotal > 0;
+
+    //отмена из другого потока после начала сопоставления
+    generator.resetProgress();
+    bool cancelled = false;
+    std::thread canceller([&] {
+        while (progress.stage != GenerationStage::Matching) std::this_thread::yield();
+        generator.cancel();
+    });
+    double cancelMs = measureMs([&] {
+        try {
+            generator.createMosaic(source, cfg);
+        }
+        catch (const GenerationCancelled&) {
+            cancelled = true;
+        }
+    });
+    canceller.join();
+    ok = ok && cancelled;
+
+    generator.resetProgress();
+    cv::Mat again = generator.createMosaic(source, cfg);
+    ok = ok && !again.empty();
+    fs::remove(library);
+    std::cout << "cells " << progress.cellsTotal << std::fixed << std::setprecision(1) << "  full " << fullMs
+        << " ms  cancelled after " << cancelMs << " ms" << (cancelled ? "" : "  NOT CANCELLED") << std::endl;
+    return ok;
+}
+
+//сессия генератора: смена метрики туда и обратно не пересчитывает признаки тайлов,
+//а результат совпадает с результатом нового генератора
+bool benchGeneratorSession() {
+    std::mt19937 rng(6);
+    bool ok = true;
+    fs::path library = writeRandomLibrary("mosaic_session.mosaiclib", 2000, 30, rng);
+    cv::Mat source = randomImage(600, 800, 3, rng);
+    MosaicGenerator session;
+    session.setMetric("color");
+    ok = session.loadTileLibrary(library) && ok;
+    ok = ok && !session.hasTiles(library, 30);
+
+    Config cfg;
+    double firstMs = measureMs([&] { ok = session.setMetric("texture") && ok; });
+    double backMs = measureMs([&] { ok = session.setMetric("color") && ok; });
+    double againMs = measureMs([&] { ok = session.setMetric("texture") && ok; });
+    ok = ok && !session.setMetric("unknown");
+
+    //результаты сессии после переключений против нового генератора для каждой метрики
+    size_t diff = 0;
+    for (const char* metricName : { "color", "texture" }) {
+        cfg.metric = metricName;
+        session.setMetric(metricName);
+        cv::Mat reused = session.createMosaic(source, cfg);
+        MosaicGenerator fresh;
+        fresh.setMetric(metricName);
+        ok = fresh.loadTileLibrary(library) && ok;
+        diff += countDifferentBytes(reused, fresh.createMosaic(source, cfg));
+    }
+    ok = ok && diff == 0;
+    fs::remove(library);
+    std::cout << std::fixed << std::setprecision(2) << "metric switch: new " << firstMs << " ms  back " << backMs
+        << " ms  again " << againMs << " ms  differing bytes " << diff << std::endl;
+    return ok;
+}
+
+//ленивые признаки тайлов по видам: метрика с уже посчитанными видами не считает ничего,
+//составная метрика досчитывает только недостающие виды; результат совпадает с новым генератором,
+//пакетные и векторные расстояния составной метрики совпадают с distance
+bool benchLazyFeatures() {
+    std::mt19937 rng(7);
+    bool ok = true;
+    fs::path library = writeRandomLibrary("mosaic_lazy.mosaiclib", 2000, 30, rng);
+    cv::Mat source = randomImage(300, 400, 3, rng);
+    MosaicGenerator session;
+    session.setMetric("color");
+    ok = session.loadTileLibrary(library) && ok;
+
+    Config cfg;
+    cfg.gridStep = 20;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const char* metricName : { "texture", "color", "gradient", "color_contrast", "composite", "texture" }) {
+        cfg.metric = metricName;
+        cv::Mat reused;
+        double ms = measureMs([&] { reused = session.createMosaic(source, cfg); });
+        MosaicGenerator fresh;
+        fresh.setMetric(metricName);
+        ok = fresh.loadTileLibrary(library) && ok;
+        size_t diff = countDifferentBytes(reused, fresh.createMosaic(source, cfg));
+        ok = ok && diff == 0;
+        std::cout << std::left << std::setw(16) << metricName << std::right << " mosaic " << std::setw(7) << ms
+            << " ms  features " << std::setw(6) << session.getFeatureMemoryBytes() / 1024 << " KB  differing bytes " << diff << std::endl;
+    }
+    for (const auto& entry : session.getFeatureMemoryByMetric()) {
+        std::cout << "  " << std::left << std::setw(16) << entry.first << std::right << entry.second / 1024 << " KB" << std::endl;
+    }
+    ok = ok && session.getFeatureMemoryByMetric().size() == MosaicGenerator::metricNames().size();
+    fs::remove(library);
+
+    //составная метрика: пакетные ядра и расстояние по векторам индекса против distance
+    CompositeMetric composite;
+    const size_t tileCount = 301, cellCount = 5;
+    FeatureStore tiles, cells;
+    tiles.require(FeatureAll);
+    tiles.resize(tileCount);
+    cells.require(FeatureAll);
+    cells.resize(cellCount);
+    for (size_t i = 0; i < tileCount; ++i) FeatureUtils::computeFeatures(randomImage(16, 16, 3, rng), FeatureAll, tiles, i);
+    for (size_t i = 0; i < cellCount; ++i) FeatureUtils::computeFeatures(randomImage(16, 16, 3, rng), FeatureAll, cells, i);
+    std::vector<double> batch(tileCount), cellVector(composite.featureVectorSize()), tileVector(composite.featureVectorSize());
+    double maxError = 0.0;
+    for (size_t c = 0; c < cellCount; ++c) {
+        composite.distanceBatch(cells, c, tiles, 0, tileCount, batch.data());
+        composite.getFeatureVector(cells, c, cellVector.data());
+        for (size_t t = 0; t < tileCount; ++t) {
+            double reference = composite.distance(cells, c, tiles, t);
+            composite.getFeatureVector(tiles, t, tileVector.data());
+            maxError = std::max(maxError, std::fabs(batch[t] - reference));
+            maxError = std::max(maxError, std::fabs(composite.vectorDistance(cellVector.data(), tileVector.data()) - reference));
+        }
+    }
+    //корни бинов для индекса считаются из float, поэтому допуск больше, чем у ядер
+    ok = ok && maxError <= 1e-4;
+    std::cout << "composite batch/vector max error " << std::scientific << std::setprecision(2) << maxError << std::fixed << std::endl;
+    return ok;
+}
+
+//уровни предпросмотра: время каждого уровня против полной мозаики; полный уровень совпадает с createMosaic,
+//а предпросмотр не меняет состояние генератора (следующая полная мозаика та же)
+bool benchPreview() {
+    std::mt19937 rng(8);
+    bool ok = true;
+    fs::path library = writeRandomLibrary("mosaic_preview.mosaiclib", 1000, 30, rng);
+    cv::Mat source = randomImage(1200, 1600, 3, rng);
+    MosaicGenerator generator;
+    generator.setMetric("texture");
+    ok = generator.loadTileLibrary(library) && ok;
+    PostProcessConfig postCfg;
+    postCfg.gridSize = 20;
+    postCfg.addEffect("color_correction", 0.5);
+    postCfg.addEffect("seam_smoothing", 0.7);
+    generator.setPostProcessConfig(postCfg);
+
+    Config cfg;
+    cfg.metric = "texture";
+    cfg.gridStep = 20;
+    cv::Mat full;
+    double fullMs = measureMs([&] { full = generator.createMosaic(source, cfg); });
+    std::cout << std::fixed << std::setprecision(1) << "full " << fullMs << " ms" << std::endl;
+    for (int factor : MosaicGenerator::previewFactors(source.size(), cfg.gridStep)) {
+        cv::Mat preview;
+        double ms = measureMs([&] { preview = generator.createPreview(source, cfg, factor); });
+        ok = ok && preview.size() == cv::Size(source.cols / factor, source.rows / factor);
+        size_t diff = factor == 1 ? countDifferentBytes(preview, full) : 0;
+        ok = ok && diff == 0;
+        std::cout << "factor " << factor << "  " << preview.cols << "x" << preview.rows << "  " << std::setw(7) << ms
+            << " ms  x" << fullMs / std::max(ms, 1e-3) << (factor == 1 ? "  differing bytes " + std::to_string(diff) : "") << std::endl;
+    }
+    ok = ok && countDifferentBytes(generator.createMosaic(source, cfg), full) == 0;
+    fs::remove(library);
+    return ok;
+}
+
+struct Benchmark {
+    const char* name;
+    std::function<bool()> run;
+};
+
+}
+
+int main(int argc, char** argv) {
+    std::vector<Benchmark> benchmarks = {
+        { "spatial_index", benchSpatialIndex },
+        { "approximate_search", benchApproximateSearch },
+        { "distance_kernels", benchDistanceKernels },
+        { "global_assignment", benchGlobalAssignment },
+        { "source_feature_map", benchSourceFeatureMap },
+        { "cell_feature_maps", benchCellFeatureMaps },
+        { "lbp_kernel", benchLBPKernel },
+        { "gradient_kernel", benchGradientKernel },
+        { "tile_render", benchTileRender },
+        { "tile_atlas", benchTileAtlas },
+        { "tile_library", benchTileLibrary },
+        { "streaming", benchStreaming },
+        { "output_scale", benchOutputScale },
+        { "post_process", benchPostProcess },
+        { "seam_smoothing", benchSeamSmoothing },
+        { "progress_cancel", benchProgressCancel },
+        { "generator_session", benchGeneratorSession },
+        { "lazy_features", benchLazyFeatures },
+        { "preview", benchPreview },
+    };
+
+    //--list - имена замеров по одному в строке (по ним CMake регистрирует тесты ctest)
+    if (argc == 2 && std::string(argv[1]) == "--list") {
+        for (const auto& bench : benchmarks) std::cout << bench.name << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    bool ok = true;
+    for (const auto& bench : benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            if (bench.name == std::string(argv[i])) selected = true;
+        }
+        if (!selected) continue;
+
+        std::cout << "== " << bench.name << " ==" << std::endl;
+        if (!bench.run()) {
+            std::cout << "FAILED: " << bench.name << std::endl;
+            ok = false;
+        }
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
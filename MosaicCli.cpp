@@ -0,0 +1,361 @@
+#include "MosaicProcessor.h"
+#include "PostProcessor.h"
+#include "ImageBands.h"
+#include "TileCache.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//консольная пакетная генерация мозаик без GUI
+//тайлы загружаются один раз и используются для всех исходных изображений; для каждого изображения
+//печатается время этапов, код возврата ненулевой, если хотя бы одно изображение не обработано
+namespace {
+
+//коды возврата
+constexpr int exitFailure = 1;//ошибка загрузки тайлов или обработки изображения
+constexpr int exitUsage = 2;//неверные аргументы
+
+//параметры командной строки
+struct CliOptions {
+    fs::path tilesFolder;//папка тайлов
+    fs::path libraryFile;//файл библиотеки тайлов (вместо папки)
+    fs::path outputDir = ".";//папка результатов
+    fs::path outputFile;//файл результата (только для одного изображения)
+    std::string format = "png";//формат результатов в папке (при --band-rows по умолчанию tif)
+    std::vector<fs::path> sources;//исходные изображения
+    Config cfg;//параметры мозаики
+    PostProcessConfig postCfg;//эффекты постобработки
+    int loadThreads = 0;//потоки загрузки тайлов (0 - по числу ядер)
+    int matchThreads = 0;//потоки сопоставления и постобработки (0 - по числу ядер)
+    bool tileCache = true;//дисковый кэш признаков тайлов
+    int bandRows = 0;//высота полосы потоковой генерации (0 - изображение целиком)
+};
+
+void printUsage(std::ostream& out) {
+    out << "usage: mosaic_cli (--tiles <folder> | --library <file>) [options] <source>...\n"
+        << "tiles:\n"
+        << "  --tiles <folder>          tile images folder\n"
+        << "  --library <file>          tile library file (see MosaicGenerator::buildTileLibrary)\n"
+        << "  --tile-size <px>          tile size (default 30)\n"
+        << "  --rotation <degrees>      rotate tiles\n"
+        << "  --no-cache                do not use the tile feature cache\n"
+        << "mosaic:\n"
+        << "  --step <px>               grid step (default 30)\n"
+        << "  --metric <name>           color, color_contrast, gradient, texture, composite (default color)\n"
+        << "  --max-repeats <n>         limit repeats of a tile\n"
+        << "  --global                  global assignment (with --max-repeats, not with --band-rows)\n"
+        << "  --candidates <n>          candidates per cell for global assignment (default 16)\n"
+        << "  --approximate             approximate search for histogram metrics\n"
+        << "  --probes <n>              clusters probed by approximate search (default 8)\n"
+        << "  --output-tile-size <px>   cell size in the output (default: step)\n"
+        << "  --effect <name>[:<k>]     post-processing effect with intensity k in 0..1 (default 0.5),\n"
+        << "                            repeatable, applied in order (color_correction, seam_smoothing, alpha_blend)\n"
+        << "output:\n"
+        << "  -o, --output <file>       output file (single source only)\n"
+        << "  --output-dir <folder>     output folder, files are named <source>_mosaic.<format> (default .)\n"
+        << "  --format <ext>            output format in the folder (default png, tif with --band-rows)\n"
+        << "  --band-rows <n>           stream binary PPM sources to TIFF outputs by bands of n rows\n"
+        << "                            (-o and --format must then name .tif or .tiff)\n"
+        << "performance:\n"
+        << "  --threads <n>             matching and post-processing threads (default: all cores)\n"
+        << "  --load-threads <n>        tile loading threads (default: all cores)\n";
+}
+
+//разбор целого числа не меньше minValue
+bool parseInt(const std::string& text, int minValue, int& value) {
+    try {
+        size_t end = 0;
+        int parsed = std::stoi(text, &end);
+        if (end != text.size() || parsed < minValue) return false;
+        value = parsed;
+        return true;
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+}
+
+//расширение TIFF (tif или tiff без точки, без учета регистра)
+bool isTiffExtension(std::string extension) {
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == "tif" || extension == "tiff";
+}
+
+//разбор аргументов, false и сообщение об ошибке при неверных аргументах
+bool parseArguments(int argc, char** argv, CliOptions& options, std::string& error) {
+    bool formatSet = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        //значение параметра - следующий аргумент
+        auto value = [&](std::string& out) {
+            if (i + 1 >= argc) {
+                error = "missing value for " + arg;
+                return false;
+            }
+            out = argv[++i];
+            return true;
+        };
+        auto intValue = [&](int minValue, int& out) {
+            std::string text;
+            if (!value(text)) return false;
+            if (!parseInt(text, minValue, out)) {
+                error = "invalid value for " + arg + ": " + text;
+                return false;
+            }
+            return true;
+        };
+        std::string text;
+        bool ok = true;
+        if (arg == "--tiles") {
+            ok = value(text);
+            options.tilesFolder = text;
+        }
+        else if (arg == "--library") {
+            ok = value(text);
+            options.libraryFile = text;
+        }
+        else if (arg == "--tile-size") ok = intValue(1, options.cfg.tileSize);
+        else if (arg == "--rotation") {
+            ok = intValue(0, options.cfg.rotationAngle);
+            options.cfg.rotation = true;
+        }
+        else if (arg == "--no-cache") options.tileCache = false;
+        else if (arg == "--step") ok = intValue(1, options.cfg.gridStep);
+        else if (arg == "--metric") ok = value(options.cfg.metric);
+        else if (arg == "--max-repeats") {
+            ok = intValue(1, options.cfg.maxRepeats);
+            options.cfg.repeats = true;
+        }
+        else if (arg == "--global") options.cfg.globalAssignment = true;
+        else if (arg == "--candidates") ok = intValue(1, options.cfg.assignmentCandidates);
+        else if (arg == "--approximate") options.cfg.approximateSearch = true;
+        else if (arg == "--probes") ok = intValue(1, options.cfg.searchProbes);
+        else if (arg == "--output-tile-size") ok = intValue(1, options.cfg.outputTileSize);
+        else if (arg == "--effect") {
+            ok = value(text);
+            //интенсивность 0..1 после двоеточия (по умолчанию 0.5, как у addEffect)
+            size_t colon = text.find(':');
+            std::string name = text.substr(0, colon);
+            double intensity = 0.5;
+            if (ok && colon != std::string::npos) {
+                size_t end = 0;
+                std::string number = text.substr(colon + 1);
+                try {
+                    intensity = std::stod(number, &end);
+                }
+                catch (const std::exception&) {
+                    end = 0;
+                }
+                if (end == 0 || end != number.size() || intensity < 0.0 || intensity > 1.0) {
+                    error = "invalid effect intensity (expected 0..1): " + text;
+                    return false;
+                }
+            }
+            if (ok && !EffectFactory::createEffect(name)) {
+                error = "unknown effect: " + name;
+                return false;
+            }
+            options.postCfg.addEffect(name, intensity);
+        }
+        else if (arg == "-o" || arg == "--output") {
+            ok = value(text);
+            options.outputFile = text;
+        }
+        else if (arg == "--output-dir") {
+            ok = value(text);
+            options.outputDir = text;
+        }
+        else if (arg == "--format") {
+            ok = value(options.format);
+            formatSet = true;
+        }
+        else if (arg == "--band-rows") ok = intValue(1, options.bandRows);
+        else if (arg == "--threads") ok = intValue(0, options.matchThreads);
+        else if (arg == "--load-threads") ok = intValue(0, options.loadThreads);
+        else if (arg == "-h" || arg == "--help") {
+            error.clear();
+            return false;
+        }
+        else if (!arg.empty() && arg[0] == '-') {
+            error = "unknown option: " + arg;
+            return false;
+        }
+        else {
+            options.sources.push_back(arg);
+        }
+        if (!ok) return false;
+    }
+
+    if (options.tilesFolder.empty() == options.libraryFile.empty()) {
+        error = "exactly one of --tiles and --library is required";
+        return false;
+    }
+    if (options.sources.empty()) {
+        error = "no source images";
+        return false;
+    }
+    //потоковая генерация назначает тайлы полосами, глобальное назначение требует всех клеток сразу
+    if (options.bandRows > 0 && options.cfg.globalAssignment) {
+        error = "--global cannot be combined with --band-rows (streaming assigns tiles greedily band by band)";
+        return false;
+    }
+    if (!options.outputFile.empty() && options.sources.size() != 1) {
+        error = "--output requires a single source image";
+        return false;
+    }
+    //потоковая генерация пишет только TIFF: другое расширение дало бы файл, не совпадающий с содержимым
+    if (options.bandRows > 0) {
+        std::string extension = options.outputFile.extension().string();
+        if (!options.outputFile.empty() && (extension.empty() || !isTiffExtension(extension.substr(1)))) {
+            error = "--band-rows writes TIFF, --output must end with .tif or .tiff: " + options.outputFile.string();
+            return false;
+        }
+        if (formatSet && !isTiffExtension(options.format)) {
+            error = "--band-rows writes TIFF, --format must be tif or tiff: " + options.format;
+            return false;
+        }
+        if (!formatSet) options.format = "tif";
+    }
+    options.postCfg.gridSize = options.cfg.gridStep;
+    return true;
+}
+
+//время в мс с момента start
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//путь результата для исходного изображения
+fs::path outputPath(const CliOptions& options, const fs::path& source) {
+    if (!options.outputFile.empty()) return options.outputFile;
+    return options.outputDir / (source.stem().string() + "_mosaic." + options.format);
+}
+
+//генерация мозаики одного изображения с печатью времени этапов; false и сообщение при ошибке
+bool renderImage(MosaicGenerator& generator, const CliOptions& options, const fs::path& source, const fs::path& output,
+    size_t& pixels, std::string& error) {
+    auto start = std::chrono::steady_clock::now();
+    std::cout << source.string() << " -> " << output.string() << std::fixed << std::setprecision(1);
+
+    //потоковый режим: PPM читается, а TIFF пишется полосами (память ограничена высотой полосы)
+    if (options.bandRows > 0) {
+        PpmBandReader reader;
+        if (!reader.open(source)) {
+            error = "cannot open binary PPM source";
+            return false;
+        }
+        TiffBandWriter writer(output);
+        generator.createMosaicStreaming(reader, writer, options.cfg, options.bandRows);
+        pixels = reader.size().area();
+        //чтение и запись идут полосами вперемешку с остальными этапами, их время копит генератор
+        const GenerationTimings& timings = generator.getLastTimings();
+        std::cout << "  " << writer.size().width << "x" << writer.size().height << "  streamed"
+            << "  read " << timings.readMs << "  features " << timings.tileFeaturesMs << "  match " << timings.matchMs
+            << "  render " << timings.renderMs << "  post " << timings.postProcessMs << "  write " << timings.writeMs;
+    }
+    else {
+        cv::Mat image = cv::imread(source.string(), cv::IMREAD_COLOR);
+        if (image.empty()) {
+            error = "cannot read source image";
+            return false;
+        }
+        double readMs = elapsedMs(start);
+        pixels = image.total();
+
+        cv::Mat mosaic = generator.createMosaic(image, options.cfg);
+        const GenerationTimings& timings = generator.getLastTimings();
+
+        auto writeStart = std::chrono::steady_clock::now();
+        if (!cv::imwrite(output.string(), mosaic)) {
+            error = "cannot write " + output.string();
+            return false;
+        }
+        std::cout << "  " << mosaic.cols << "x" << mosaic.rows
+            << "  read " << readMs << "  features " << timings.tileFeaturesMs << "  match " << timings.matchMs
+            << "  render " << timings.renderMs << "  post " << timings.postProcessMs << "  write " << elapsedMs(writeStart);
+    }
+    std::cout << "  total " << elapsedMs(start) << " ms" << std::endl;
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    CliOptions options;
+    std::string error;
+    if (!parseArguments(argc, argv, options, error)) {
+        if (error.empty()) {
+            printUsage(std::cout);
+            return EXIT_SUCCESS;
+        }
+        std::cerr << "error: " << error << "\n" << "run mosaic_cli --help for usage\n";
+        return exitUsage;
+    }
+
+    MosaicGenerator generator;
+    generator.setTileCacheEnabled(options.tileCache);
+    generator.setLoadThreads(options.loadThreads);
+    generator.setMatchThreads(options.matchThreads);
+    generator.setPostProcessConfig(options.postCfg);
+    //метрика задается до загрузки тайлов, чтобы признаки брались из дискового кэша
+    if (!generator.setMetric(options.cfg.metric)) {
+        std::cerr << "error: unknown metric: " << options.cfg.metric << "\n";
+        return exitUsage;
+    }
+
+    //тайлы загружаются один раз для всех изображений
+    auto loadStart = std::chrono::steady_clock::now();
+    bool loaded = options.libraryFile.empty()
+        ? generator.loadTiles(options.tilesFolder, options.cfg.tileSize, options.cfg.rotation, options.cfg.rotationAngle)
+        : generator.loadTileLibrary(options.libraryFile);
+    if (!loaded || generator.getTilesCount() == 0) {
+        std::cerr << "error: no tiles loaded from "
+            << (options.libraryFile.empty() ? options.tilesFolder : options.libraryFile).string() << "\n";
+        return exitFailure;
+    }
+    std::cout << "tiles " << generator.getTilesCount() << "  loaded in " << std::fixed << std::setprecision(1)
+        << elapsedMs(loadStart) << " ms" << std::endl;
+    //ошибка записи кэша не мешает генерации, следующий запуск просто прочитает тайлы заново
+    if (options.libraryFile.empty() && generator.lastCacheSaveFailed()) {
+        std::cerr << "warning: failed to write tile cache " << TileCache::cachePathFor(options.tilesFolder).string() << "\n";
+    }
+
+    if (options.outputFile.empty()) {
+        std::error_code ec;
+        fs::create_directories(options.outputDir, ec);
+    }
+
+    auto batchStart = std::chrono::steady_clock::now();
+    size_t failed = 0, totalPixels = 0;
+    for (const fs::path& source : options.sources) {
+        size_t pixels = 0;
+        std::string imageError;
+        bool ok = false;
+        try {
+            ok = renderImage(generator, options, source, outputPath(options, source), pixels, imageError);
+        }
+        catch (const std::exception& e) {
+            imageError = e.what();
+        }
+        if (!ok) {
+            std::cout << std::endl;
+            std::cerr << "error: " << source.string() << ": " << imageError << "\n";
+            failed++;
+            continue;
+        }
+        totalPixels += pixels;
+    }
+
+    double batchMs = elapsedMs(batchStart);
+    size_t done = options.sources.size() - failed;
+    std::cout << "images " << done << "/" << options.sources.size() << "  " << batchMs << " ms"
+        << "  " << done * 1000.0 / std::max(batchMs, 1e-3) << " images/s"
+        << "  " << totalPixels / 1000.0 / std::max(batchMs, 1e-3) << " Mpx/s" << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : exitFailure;
+}
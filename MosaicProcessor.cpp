@@ -1,8 +1,23 @@
 #include "MosaicProcessor.h"
-#include <iostream>
+#include "TileCache.h"
+#include "Concurrency.h"
+#include "SpatialIndex.h"
+#include "DistanceKernels.h"
+#include "TileAssignment.h"
+#include "SourceFeatureMap.h"
+#include "FeatureKernels.h"
+#include "TileRenderCache.h"
+#include "TileLibrary.h"
+#include "ImageBands.h"
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <algorithm>
 #include <numeric>
 #include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <functional>
 
 //структура FeatureUtils
 //вспомогательные функции вычисления признаков
@@ -25,37 +40,43 @@ cv::Scalar FeatureUtils::computeStdDev(const cv::Mat& image) {
 
 //вычисляет гистограмму направлений градиентов(HOG - подобный признак)
 //гистограмма показывает распределение направлений краев в изображении
-cv::Mat FeatureUtils::computeGradientHist(const cv::Mat& image) {
+cv::Mat FeatureUtils::computeGradientHist(const cv::Mat& image, bool fastAtan) {
     //проверка входного изображения
     if (image.empty() || image.rows < 3 || image.cols < 3) {
         return cv::Mat::zeros(36, 1, CV_32F);
     }
-    cv::Mat gray, grad_x, grad_y, magnitude, angle;
-    //преобразование в оттенки серого для цветных изображений
-    if (image.channels() == 3) {
-        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
-    }
-    else {
-        gray = image;
-    }
-    gray.convertTo(gray, CV_32F);
-    //вычисление градиентов по осям X и Y с помощью оператора Собеля
-    cv::Sobel(gray, grad_x, CV_32F, 1, 0, 3);
-    cv::Sobel(gray, grad_y, CV_32F, 0, 1, 3);
-    //преобразование декартовых координат в полярные (величина и угол)
-    cv::cartToPolar(grad_x, grad_y, magnitude, angle, true);
     //создание гистограммы с 36 бинами (по 10 градусов на бин)
     const int histSize = 36;
     cv::Mat hist = cv::Mat::zeros(histSize, 1, CV_32F);
-    float angle_step = 360.0f / histSize;
-    //заполнение гистограммы величинами градиентов
-    for (int y = 0; y < angle.rows; ++y) {
-        for (int x = 0; x < angle.cols; ++x) {
-            float angle_val = angle.at<float>(y, x);
-            float mag_val = magnitude.at<float>(y, x);
-            int bin = static_cast<int>(angle_val / angle_step);
-            bin = std::max(0, std::min(bin, histSize - 1));
-            hist.at<float>(bin) += mag_val;
+    if (image.depth() == CV_8U && (image.channels() == 1 || image.channels() == 3)) {
+        //8-битные изображения - за один проход без промежуточных матриц (Собель, величина и бин в регистрах)
+        computeGradientHistogram(image, hist.ptr<float>(), fastAtan);
+    }
+    else {
+        cv::Mat gray, grad_x, grad_y, magnitude, angle;
+        //преобразование в оттенки серого для цветных изображений
+        if (image.channels() == 3) {
+            cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        }
+        else {
+            gray = image;
+        }
+        gray.convertTo(gray, CV_32F);
+        //вычисление градиентов по осям X и Y с помощью оператора Собеля
+        cv::Sobel(gray, grad_x, CV_32F, 1, 0, 3);
+        cv::Sobel(gray, grad_y, CV_32F, 0, 1, 3);
+        //преобразование декартовых координат в полярные (величина и угол)
+        cv::cartToPolar(grad_x, grad_y, magnitude, angle, true);
+        float angle_step = 360.0f / histSize;
+        //заполнение гистограммы величинами градиентов
+        for (int y = 0; y < angle.rows; ++y) {
+            for (int x = 0; x < angle.cols; ++x) {
+                float angle_val = angle.at<float>(y, x);
+                float mag_val = magnitude.at<float>(y, x);
+                int bin = static_cast<int>(angle_val / angle_step);
+                bin = std::max(0, std::min(bin, histSize - 1));
+                hist.at<float>(bin) += mag_val;
+            }
         }
     }
     //нормализация гистограммы
@@ -96,151 +117,485 @@ cv::Mat FeatureUtils::computeLBPFeatures(const cv::Mat& image) {
     else {
         gray = image;
     }
-    //создание LBP-карты
-    cv::Mat lbp = cv::Mat::zeros(gray.rows - 2, gray.cols - 2, CV_8UC1);
-    for (int i = 1; i < gray.rows - 1; i++) {
-        for (int j = 1; j < gray.cols - 1; j++) {
-            lbp.at<uchar>(i - 1, j - 1) = getLBPValue(gray, i, j);
-        }
-    }
-    //вычисление гистограммы LBP-кодов
+    //вычисление гистограммы LBP-кодов векторным ядром (коды совпадают с getLBPValue, LBP-карта не создается)
     const int histSize = 256;
-    float range[] = { 0, 256 };
-    const float* ranges[] = { range };
-    cv::Mat hist;
-    cv::calcHist(&lbp, 1, 0, cv::Mat(), hist, 1, &histSize, ranges, true, false);
+    uint32_t counts[histSize] = {};
+    computeLBPHistogram(gray, counts);
+    cv::Mat hist(histSize, 1, CV_32F);
+    for (int i = 0; i < histSize; ++i) {
+        hist.at<float>(i) = static_cast<float>(counts[i]);
+    }
     //нормализация гистограммы
     cv::normalize(hist, hist, 1.0, 0.0, cv::NORM_L1);
     hist.convertTo(hist, CV_32F);
     return hist;
 }
 
+//вспомогательные функции хранения и сравнения признаков в FeatureStore
+
+//запись каналов cv::Scalar в строку признаков
+static void storeScalar(const cv::Scalar& value, float* out) {
+    for (int i = 0; i < 4; ++i) out[i] = static_cast<float>(value[i]);
+}
+
+//запись гистограммы (CV_32F, bins элементов) в строку признаков
+static void storeHistogram(const cv::Mat& hist, float* out, int bins) {
+    for (int i = 0; i < bins; ++i) {
+        out[i] = i < static_cast<int>(hist.total()) ? hist.at<float>(i) : 0.0f;
+    }
+}
+
+//признаки изображения по видам из маски
+void FeatureUtils::computeFeatures(const cv::Mat& image, unsigned mask, FeatureStore& store, size_t row) {
+    if (mask & FeatureColor) storeScalar(cv::mean(image), store.color(row));
+    if (mask & FeatureStdDev) storeScalar(computeStdDev(image), store.stddev(row));
+    if (mask & FeatureGradient) storeHistogram(computeGradientHist(image), store.gradient(row), FeatureStore::gradientBins);
+    if (mask & FeatureTexture) storeHistogram(computeLBPFeatures(image), store.texture(row), FeatureStore::textureBins);
+}
+
+//вектор корней из бинов гистограммы (для индекса):
+//при нем расстояние Бхаттачарии нормированных гистограмм пропорционально евклидову
+static void histogramRoots(const float* hist, int bins, double* out) {
+    for (int i = 0; i < bins; ++i) {
+        out[i] = std::sqrt(std::max(0.0f, hist[i]));
+    }
+}
+
+//расстояние Бхаттачарии по векторам корней из бинов двух гистограмм
+//sqrt(h1*h2) = sqrt(h1)*sqrt(h2), суммы бинов - суммы квадратов корней
+static double bhattacharyyaFromRoots(const double* a, const double* b, int size) {
+    double dot = 0.0, s1 = 0.0, s2 = 0.0;
+    for (int i = 0; i < size; ++i) {
+        dot += a[i] * b[i];
+        s1 += a[i] * a[i];
+        s2 += b[i] * b[i];
+    }
+    s1 *= s2;
+    s1 = std::fabs(s1) > FLT_EPSILON ? 1.0 / std::sqrt(s1) : 1.0;
+    return std::sqrt(std::max(1.0 - dot * s1, 0.0));
+}
+
+//класс IMetric
+//признаки клетки по карте: по умолчанию считаются по пикселям области исходного изображения
+void IMetric::computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const {
+    computeCellFeatures(map.image()(region), cells, row);
+}
+
 //класс ColorMetric
 //вычисляет параметры клетки
-void ColorMetric::computeCellFeatures(Tile& cell, const cv::Mat& cellImage) {
-    cell.color = cv::mean(cellImage);
+void ColorMetric::computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const {
+    storeScalar(cv::mean(cellImage), cells.color(row));
+}
+//вычисляет параметры клетки по интегральному изображению карты
+void ColorMetric::computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const {
+    storeScalar(map.mean(region), cells.color(row));
 }
 //вычисляет параметры тайтла
-void ColorMetric::computeTileFeatures(Tile& tile, const cv::Mat& tileImage) {
-    tile.color = cv::mean(tileImage);
+void ColorMetric::computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const {
+    FeatureUtils::computeFeatures(tileImage, featureMask(), tiles, row);
 }
 //вычисляет расстояние между параметрами клетки и тайла на основе цвета
-double ColorMetric::distance(const Tile& cell, const Tile& tile) const {
-    return cv::norm(cell.color, tile.color);
+double ColorMetric::distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const {
+    return DistanceScalar::colorL2(cells.color(cell), tiles.color(tile));
+}
+//пакетное вычисление расстояний векторными ядрами
+void ColorMetric::distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+    size_t begin, size_t end, double* out) const {
+    if (begin >= end) return;
+    distanceKernels().colorL2(cells.color(cell), tiles.color(begin), end - begin, out);
 }
 //геттер для получения имени метрики
 std::string ColorMetric::getName() const {
     return "color";
 }
+//используемые признаки: средний цвет
+unsigned ColorMetric::featureMask() const {
+    return FeatureColor;
+}
+//размер вектора признаков: 4 канала среднего цвета
+int ColorMetric::featureVectorSize() const {
+    return 4;
+}
+//вектор признаков для индекса
+void ColorMetric::getFeatureVector(const FeatureStore& store, size_t row, double* out) const {
+    const float* color = store.color(row);
+    for (int i = 0; i < 4; ++i) out[i] = color[i];
+}
+//евклидово расстояние между векторами
+double ColorMetric::vectorDistance(const double* a, const double* b) const {
+    double sum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        double d = a[i] - b[i];
+        sum += d * d;
+    }
+    return std::sqrt(sum);
+}
 
 //класс ColorContrastMetric
 //вычисляет параметры клетки
-void ColorContrastMetric::computeCellFeatures(Tile& cell, const cv::Mat& cellImage) {
-    cell.color = cv::mean(cellImage);
-    cell.stddev = FeatureUtils::computeStdDev(cellImage);
+void ColorContrastMetric::computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const {
+    storeScalar(cv::mean(cellImage), cells.color(row));
+    storeScalar(FeatureUtils::computeStdDev(cellImage), cells.stddev(row));
+}
+//вычисляет параметры клетки по интегральным изображениям карты
+void ColorContrastMetric::computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const {
+    storeScalar(map.mean(region), cells.color(row));
+    storeScalar(map.stddev(region), cells.stddev(row));
 }
 //вычисляет параметры тайтла
-void ColorContrastMetric::computeTileFeatures(Tile& tile, const cv::Mat& tileImage) {
-    tile.color = cv::mean(tileImage);
-    tile.stddev = FeatureUtils::computeStdDev(tileImage);
+void ColorContrastMetric::computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const {
+    FeatureUtils::computeFeatures(tileImage, featureMask(), tiles, row);
 }
 //вычисляет расстояние между параметрами клетки и тайла на основе цвета и контрастности
-double ColorContrastMetric::distance(const Tile& cell, const Tile& tile) const {
-    double colorDist = cv::norm(cell.color, tile.color);
-    double stddevDist = cv::norm(cell.stddev, tile.stddev);
+double ColorContrastMetric::distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const {
+    double colorDist = DistanceScalar::colorL2(cells.color(cell), tiles.color(tile));
+    double stddevDist = DistanceScalar::colorL2(cells.stddev(cell), tiles.stddev(tile));
     return colorDist + 2.0 * stddevDist;
 }
+//пакетное вычисление расстояний векторными ядрами
+void ColorContrastMetric::distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+    size_t begin, size_t end, double* out) const {
+    if (begin >= end) return;
+    distanceKernels().colorContrast(cells.color(cell), cells.stddev(cell),
+        tiles.color(begin), tiles.stddev(begin), end - begin, out);
+}
 //геттер для получения имени метрики
 std::string ColorContrastMetric::getName() const {
     return "color_contrast";
 }
+//используемые признаки: средний цвет и отклонение
+unsigned ColorContrastMetric::featureMask() const {
+    return FeatureColor | FeatureStdDev;
+}
+//размер вектора признаков: 4 канала среднего цвета и 4 канала отклонения
+int ColorContrastMetric::featureVectorSize() const {
+    return 8;
+}
+//вектор признаков для индекса
+void ColorContrastMetric::getFeatureVector(const FeatureStore& store, size_t row, double* out) const {
+    const float* color = store.color(row);
+    const float* stddev = store.stddev(row);
+    for (int i = 0; i < 4; ++i) {
+        out[i] = color[i];
+        out[4 + i] = stddev[i];
+    }
+}
+//расстояние между векторами: сумма двух евклидовых расстояний (удовлетворяет неравенству треугольника)
+double ColorContrastMetric::vectorDistance(const double* a, const double* b) const {
+    double colorSum = 0.0, stddevSum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        double dc = a[i] - b[i];
+        double ds = a[4 + i] - b[4 + i];
+        colorSum += dc * dc;
+        stddevSum += ds * ds;
+    }
+    return std::sqrt(colorSum) + 2.0 * std::sqrt(stddevSum);
+}
 
 //класс GradientMetric
 //вычисляет параметры клетки
-void GradientMetric::computeCellFeatures(Tile& cell, const cv::Mat& cellImage) {
-    cell.gradientHist = FeatureUtils::computeGradientHist(cellImage);
+void GradientMetric::computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const {
+    storeHistogram(FeatureUtils::computeGradientHist(cellImage), cells.gradient(row), FeatureStore::gradientBins);
+}
+//вычисляет параметры клетки по плоскостям градиента карты
+void GradientMetric::computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const {
+    map.gradientHistogram(region, cells.gradient(row));
 }
 //вычисляет параметры тайтла
-void GradientMetric::computeTileFeatures(Tile& tile, const cv::Mat& tileImage) {
-    tile.gradientHist = FeatureUtils::computeGradientHist(tileImage);
+void GradientMetric::computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const {
+    FeatureUtils::computeFeatures(tileImage, featureMask(), tiles, row);
 }
 //вычисляет расстояние между параметрами клетки и тайла на основе гистограмм градиентов
-double GradientMetric::distance(const Tile& cell, const Tile& tile) const {
-    //проверка гистограмм (не пустые)
-    if (cell.gradientHist.empty() || tile.gradientHist.empty()) {
-        return std::numeric_limits<double>::max();
-    }
+double GradientMetric::distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const {
     //вычисление расстояния Бхаттачарии между гистограммами
-    double histDist = cv::compareHist(cell.gradientHist, tile.gradientHist, cv::HISTCMP_BHATTACHARYYA);
+    double histDist = DistanceScalar::bhattacharyya(cells.gradient(cell), tiles.gradient(tile), FeatureStore::gradientBins);
 
     // Масштабируем до диапазона, сравнимого с цветовыми метриками
     return histDist * 1000.0;
 }
+//пакетное вычисление расстояний векторными ядрами
+void GradientMetric::distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+    size_t begin, size_t end, double* out) const {
+    if (begin >= end) return;
+    distanceKernels().bhattacharyya(cells.gradient(cell), tiles.gradient(begin),
+        FeatureStore::gradientBins, FeatureStore::gradientStride, end - begin, out);
+    for (size_t i = 0; i < end - begin; ++i) out[i] *= 1000.0;
+}
 //геттер для получения имени метрики
 std::string GradientMetric::getName() const {
     return "gradient";
 }
+//используемые признаки: гистограмма градиентов
+unsigned GradientMetric::featureMask() const {
+    return FeatureGradient;
+}
+//размер вектора признаков: корни из бинов гистограммы
+int GradientMetric::featureVectorSize() const {
+    return FeatureStore::gradientBins;
+}
+//вектор признаков для индекса: поэлементный корень гистограммы
+void GradientMetric::getFeatureVector(const FeatureStore& store, size_t row, double* out) const {
+    histogramRoots(store.gradient(row), FeatureStore::gradientBins, out);
+}
+//расстояние Бхаттачарии по векторам корней
+double GradientMetric::vectorDistance(const double* a, const double* b) const {
+    return bhattacharyyaFromRoots(a, b, FeatureStore::gradientBins) * 1000.0;
+}
 
 //класс TextureMetric
 //вычисляет параметры клетки
-void TextureMetric::computeCellFeatures(Tile& cell, const cv::Mat& cellImage) {
-    cell.textureFeatures = FeatureUtils::computeLBPFeatures(cellImage);
+void TextureMetric::computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const {
+    storeHistogram(FeatureUtils::computeLBPFeatures(cellImage), cells.texture(row), FeatureStore::textureBins);
+}
+//вычисляет параметры клетки по плоскости LBP-кодов карты
+void TextureMetric::computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const {
+    map.textureHistogram(region, cells.texture(row));
 }
 //вычисляет параметры тайтла
-void TextureMetric::computeTileFeatures(Tile& tile, const cv::Mat& tileImage) {
-    tile.textureFeatures = FeatureUtils::computeLBPFeatures(tileImage);
+void TextureMetric::computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const {
+    FeatureUtils::computeFeatures(tileImage, featureMask(), tiles, row);
 }
 //вычисляет расстояние между параметрами клетки и тайла на основе текстурных признаков
-double TextureMetric::distance(const Tile& cell, const Tile& tile) const {
-    const cv::Mat& hist1 = cell.textureFeatures;
-    const cv::Mat& hist2 = tile.textureFeatures;
-    //проверка гистограмм
-    if (hist1.empty() || hist2.empty() || hist1.size() != hist2.size()) {
-        return std::numeric_limits<double>::max();
-    }
+double TextureMetric::distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const {
     //вычисление расстояния Бхаттачарии между гистограммами LBP
-    double histDist = cv::compareHist(hist1, hist2, cv::HISTCMP_BHATTACHARYYA);
+    double histDist = DistanceScalar::bhattacharyya(cells.texture(cell), tiles.texture(tile), FeatureStore::textureBins);
     return histDist * 1000.0;
 }
+//пакетное вычисление расстояний векторными ядрами
+void TextureMetric::distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+    size_t begin, size_t end, double* out) const {
+    if (begin >= end) return;
+    distanceKernels().bhattacharyya(cells.texture(cell), tiles.texture(begin),
+        FeatureStore::textureBins, FeatureStore::textureStride, end - begin, out);
+    for (size_t i = 0; i < end - begin; ++i) out[i] *= 1000.0;
+}
 //геттер для получения имени метрики
 std::string TextureMetric::getName() const {
     return "texture";
 }
-//класс MosaicGenerator - класс для создания мозаики
-//сеттер метрики по имени
-bool MosaicGenerator::setMetric(const std::string& metricName) {
-    if (metricName == "color") {
-        metric = std::make_unique<ColorMetric>();
-    }
-    else if (metricName == "color_contrast") {
-        metric = std::make_unique<ColorContrastMetric>();
-    }
-    else if (metricName == "gradient") {
-        metric = std::make_unique<GradientMetric>();
+//используемые признаки: гистограмма LBP
+unsigned TextureMetric::featureMask() const {
+    return FeatureTexture;
+}
+//размер вектора признаков: корни из бинов гистограммы
+int TextureMetric::featureVectorSize() const {
+    return FeatureStore::textureBins;
+}
+//вектор признаков для индекса: поэлементный корень гистограммы
+void TextureMetric::getFeatureVector(const FeatureStore& store, size_t row, double* out) const {
+    histogramRoots(store.texture(row), FeatureStore::textureBins, out);
+}
+//расстояние Бхаттачарии по векторам корней
+double TextureMetric::vectorDistance(const double* a, const double* b) const {
+    return bhattacharyyaFromRoots(a, b, FeatureStore::textureBins) * 1000.0;
+}
+
+//класс CompositeMetric
+//вычисляет параметры клетки
+void CompositeMetric::computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const {
+    FeatureUtils::computeFeatures(cellImage, featureMask(), cells, row);
+}
+//вычисляет параметры клетки по всем плоскостям карты
+void CompositeMetric::computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const {
+    storeScalar(map.mean(region), cells.color(row));
+    storeScalar(map.stddev(region), cells.stddev(row));
+    map.gradientHistogram(region, cells.gradient(row));
+    map.textureHistogram(region, cells.texture(row));
+}
+//вычисляет параметры тайтла
+void CompositeMetric::computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const {
+    FeatureUtils::computeFeatures(tileImage, featureMask(), tiles, row);
+}
+//вычисляет расстояние: цвет и контрастность плюс взвешенные расстояния гистограмм
+double CompositeMetric::distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const {
+    double colorDist = DistanceScalar::colorL2(cells.color(cell), tiles.color(tile));
+    double stddevDist = DistanceScalar::colorL2(cells.stddev(cell), tiles.stddev(tile));
+    double gradientDist = DistanceScalar::bhattacharyya(cells.gradient(cell), tiles.gradient(tile), FeatureStore::gradientBins);
+    double textureDist = DistanceScalar::bhattacharyya(cells.texture(cell), tiles.texture(tile), FeatureStore::textureBins);
+    return colorDist + 2.0 * stddevDist + histogramWeight * (gradientDist + textureDist);
+}
+//пакетное вычисление расстояний векторными ядрами: слагаемые гистограмм считаются блоками в буфер на стеке
+void CompositeMetric::distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+    size_t begin, size_t end, double* out) const {
+    if (begin >= end) return;
+    const DistanceKernels& kernels = distanceKernels();
+    kernels.colorContrast(cells.color(cell), cells.stddev(cell), tiles.color(begin), tiles.stddev(begin), end - begin, out);
+    const size_t block = 64;
+    double gradientDist[block], textureDist[block];
+    for (size_t first = begin; first < end; first += block) {
+        size_t count = std::min(block, end - first);
+        kernels.bhattacharyya(cells.gradient(cell), tiles.gradient(first),
+            FeatureStore::gradientBins, FeatureStore::gradientStride, count, gradientDist);
+        kernels.bhattacharyya(cells.texture(cell), tiles.texture(first),
+            FeatureStore::textureBins, FeatureStore::textureStride, count, textureDist);
+        for (size_t i = 0; i < count; ++i) {
+            out[first - begin + i] += histogramWeight * (gradientDist[i] + textureDist[i]);
+        }
     }
-    else if (metricName == "texture") {
-        metric = std::make_unique<TextureMetric>();
+}
+//геттер для получения имени метрики
+std::string CompositeMetric::getName() const {
+    return "composite";
+}
+//используемые признаки: все виды
+unsigned CompositeMetric::featureMask() const {
+    return FeatureAll;
+}
+//размер вектора признаков: цвет, отклонение и корни из бинов обеих гистограмм
+int CompositeMetric::featureVectorSize() const {
+    return 8 + FeatureStore::gradientBins + FeatureStore::textureBins;
+}
+//вектор признаков для индекса
+void CompositeMetric::getFeatureVector(const FeatureStore& store, size_t row, double* out) const {
+    const float* color = store.color(row);
+    const float* stddev = store.stddev(row);
+    for (int i = 0; i < 4; ++i) {
+        out[i] = color[i];
+        out[4 + i] = stddev[i];
     }
-    else {
-        return false;
+    histogramRoots(store.gradient(row), FeatureStore::gradientBins, out + 8);
+    histogramRoots(store.texture(row), FeatureStore::textureBins, out + 8 + FeatureStore::gradientBins);
+}
+//расстояние между векторами: сумма расстояний частей (каждое удовлетворяет неравенству треугольника)
+double CompositeMetric::vectorDistance(const double* a, const double* b) const {
+    double colorSum = 0.0, stddevSum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        double dc = a[i] - b[i];
+        double ds = a[4 + i] - b[4 + i];
+        colorSum += dc * dc;
+        stddevSum += ds * ds;
     }
+    const int textureOffset = 8 + FeatureStore::gradientBins;
+    double gradientDist = bhattacharyyaFromRoots(a + 8, b + 8, FeatureStore::gradientBins);
+    double textureDist = bhattacharyyaFromRoots(a + textureOffset, b + textureOffset, FeatureStore::textureBins);
+    return std::sqrt(colorSum) + 2.0 * std::sqrt(stddevSum) + histogramWeight * (gradientDist + textureDist);
+}
+//класс MosaicGenerator - класс для создания мозаики
+MosaicGenerator::MosaicGenerator() : renderCache(std::make_unique<TileRenderCache>()) {}
 
-    //пересчитываем параметры для всех уже загруженных тайлов
-    for (auto& tile : tiles) {
-        computeTileFeatures(tile, tile.image);
-    }
+//сброс хода задачи
+void GenerationProgress::reset() {
+    stage = GenerationStage::Idle;
+    tilesFound = 0;
+    tilesLoaded = 0;
+    cellsTotal = 0;
+    cellsMatched = 0;
+    cancelled = false;
+}
+
+//проверка запроса отмены во внутренних циклах
+void MosaicGenerator::throwIfCancelled() const {
+    if (progress.cancelled) throw GenerationCancelled();
+}
+MosaicGenerator::~MosaicGenerator() = default;
+
+//память пикселей тайлов
+size_t MosaicGenerator::getTileMemoryBytes() const {
+    return tileAtlas.getMemoryBytes() + renderCache->getMemoryBytes();
+}
 
+//удаление тайлов вместе с их признаками и отрисовками
+void MosaicGenerator::clearTiles() {
+    tiles.clear();
+    tileAtlas.clear();
+    tileLibrary.close();
+    features.resize(0);
+    tileKinds = 0;
+    tilesFolder.clear();
+    renderCache->clear();
+    indexDirty = true;
+}
+
+//тайлы папки остаются загруженными между генерациями, пока не изменятся папка, размер или поворот
+bool MosaicGenerator::hasTiles(const fs::path& folder, int size, bool enableRotation, int rotation) const {
+    return !tiles.empty() && !tilesFolder.empty() && tilesFolder == folder &&
+        tilesSize == size && tilesAngle == (enableRotation ? rotation : 0);
+}
+
+//создание метрики по имени (nullptr - неизвестное имя)
+static std::unique_ptr<IMetric> createMetric(const std::string& metricName) {
+    if (metricName == "color") return std::make_unique<ColorMetric>();
+    if (metricName == "color_contrast") return std::make_unique<ColorContrastMetric>();
+    if (metricName == "gradient") return std::make_unique<GradientMetric>();
+    if (metricName == "texture") return std::make_unique<TextureMetric>();
+    if (metricName == "composite") return std::make_unique<CompositeMetric>();
+    return nullptr;
+}
+
+//имена всех метрик
+std::vector<std::string> MosaicGenerator::metricNames() {
+    return { "color", "color_contrast", "gradient", "texture", "composite" };
+}
+
+//сеттер метрики по имени
+//признаки тайлов не пересчитываются: недостающие виды досчитываются в ensureTileFeatures перед сопоставлением,
+//а уже посчитанные виды сохраняются при переключении метрик (индекс ссылается на метрику, поэтому перестраивается)
+bool MosaicGenerator::setMetric(const std::string& metricName) {
+    //метрика не изменилась
+    if (metric && metric->getName() == metricName) {
+        return true;
+    }
+    std::unique_ptr<IMetric> created = createMetric(metricName);
+    if (!created) return false;
+    metric = std::move(created);
+    tileIndex.reset();
+    indexDirty = true;
     return true;
 }
 
+//досчет признаков тайлов для текущей метрики: считаются только виды, которых еще нет
+//(из таблицы открытой библиотеки, если она их хранит, иначе по изображениям тайлов)
+void MosaicGenerator::ensureTileFeatures() {
+    if (!metric) return;
+    unsigned missing = metric->featureMask() & ~tileKinds;
+    if (!missing || tiles.empty()) return;
+    unsigned stored = tileLibrary.isOpen() ? missing & tileLibrary.featureMask() : 0;
+    unsigned computed = missing & ~stored;
+    features.require(missing);
+    parallelFor(tiles.size(), loadThreads, [&](size_t i) {
+        if (progress.cancelled) return;
+        if (stored) tileLibrary.readFeatures(i, features, i);
+        FeatureUtils::computeFeatures(tiles[i].image, computed, features, i);
+    }, 64);
+    throwIfCancelled();
+    tileKinds |= missing;
+}
+
+//память признаков тайлов по метрикам
+std::map<std::string, size_t> MosaicGenerator::getFeatureMemoryByMetric() const {
+    std::map<std::string, size_t> result;
+    for (const std::string& name : metricNames()) {
+        unsigned mask = createMetric(name)->featureMask();
+        if ((tileKinds & mask) == mask) result[name] = features.memoryBytes(mask);
+    }
+    return result;
+}
+
 //вычисление признаков для тайла с помощью текущей метрики
-void MosaicGenerator::computeTileFeatures(Tile& tile, const cv::Mat& image) const {
+void MosaicGenerator::computeTileFeatures(const cv::Mat& image, FeatureStore& store, size_t row) const {
     if (metric) {
-        metric->computeTileFeatures(tile, image);
+        metric->computeTileFeatures(image, store, row);
+    }
+}
+
+//подготовка изображения тайла: масштабирование до заданного размера и поворот на заданный угол
+static cv::Mat prepareTileImage(const cv::Mat& originalTile, int size, int angle) {
+    cv::Mat resizedTile;
+    cv::resize(originalTile, resizedTile, cv::Size(size, size));
+    if (angle == 0) {
+        return resizedTile;
     }
+    cv::Mat rotatedTile;
+    cv::Point2f center((float)size / 2, (float)size / 2);
+    cv::Mat rot_mat = cv::getRotationMatrix2D(center, angle, 1.0);
+    cv::warpAffine(resizedTile, rotatedTile, rot_mat, resizedTile.size(),
+        cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
+    return rotatedTile;
 }
 
 //загрузка тайлов из указанной папки
+//конвейер: обход папки -> пул декодирования -> пул масштабирования/поворота/признаков -> упорядоченная вставка;
+//кол-во элементов в обработке ограничено, originalIndex назначается в порядке обхода папки
 bool MosaicGenerator::loadTiles(const fs::path& folder, int size, bool enableRotation, int rotation) {
     //метрика по умолчанию
     if (!metric) {
@@ -248,105 +603,853 @@ bool MosaicGenerator::loadTiles(const fs::path& folder, int size, bool enableRot
     }
 
     tiles.clear();
-    int originalIndex = 0;
-    //обход всех файлов в указанной папке
-    for (const auto& entry : fs::directory_iterator(folder)) {
-        if (entry.is_regular_file()) {
-            cv::Mat originalTile = cv::imread(entry.path().string(), cv::IMREAD_COLOR);
-
-            if (!originalTile.empty()) {
-                //изменение размера тайла до заданного
-                cv::Mat resizedTile;
-                cv::resize(originalTile, resizedTile, cv::Size(size, size));
-                //определение угла поворота для тайла
-                std::vector<int> angles;
-                if (enableRotation) {
-                    angles.push_back(rotation);
+    tileAtlas.clear();
+    tileLibrary.close();
+    renderCache->clear();
+    tileKinds = 0;
+    tilesFolder.clear();
+    progress.stage = GenerationStage::LoadingTiles;
+    progress.tilesFound = 0;
+    progress.tilesLoaded = 0;
+    unsigned featureMask = metric->featureMask();
+    features.clear();
+    features.require(featureMask);
+    int angle = enableRotation ? rotation : 0;
+    //дисковый кэш изображений и признаков для текущих размера тайла и угла (виды признаков - по записям)
+    TileCache cache(folder, size, angle);
+    std::mutex cacheMutex;
+    cacheSaveFailed = false;
+    if (tileCacheEnabled) {
+        cache.load();
+    }
+
+    //элемент конвейера: один файл папки
+    struct LoadItem {
+        size_t seq = 0;//порядковый номер файла при обходе папки
+        fs::path path;//путь к файлу
+        FileStamp stamp;//отметка файла для кэша
+        cv::Mat decoded;//декодированное изображение
+        Tile tile;//готовый тайл
+        FeatureStore features;//признаки тайла (одна строка)
+        bool ok = false;//тайл успешно подготовлен
+        bool fromCache = false;//тайл взят из кэша
+        unsigned cachedKinds = 0;//виды признаков метрики, взятые из кэша
+        bool last = false;//маркер конца обхода (seq = кол-во файлов)
+    };
+
+    int threadCount = resolveThreadCount(loadThreads);
+    int decodeThreads = std::max(1, (threadCount + 1) / 2);
+    int featureThreads = std::max(1, threadCount / 2);
+    size_t inFlight = static_cast<size_t>(threadCount) * 4;
+
+    BoundedQueue<LoadItem> decodeQueue(inFlight);
+    BoundedQueue<LoadItem> featureQueue(inFlight);
+    BoundedQueue<LoadItem> resultQueue(inFlight + 1);
+    Semaphore window(inFlight);//ограничение памяти: не больше inFlight файлов между обходом и вставкой
+    std::atomic<int> activeDecoders(decodeThreads);
+    std::atomic<bool> aborted(false);//обход или вставка завершились исключением, этапы останавливаются
+    std::exception_ptr enumeratorError;//исключение обхода (пробрасывается после остановки всех потоков)
+
+    //этап 1: обход папки и проверка кэша
+    //при исключении обход прекращается, но очередь декодирования закрывается и маркер конца отправляется всегда,
+    //поэтому вставка дочитывает уже отправленные файлы и завершается
+    std::thread enumerator([&] {
+        size_t seq = 0;
+        try {
+            std::error_code ec;
+            for (fs::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+                //при отмене обход прекращается, уже найденные файлы дочитываются без обработки
+                if (progress.cancelled || aborted) break;
+                if (!it->is_regular_file(ec)) continue;
+                progress.tilesFound++;
+                window.acquire();
+                if (aborted) break;
+                LoadItem item;
+                //номер занимается только отправленным элементом: иначе вставка ждала бы файл, который не придет
+                item.seq = seq;
+                item.path = it->path();
+                item.stamp = FileStamp::of(item.path);
+                item.features.require(featureMask);
+                item.features.resize(1);
+                bool cached = false;
+                if (tileCacheEnabled) {
+                    std::lock_guard<std::mutex> lock(cacheMutex);
+                    cached = cache.find(item.path, item.stamp, item.tile, item.features, 0, item.cachedKinds);
+                }
+                //тайл из кэша: чтение и масштабирование пропускаются, признаки досчитываются только недостающих видов
+                //(кэш заполнен другой метрикой)
+                if (cached && item.cachedKinds == featureMask) {
+                    item.ok = true;
+                    item.fromCache = true;
+                    resultQueue.push(std::move(item));
+                }
+                else if (cached) {
+                    item.fromCache = true;
+                    featureQueue.push(std::move(item));
+                }
+                else {
+                    decodeQueue.push(std::move(item));
+                }
+                seq++;
+            }
+        }
+        catch (...) {
+            enumeratorError = std::current_exception();
+            aborted = true;
+        }
+        decodeQueue.close();
+        LoadItem marker;
+        marker.seq = seq;
+        marker.last = true;
+        resultQueue.push(std::move(marker));
+    });
+
+    //этап 2: декодирование файлов
+    std::vector<std::thread> decoders;
+    for (int t = 0; t < decodeThreads; ++t) {
+        decoders.emplace_back([&] {
+            LoadItem item;
+            while (decodeQueue.pop(item)) {
+                if (progress.cancelled || aborted) {
+                    resultQueue.push(std::move(item));
+                    continue;
+                }
+                //ошибка декодирования (в том числе нехватка памяти) пропускает файл, а не завершает процесс
+                try {
+                    item.decoded = cv::imread(item.path.string(), cv::IMREAD_COLOR);
+                }
+                catch (const std::exception&) {
+                    item.decoded.release();
+                }
+                if (item.decoded.empty()) {
+                    resultQueue.push(std::move(item));
                 }
                 else {
-                    angles.push_back(0);
+                    featureQueue.push(std::move(item));
                 }
-                //поворот всех тайтлов на заданный угол
-                for (int angle : angles) {
-                    cv::Mat rotatedTile;
-                    if (angle != 0) {
-                        cv::Point2f center((float)size / 2, (float)size / 2);
-                        cv::Mat rot_mat = cv::getRotationMatrix2D(center, angle, 1.0);
-                        cv::warpAffine(resizedTile, rotatedTile, rot_mat, resizedTile.size(),
-                            cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
+            }
+            //последний завершившийся декодер закрывает очередь следующего этапа
+            if (--activeDecoders == 0) {
+                featureQueue.close();
+            }
+        });
+    }
+
+    //этап 3: масштабирование, поворот и вычисление признаков (для тайлов из кэша - только недостающих видов)
+    std::vector<std::thread> featurizers;
+    for (int t = 0; t < featureThreads; ++t) {
+        featurizers.emplace_back([&] {
+            LoadItem item;
+            while (featureQueue.pop(item)) {
+                if (progress.cancelled || aborted) {
+                    item.decoded.release();
+                    resultQueue.push(std::move(item));
+                    continue;
+                }
+                try {
+                    if (!item.fromCache) {
+                        item.tile.image = prepareTileImage(item.decoded, size, angle);
+                        item.tile.angle = angle;
                     }
-                    else {
-                        rotatedTile = resizedTile.clone();
+                    FeatureUtils::computeFeatures(item.tile.image, featureMask & ~item.cachedKinds, item.features, 0);
+                    item.ok = true;
+                }
+                catch (const std::exception&) {
+                    item.ok = false;
+                }
+                item.decoded.release();
+                resultQueue.push(std::move(item));
+            }
+        });
+    }
+
+    //этап 4: упорядоченная вставка в текущем потоке
+    //исключение при вставке (например, нехватка памяти для атласа) останавливает все этапы:
+    //очереди закрываются, обход освобождается от ожидания окна, потоки дожидаются и ошибка пробрасывается дальше
+    std::exception_ptr error;
+    try {
+        std::map<size_t, LoadItem> pending;//элементы, пришедшие раньше своей очереди
+        size_t nextSeq = 0;
+        size_t totalCount = std::numeric_limits<size_t>::max();
+        int originalIndex = 0;
+        LoadItem item;
+        while (nextSeq < totalCount && resultQueue.pop(item)) {
+            if (item.last) {
+                totalCount = item.seq;
+                continue;
+            }
+            pending.emplace(item.seq, std::move(item));
+            for (auto it = pending.find(nextSeq); it != pending.end(); it = pending.find(nextSeq)) {
+                LoadItem& ready = it->second;
+                if (ready.ok) {
+                    ready.tile.originalIndex = originalIndex++;
+                    features.copyRow(ready.features, 0, features.addRow());
+                    //пиксели переносятся в атлас, тайл хранит только заголовок
+                    ready.tile.image = tileAtlas.add(ready.tile.image);
+                    //запись кэша ссылается на пиксели атласа, а не на свою копию:
+                    //новые тайлы и досчитанные виды признаков дописываются в кэш (виды других метрик сохраняются),
+                    //у полностью найденных в кэше тайлов буфер записи заменяется заголовком атласа
+                    if (tileCacheEnabled) {
+                        std::lock_guard<std::mutex> lock(cacheMutex);
+                        if (ready.cachedKinds != featureMask) {
+                            cache.store(ready.path, ready.stamp, ready.tile, ready.features, 0, featureMask);
+                        }
+                        else {
+                            cache.share(ready.path, ready.tile.image);
+                        }
                     }
-                    //создание и настройка нового тайла
-                    Tile newTile;
-                    newTile.image = rotatedTile;
-                    newTile.angle = angle;
-                    newTile.originalIndex = originalIndex;
-                    //вычисление параметров для тайла
-                    computeTileFeatures(newTile, newTile.image);
-                    tiles.push_back(newTile);
+                    tiles.push_back(std::move(ready.tile));
                 }
-                originalIndex++;
+                pending.erase(it);
+                nextSeq++;
+                progress.tilesLoaded++;
+                window.release();
             }
         }
     }
+    catch (...) {
+        error = std::current_exception();
+        aborted = true;
+        decodeQueue.close();
+        featureQueue.close();
+        resultQueue.close();
+        for (size_t i = 0; i < inFlight; ++i) window.release();
+    }
+
+    enumerator.join();
+    for (auto& thread : decoders) thread.join();
+    for (auto& thread : featurizers) thread.join();
+
+    if (!error) error = enumeratorError;
+    if (error) {
+        progress.stage = GenerationStage::Idle;
+        clearTiles();
+        std::rethrow_exception(error);
+    }
+
+    //сохраняем обновленный кэш (ошибка записи не мешает генерации, она запоминается для вызывающего); после отмены
+    //кэш не пишется: save оставляет только затребованные записи и удалил бы записи файлов, до которых обход не дошел
+    cacheSaveFailed = tileCacheEnabled && !progress.cancelled && !cache.save();
+    indexDirty = true;
+    progress.stage = GenerationStage::Idle;
+    //отмененная загрузка не оставляет частичный набор тайлов
+    if (progress.cancelled) {
+        clearTiles();
+        return false;
+    }
+    if (!tiles.empty()) {
+        tilesFolder = folder;
+        tilesSize = size;
+        tilesAngle = angle;
+        tileKinds = featureMask;
+    }
     return !tiles.empty();
 }
 
-//создание мозаики без постобработки
-cv::Mat MosaicGenerator::createRawMosaic(const cv::Mat& source, const Config& cfg) {
+//загрузка тайлов из библиотеки: изображения тайлов - заголовки на отображение файла (страницы читаются по требованию),
+//признаки копируются из таблицы, если она посчитана для текущей метрики, иначе считаются по изображениям
+bool MosaicGenerator::loadTileLibrary(const fs::path& libraryFile) {
     //метрика по умолчанию
-    if (!metric) setMetric("color");
+    if (!metric) {
+        setMetric("color");
+    }
 
-    int targetWidth = source.cols;
-    int targetHeight = source.rows;
-    //создание пустого изображения для мозаики
-    cv::Mat rawMosaic(targetHeight, targetWidth, source.type(), cv::Scalar(0, 0, 0));
-    //обработка изображения по клеткам сетки
-    for (int y = 0; y < targetHeight; y += cfg.gridStep) {
-        for (int x = 0; x < targetWidth; x += cfg.gridStep) {
-            Tile currentCell;
-            //определение размеров текущей клетки
-            int blockWidth = std::min(cfg.gridStep, targetWidth - x);
-            int blockHeight = std::min(cfg.gridStep, targetHeight - y);
-
-            cv::Rect region(x, y, blockWidth, blockHeight);
-            cv::Mat cellImage = source(region);
-            //вычисление признаков для текущей клетки
-            metric->computeCellFeatures(currentCell, cellImage);
-
-            //поиск наилучшего тайла по индексу в оригинальном векторе
-            int bestIndex = -1;
-            double bestDistance = std::numeric_limits<double>::max();
-
-            for (int i = 0; i < tiles.size(); ++i) {
-                if (tiles[i].usage < cfg.maxRepeats) { 
-                double dist = metric->distance(currentCell, tiles[i]);
-                if (dist < bestDistance) {
-                    bestDistance = dist;
-                    bestIndex = i;
+    tiles.clear();
+    tileAtlas.clear();
+    renderCache->clear();
+    features.clear();
+    tileKinds = 0;
+    tilesFolder.clear();
+    indexDirty = true;
+    if (!tileLibrary.open(libraryFile)) return false;
+
+    //признаки вида не зависят от метрики, поэтому таблица подходит, если хранит все нужные виды
+    unsigned featureMask = metric->featureMask();
+    bool storedFeatures = (tileLibrary.featureMask() & featureMask) == featureMask;
+    features.require(featureMask);
+    features.resize(tileLibrary.size());
+    tiles.resize(tileLibrary.size());
+    progress.stage = GenerationStage::LoadingTiles;
+    progress.tilesFound = tiles.size();
+    progress.tilesLoaded = 0;
+    parallelFor(tiles.size(), loadThreads, [&](size_t i) {
+        if (progress.cancelled) return;
+        tiles[i].image = tileLibrary.tile(i);
+        tiles[i].angle = tileLibrary.angle();
+        tiles[i].originalIndex = static_cast<int>(i);
+        if (storedFeatures) {
+            tileLibrary.readFeatures(i, features, i);
+        }
+        else {
+            computeTileFeatures(tiles[i].image, features, i);
+        }
+        progress.tilesLoaded++;
+    }, 256);
+    progress.stage = GenerationStage::Idle;
+    if (progress.cancelled) {
+        clearTiles();
+        return false;
+    }
+    tileKinds = featureMask;
+    return !tiles.empty();
+}
+
+//сборка библиотеки тайлов из папки
+//файлы обходятся в том же порядке, что и в loadTiles; пакет файлов декодируется и обрабатывается параллельно,
+//затем записывается по порядку, поэтому в памяти одновременно находится не больше одного пакета изображений
+bool MosaicGenerator::buildTileLibrary(const fs::path& folder, const fs::path& libraryFile, int size, bool enableRotation, int rotation) {
+    //метрика по умолчанию
+    if (!metric) {
+        setMetric("color");
+    }
+    unsigned featureMask = metric->featureMask();
+    int angle = enableRotation ? rotation : 0;
+    TileLibraryWriter writer;
+    if (!writer.open(libraryFile, size, angle, metric->getName(), featureMask)) return false;
+
+    std::vector<fs::path> files;
+    std::error_code ec;
+    for (fs::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec)) files.push_back(it->path());
+    }
+
+    const size_t batchSize = 256;
+    std::vector<cv::Mat> images(batchSize);
+    FeatureStore batchFeatures;
+    batchFeatures.require(featureMask);
+    batchFeatures.resize(batchSize);
+    //неудачная сборка (ошибка записи, исключение, ни одного тайла) удаляет недописанный файл
+    bool ok = true;
+    try {
+        for (size_t first = 0; ok && first < files.size(); first += batchSize) {
+            size_t count = std::min(batchSize, files.size() - first);
+            parallelFor(count, loadThreads, [&](size_t i) {
+                images[i].release();
+                //ошибка чтения или обработки файла (в том числе нехватка памяти) пропускает файл
+                try {
+                    cv::Mat decoded = cv::imread(files[first + i].string(), cv::IMREAD_COLOR);
+                    if (decoded.empty()) return;
+                    images[i] = prepareTileImage(decoded, size, angle);
+                    computeTileFeatures(images[i], batchFeatures, i);
                 }
+                catch (const std::exception&) {
+                    images[i].release();
                 }
+            }, 1);
+            for (size_t i = 0; ok && i < count; ++i) {
+                if (!images[i].empty()) ok = writer.add(images[i], batchFeatures, i);
             }
-            //если не найден подходящий тайл, используем средний цвет клетки
-            if (bestIndex == -1) {
-                cv::Mat colorBlock(blockHeight, blockWidth, source.type(), cv::mean(cellImage));
-                colorBlock.copyTo(rawMosaic(region));
-                continue;
+        }
+        ok = writer.finish() && ok;
+    }
+    catch (...) {
+        writer.discard();
+        throw;
+    }
+    if (!ok || writer.size() == 0) {
+        writer.discard();
+        return false;
+    }
+    return true;
+}
+
+//перестройка индекса ближайших тайлов после смены тайлов, метрики или режима поиска
+void MosaicGenerator::prepareIndex(const Config& cfg) {
+    if (metric && !indexDirty && indexApproximate == cfg.approximateSearch) {
+        //число просматриваемых кластеров меняется без перестройки
+        if (auto ivf = dynamic_cast<IVFIndex*>(tileIndex.get())) {
+            ivf->setProbes(cfg.searchProbes);
+        }
+        return;
+    }
+    tileIndex = metric ? createTileIndex(*metric, cfg.approximateSearch, cfg.searchProbes) : nullptr;
+    if (tileIndex) {
+        tileIndex->build(features, *metric);
+    }
+    indexDirty = false;
+    indexApproximate = cfg.approximateSearch;
+}
+
+//клетки сетки в порядке строк (крайние клетки обрезаются по границе изображения)
+static std::vector<cv::Rect> gridRegions(const cv::Size& size, int gridStep) {
+    std::vector<cv::Rect> regions;
+    for (int y = 0; y < size.height; y += gridStep) {
+        for (int x = 0; x < size.width; x += gridStep) {
+            regions.emplace_back(x, y, std::min(gridStep, size.width - x), std::min(gridStep, size.height - y));
+        }
+    }
+    return regions;
+}
+
+//размер клетки в итоговой мозаике
+static int outputCellSize(const Config& cfg) {
+    return cfg.outputTileSize > 0 ? cfg.outputTileSize : cfg.gridStep;
+}
+
+//время в мс с момента start
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//координата исходного изображения в мозаике с клеткой cellSize вместо gridStep
+//(целые клетки масштабируются точно, обрезанная клетка на краю - пропорционально)
+static int scaleCoordinate(int value, int gridStep, int cellSize) {
+    return value / gridStep * cellSize + value % gridStep * cellSize / gridStep;
+}
+
+//области клеток в мозаике (клетки должны начинаться на строке сетки)
+static std::vector<cv::Rect> scaleRegions(const std::vector<cv::Rect>& regions, int gridStep, int cellSize) {
+    if (cellSize == gridStep) return regions;
+    std::vector<cv::Rect> scaled;
+    scaled.reserve(regions.size());
+    for (const auto& region : regions) {
+        int x = scaleCoordinate(region.x, gridStep, cellSize);
+        int y = scaleCoordinate(region.y, gridStep, cellSize);
+        scaled.emplace_back(x, y, scaleCoordinate(region.x + region.width, gridStep, cellSize) - x,
+            scaleCoordinate(region.y + region.height, gridStep, cellSize) - y);
+    }
+    return scaled;
+}
+
+//оригинал в масштабе мозаики для эффектов: строки [outputTop, outputBottom) результата шириной outputWidth
+//по строкам rows исходного изображения высотой sourceHeight, начинающимся со строки rowsTop;
+//по горизонтали - cv::resize целых строк, по вертикали - линейная интерполяция двух строк с позицией,
+//посчитанной в целых числах по номеру строки результата (как центры пикселей при шаге gridStep -> cellSize),
+//поэтому строка не зависит от того, по каким полосам строится оригинал
+static cv::Mat scaleOriginalRows(const cv::Mat& rows, int rowsTop, int sourceHeight, int outputTop, int outputBottom,
+    int outputWidth, int gridStep, int cellSize) {
+    cv::Mat wide;
+    cv::resize(rows, wide, cv::Size(outputWidth, rows.rows), 0, 0, cv::INTER_LINEAR);
+    cv::Mat result(outputBottom - outputTop, outputWidth, rows.type());
+    const long long denominator = 2LL * cellSize;
+    for (int y = outputTop; y < outputBottom; ++y) {
+        //позиция строки в исходном изображении: ((y + 0.5) * gridStep / cellSize - 0.5) = numerator / denominator
+        long long numerator = std::max(0LL, (2LL * y + 1) * gridStep - cellSize);
+        int row = static_cast<int>(numerator / denominator);
+        double weight = static_cast<double>(numerator % denominator) / denominator;
+        int first = std::min(row, sourceHeight - 1), second = std::min(row + 1, sourceHeight - 1);
+        cv::Mat target = result.row(y - outputTop);
+        cv::addWeighted(wide.row(first - rowsTop), 1.0 - weight, wide.row(second - rowsTop), weight, 0.0, target);
+    }
+    return result;
+}
+
+//размер сетки постобработки на время генерации: швы проходят по границам клеток мозаики, а не исходного изображения
+class PostProcessGridScope {
+private:
+    PostProcessPipeline& pipeline;
+    int savedGridSize;
+
+public:
+    PostProcessGridScope(PostProcessPipeline& pipeline, int gridStep, int cellSize)
+        : pipeline(pipeline), savedGridSize(pipeline.getGridSize()) {
+        if (cellSize != gridStep) pipeline.setGridSize(savedGridSize * cellSize / gridStep);
+    }
+    ~PostProcessGridScope() {
+        if (pipeline.getGridSize() != savedGridSize) pipeline.setGridSize(savedGridSize);
+    }
+    PostProcessGridScope(const PostProcessGridScope&) = delete;
+    PostProcessGridScope& operator=(const PostProcessGridScope&) = delete;
+};
+
+//вычисление признаков всех клеток сетки по карте признаков исходного изображения
+void MosaicGenerator::computeCellFeatures(const SourceFeatureMap& map, const std::vector<cv::Rect>& regions, FeatureStore& cells) const {
+    cells.clear();
+    cells.require(metric->featureMask());
+    cells.resize(regions.size());
+    parallelFor(regions.size(), matchThreads, [&](size_t i) {
+        throwIfCancelled();
+        metric->computeCellFeatures(map, regions[i], cells, i);
+    });
+}
+
+//поиск k лучших тайлов для каждой клетки (лимит повторов не учитывается)
+void MosaicGenerator::findCandidates(const FeatureStore& cells, int k, CandidateLists& candidates) const {
+    k = std::max(0, std::min(k, static_cast<int>(tiles.size())));
+    candidates.k = k;
+    candidates.items.assign(cells.size() * k, { 0.0, -1 });
+    candidates.counts.assign(cells.size(), 0);
+    if (k == 0) return;
+
+    parallelFor(cells.size(), matchThreads, [&](size_t cell) {
+        throwIfCancelled();
+        thread_local std::vector<std::pair<double, int>> found;
+        thread_local std::vector<double> distances;
+        if (tileIndex) {
+            tileIndex->knn(cells, cell, k, found);
+        }
+        else {
+            //полный пакет расстояний и частичная сортировка по (расстояние, индекс)
+            distances.resize(tiles.size());
+            metric->distanceBatch(cells, cell, features, 0, tiles.size(), distances.data());
+            found.resize(tiles.size());
+            for (size_t i = 0; i < tiles.size(); ++i) {
+                found[i] = { distances[i], static_cast<int>(i) };
             }
+            std::partial_sort(found.begin(), found.begin() + k, found.end());
+            found.resize(k);
+        }
+        std::copy(found.begin(), found.end(), candidates.of(cell));
+        candidates.counts[cell] = static_cast<int>(found.size());
+    });
+}
+
+//ближайший тайл с неисчерпанным лимитом повторов
+//индекс хранит только неисчерпанные тайлы; без индекса - пакет расстояний до всех тайлов
+int MosaicGenerator::findNearestAvailable(const FeatureStore& cells, size_t cell, int maxRepeats, std::vector<double>& distances) const {
+    if (maxRepeats <= 0) return -1;
+    if (tileIndex) return tileIndex->nearest(cells, cell);
+
+    distances.resize(tiles.size());
+    metric->distanceBatch(cells, cell, features, 0, tiles.size(), distances.data());
+    int bestIndex = -1;
+    double bestDistance = std::numeric_limits<double>::max();
+    for (int i = 0; i < static_cast<int>(tiles.size()); ++i) {
+        if (tiles[i].usage < maxRepeats && distances[i] < bestDistance) {
+            bestDistance = distances[i];
+            bestIndex = i;
+        }
+    }
+    return bestIndex;
+}
+
+//назначение тайлов клеткам в порядке строк (жадно: каждой клетке - ближайший доступный тайл)
+//если лимит повторов не может исчерпаться, клетки независимы и обрабатываются параллельно;
+//иначе параллельно ищутся k лучших кандидатов каждой клетки, а лимит разрешается последовательным проходом:
+//клетке достается первый неисчерпанный кандидат, что совпадает с ближайшим доступным тайлом,
+//т.к. все тайлы ближе него уже в списке; если кандидаты исчерпаны - полный поиск среди доступных тайлов
+std::vector<int> MosaicGenerator::assignGreedy(const FeatureStore& cells, const Config& cfg, size_t totalCells) {
+    std::vector<int> assignment(cells.size(), -1);
+    if (cfg.maxRepeats <= 0) return assignment;
 
-            //увеличиваем счетчик использования
-            tiles[bestIndex].usage++;
-            //изменение размера тайла и копирование в мозаику
-            cv::Mat finalTile;
-            cv::resize(tiles[bestIndex].image, finalTile, cv::Size(blockWidth, blockHeight), 0, 0, cv::INTER_CUBIC);
-            finalTile.copyTo(rawMosaic(region));
+    if (static_cast<size_t>(cfg.maxRepeats) >= totalCells) {
+        parallelFor(cells.size(), matchThreads, [&](size_t cell) {
+            throwIfCancelled();
+            thread_local std::vector<double> distances;
+            assignment[cell] = findNearestAvailable(cells, cell, cfg.maxRepeats, distances);
+            progress.cellsMatched.fetch_add(1, std::memory_order_relaxed);
+        });
+        for (int tile : assignment) {
+            if (tile >= 0) tiles[tile].usage++;
         }
+        return assignment;
     }
+
+    CandidateLists candidates;
+    findCandidates(cells, matchCandidates, candidates);
+    std::vector<double> distances;
+    for (size_t cell = 0; cell < cells.size(); ++cell) {
+        throwIfCancelled();
+        progress.cellsMatched++;
+        int bestIndex = -1;
+        const auto* list = candidates.of(cell);
+        for (int j = 0; j < candidates.counts[cell]; ++j) {
+            if (tiles[list[j].second].usage < cfg.maxRepeats) {
+                bestIndex = list[j].second;
+                break;
+            }
+        }
+        if (bestIndex == -1) {
+            bestIndex = findNearestAvailable(cells, cell, cfg.maxRepeats, distances);
+        }
+        if (bestIndex == -1) continue;
+
+        //увеличиваем счетчик использования, израсходованный тайл убираем из индекса
+        tiles[bestIndex].usage++;
+        if (tileIndex && tiles[bestIndex].usage >= cfg.maxRepeats) {
+            tileIndex->remove(bestIndex);
+        }
+        assignment[cell] = bestIndex;
+    }
+    return assignment;
+}
+
+//назначение ближайших доступных тайлов клеткам без тайла (в порядке строк, как при жадном назначении)
+void MosaicGenerator::assignRemaining(const FeatureStore& cells, int maxRepeats, std::vector<int>& assignment) {
+    std::vector<double> distances;
+    for (size_t cell = 0; cell < cells.size(); ++cell) {
+        if (assignment[cell] >= 0) continue;
+        int bestIndex = findNearestAvailable(cells, cell, maxRepeats, distances);
+        if (bestIndex == -1) break;
+        tiles[bestIndex].usage++;
+        if (tileIndex && tiles[bestIndex].usage >= maxRepeats) {
+            tileIndex->remove(bestIndex);
+        }
+        assignment[cell] = bestIndex;
+    }
+}
+
+//глобальное назначение: аукцион минимизирует суммарное расстояние по k лучшим кандидатам клеток,
+//а не отдает лучшие тайлы верхним строкам изображения; клетки, оставшиеся без кандидата,
+//получают ближайший доступный тайл вне списков
+std::vector<int> MosaicGenerator::assignGlobal(const FeatureStore& cells, const Config& cfg) {
+    //без ограничения повторов ближайший тайл каждой клетки уже оптимален
+    if (cfg.maxRepeats <= 0 || static_cast<size_t>(cfg.maxRepeats) >= cells.size()) {
+        return assignGreedy(cells, cfg, cells.size());
+    }
+
+    CandidateLists candidates;
+    findCandidates(cells, cfg.assignmentCandidates, candidates);
+    //запасной вариант дороже любого кандидата: клетка остается без тайла из списка, только если все они заняты
+    double fallbackCost = 1.0;
+    for (const auto& item : candidates.items) {
+        fallbackCost = std::max(fallbackCost, 2.0 * item.first + 1.0);
+    }
+
+    AuctionAssignment auction;
+    std::vector<int> assignment = auction.solve(candidates, tiles.size(), cfg.maxRepeats, fallbackCost);
+    //флаг ставится только здесь: при переходе на жадное назначение выше статистика остается жадной
+    lastMatchStats.global = true;
+    lastMatchStats.auctionBids = auction.getBidCount();
+    for (int tile : assignment) {
+        if (tile >= 0) tiles[tile].usage++;
+    }
+    if (tileIndex) {
+        for (int i = 0; i < static_cast<int>(tiles.size()); ++i) {
+            if (tiles[i].usage >= cfg.maxRepeats) tileIndex->remove(i);
+        }
+    }
+    assignRemaining(cells, cfg.maxRepeats, assignment);
+    progress.cellsMatched += cells.size();
+    return assignment;
+}
+
+//отрисовка назначенных тайлов: клетки не пересекаются, поэтому пишутся параллельно
+cv::Mat MosaicGenerator::renderAssignment(const cv::Mat& source, const std::vector<cv::Rect>& regions,
+    const std::vector<cv::Rect>& outputRegions, const cv::Size& outputSize, const std::vector<int>& assignment) {
+    //масштабирование каждого используемого тайла под каждый размер клетки - один раз (отрисовки остаются в кэше)
+    renderCache->prepare(tiles, outputRegions, assignment, matchThreads);
+    //создание пустого изображения для мозаики
+    cv::Mat rawMosaic(outputSize.height, outputSize.width, source.type(), cv::Scalar(0, 0, 0));
+    parallelFor(regions.size(), matchThreads, [&](size_t cell) {
+        throwIfCancelled();
+        const cv::Rect& region = outputRegions[cell];
+        if (region.area() <= 0) return;
+        //если не найден подходящий тайл, используем средний цвет клетки
+        if (assignment[cell] < 0) {
+            rawMosaic(region).setTo(cv::mean(source(regions[cell])));
+            return;
+        }
+        //копирование строк готовой отрисовки в мозаику
+        if (renderCache->place(tiles, assignment[cell], rawMosaic, region)) return;
+        //тайл другого типа, чем мозаика: прежнее масштабирование на месте
+        cv::Mat finalTile;
+        cv::resize(tiles[assignment[cell]].image, finalTile, region.size(), 0, 0, cv::INTER_CUBIC);
+        finalTile.copyTo(rawMosaic(region));
+    });
+    return rawMosaic;
+}
+
+//создание мозаики без постобработки
+//этапы: признаки всех клеток -> назначение тайлов -> отрисовка
+cv::Mat MosaicGenerator::createRawMosaic(const cv::Mat& source, const Config& cfg) {
+    //метрика по умолчанию
+    if (!metric) setMetric("color");
+    lastTimings = GenerationTimings();
+    auto stageStart = std::chrono::steady_clock::now();
+    ensureTileFeatures();
+    prepareIndex(cfg);
+    lastTimings.tileFeaturesMs = elapsedMs(stageStart);
+
+    stageStart = std::chrono::steady_clock::now();
+    std::vector<cv::Rect> regions = gridRegions(source.size(), cfg.gridStep);
+    progress.stage = GenerationStage::Matching;
+    progress.cellsTotal = regions.size();
+    progress.cellsMatched = 0;
+    SourceFeatureMap sourceMap;
+    sourceMap.build(source, metric->featureMask());
+    FeatureStore cells;
+    computeCellFeatures(sourceMap, regions, cells);
+    lastMatchStats = MatchStats();
+    lastMatchStats.cells = regions.size();
+    auto assignStart = std::chrono::steady_clock::now();
+    std::vector<int> assignment = cfg.globalAssignment ? assignGlobal(cells, cfg) : assignGreedy(cells, cfg, cells.size());
+    lastMatchStats.assignMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - assignStart).count();
+
+    //качество назначения: суммарное расстояние до назначенных тайлов
+    std::vector<double> cellDistances(assignment.size(), 0.0);
+    parallelFor(assignment.size(), matchThreads, [&](size_t cell) {
+        if (assignment[cell] >= 0) cellDistances[cell] = metric->distance(cells, cell, features, assignment[cell]);
+    });
+    lastMatchStats.totalDistance = std::accumulate(cellDistances.begin(), cellDistances.end(), 0.0);
+    lastMatchStats.filledCells = std::count(assignment.begin(), assignment.end(), -1);
+    lastTimings.matchMs = elapsedMs(stageStart);
+
+    //клетки мозаики размера outputCellSize (без увеличения - те же области)
+    progress.stage = GenerationStage::Rendering;
+    stageStart = std::chrono::steady_clock::now();
+    const int cellSize = outputCellSize(cfg);
+    cv::Size outputSize(scaleCoordinate(source.cols, cfg.gridStep, cellSize), scaleCoordinate(source.rows, cfg.gridStep, cellSize));
+    cv::Mat rawMosaic = renderAssignment(source, regions, scaleRegions(regions, cfg.gridStep, cellSize), outputSize, assignment);
+    lastTimings.renderMs = elapsedMs(stageStart);
     return rawMosaic;
 }
 
+//потоковое создание мозаики
+//проход 1: полосы высотой в целое число строк сетки читаются по очереди, признаки клеток полосы считаются
+//по карте признаков полосы (с одной строкой контекста сверху и снизу, чтобы градиенты и LBP на краях полосы
+//совпадали с картой всего изображения), назначение - жадное в порядке строк, как в createRawMosaic;
+//далее для каждого эффекта, которому нужна статистика всего изображения, - проход с отрисовкой полос
+//и применением предшествующих эффектов; последний проход отрисовывает, обрабатывает и записывает полосы.
+//полоса отрисовывается и обрабатывается с контекстом postProcessor.bandHalo() строк, строки контекста отбрасываются;
+//при увеличении полосы считаются в строках результата, а оригинал для эффектов масштабируется по полосе
+//(scaleOriginalRows со строкой сетки контекста сверху и снизу для интерполяции на краях полосы)
+void MosaicGenerator::createMosaicStreaming(ImageBandReader& source, ImageBandWriter& output, const Config& cfg, int bandRows) {
+    //проверка наличия загруженных тайлов
+    if (tiles.empty()) throw std::runtime_error("No tiles loaded");
+    //установка метрики сравнения
+    if (!setMetric(cfg.metric)) {
+        throw std::runtime_error("Invalid metric name specified: " + cfg.metric);
+    }
+    const cv::Size size = source.size();
+    if (size.width <= 0 || size.height <= 0) throw std::runtime_error("Empty source image");
+    if (cfg.gridStep <= 0) throw std::runtime_error("Invalid grid step");
+    //назначение идет по полосам и только жадное: глобальному нужны все клетки сразу
+    if (cfg.globalAssignment) throw std::runtime_error("Global assignment is not supported by streaming generation");
+    //сброс счетчиков использования тайтла перед генерацией
+    for (auto& tile : tiles) {
+        tile.usage = 0;
+    }
+    if (tileIndex) {
+        tileIndex->reset();
+    }
+    lastTimings = GenerationTimings();
+    auto stageStart = std::chrono::steady_clock::now();
+    ensureTileFeatures();
+    prepareIndex(cfg);
+    lastTimings.tileFeaturesMs = elapsedMs(stageStart);
+
+    const int gridStep = cfg.gridStep;
+    const int cellSize = outputCellSize(cfg);
+    auto scale = [&](int value) { return scaleCoordinate(value, gridStep, cellSize); };
+    const cv::Size outputSize(scale(size.width), scale(size.height));
+    //высота полосы задается в строках результата и переводится в целые строки сетки исходного изображения
+    int band = bandRows > 0 ? bandRows : defaultBandRows;
+    band = std::max(gridStep, band / cellSize * gridStep);
+    const std::vector<cv::Rect> regions = gridRegions(size, gridStep);
+    const size_t cellsPerRow = (size.width + gridStep - 1) / gridStep;
+    //клетки строк сетки, пересекающих строки [top, bottom) изображения
+    auto cellRange = [&](int top, int bottom) {
+        size_t first = static_cast<size_t>(top / gridStep) * cellsPerRow;
+        size_t last = static_cast<size_t>((bottom + gridStep - 1) / gridStep) * cellsPerRow;
+        return std::make_pair(first, std::min(last, regions.size()));
+    };
+    //время этапов копится по всем полосам и проходам
+    auto readRows = [&](int top, int bottom, cv::Mat& pixels) {
+        auto readStart = std::chrono::steady_clock::now();
+        if (!source.read(top, bottom - top, pixels)) throw std::runtime_error("Failed to read source rows");
+        lastTimings.readMs += elapsedMs(readStart);
+    };
+
+    lastMatchStats = MatchStats();
+    lastMatchStats.cells = regions.size();
+    progress.stage = GenerationStage::Matching;
+    progress.cellsTotal = regions.size();
+    progress.cellsMatched = 0;
+    std::vector<int> assignment;
+    assignment.reserve(regions.size());
+    auto assignStart = std::chrono::steady_clock::now();
+    for (int top = 0; top < size.height; top += band) {
+        int bottom = std::min(size.height, top + band);
+        int readTop = std::max(0, top - 1), readBottom = std::min(size.height, bottom + 1);
+        cv::Mat pixels;
+        readRows(readTop, readBottom, pixels);
+        auto range = cellRange(top, bottom);
+        std::vector<cv::Rect> bandRegions(regions.begin() + range.first, regions.begin() + range.second);
+        for (auto& region : bandRegions) region.y -= readTop;
+
+        SourceFeatureMap sourceMap;
+        sourceMap.build(pixels, metric->featureMask());
+        FeatureStore cells;
+        computeCellFeatures(sourceMap, bandRegions, cells);
+        std::vector<int> bandAssignment = assignGreedy(cells, cfg, regions.size());
+
+        std::vector<double> cellDistances(bandAssignment.size(), 0.0);
+        parallelFor(bandAssignment.size(), matchThreads, [&](size_t cell) {
+            if (bandAssignment[cell] >= 0) cellDistances[cell] = metric->distance(cells, cell, features, bandAssignment[cell]);
+        });
+        lastMatchStats.totalDistance += std::accumulate(cellDistances.begin(), cellDistances.end(), 0.0);
+        assignment.insert(assignment.end(), bandAssignment.begin(), bandAssignment.end());
+    }
+    lastMatchStats.assignMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - assignStart).count();
+    lastMatchStats.filledCells = std::count(assignment.begin(), assignment.end(), -1);
+    //чтение полос первого прохода относится к чтению, а не к сопоставлению
+    lastTimings.matchMs = lastMatchStats.assignMs - lastTimings.readMs;
+
+    //проход по полосам с отрисовкой и первыми count эффектами: visit(полоса мозаики, те же строки оригинала)
+    PostProcessGridScope gridScope(postProcessor, gridStep, cellSize);
+    const int halo = postProcessor.bandHalo();
+    auto processBands = [&](size_t count, const std::function<void(const cv::Mat&, const cv::Mat&)>& visit) {
+        for (int top = 0; top < size.height; top += band) {
+            int bottom = std::min(size.height, top + band);
+            //строки полосы в мозаике, строки с контекстом и охватывающие их целые строки сетки исходного изображения
+            int outputTop = scale(top), outputBottom = scale(bottom);
+            int haloTop = std::max(0, outputTop - halo), haloBottom = std::min(outputSize.height, outputBottom + halo);
+            int renderTop = haloTop / cellSize * gridStep;
+            int renderBottom = std::min(size.height, (haloBottom + cellSize - 1) / cellSize * gridStep);
+            int outputRenderTop = scale(renderTop);
+            int readTop = renderTop, readBottom = renderBottom;
+            if (cellSize != gridStep) {
+                readTop = std::max(0, renderTop - gridStep);
+                readBottom = std::min(size.height, renderBottom + gridStep);
+            }
+            cv::Mat pixels;
+            readRows(readTop, readBottom, pixels);
+            cv::Mat renderPixels = pixels.rowRange(renderTop - readTop, renderBottom - readTop);
+            auto range = cellRange(renderTop, renderBottom);
+            std::vector<cv::Rect> bandRegions(regions.begin() + range.first, regions.begin() + range.second);
+            for (auto& region : bandRegions) region.y -= renderTop;
+            std::vector<int> bandAssignment(assignment.begin() + range.first, assignment.begin() + range.second);
+            cv::Size renderSize(outputSize.width, scale(renderBottom) - outputRenderTop);
+            auto renderStart = std::chrono::steady_clock::now();
+            cv::Mat rendered = renderAssignment(renderPixels, bandRegions, scaleRegions(bandRegions, gridStep, cellSize), renderSize, bandAssignment);
+            lastTimings.renderMs += elapsedMs(renderStart);
+
+            //полоса с контекстом - отдельная матрица (фильтры не должны читать строки за ее пределами)
+            auto postStart = std::chrono::steady_clock::now();
+            cv::Mat mosaicBand = rendered.rowRange(haloTop - outputRenderTop, haloBottom - outputRenderTop).clone();
+            cv::Mat originalBand;
+            if (cellSize == gridStep) {
+                originalBand = renderPixels.rowRange(haloTop - renderTop, haloBottom - renderTop);
+            }
+            else {
+                originalBand = scaleOriginalRows(pixels, readTop, size.height, haloTop, haloBottom, outputSize.width, gridStep, cellSize);
+            }
+            cv::Mat processed = postProcessor.processBand(mosaicBand, originalBand, haloTop, outputSize, count);
+            lastTimings.postProcessMs += elapsedMs(postStart);
+            visit(processed.rowRange(outputTop - haloTop, outputBottom - haloTop),
+                originalBand.rowRange(outputTop - haloTop, outputBottom - haloTop));
+        }
+    };
+
+    //сбор статистики всего изображения для эффектов, которым она нужна
+    for (size_t i = 0; i < postProcessor.size(); ++i) {
+        PostProcessEffect& effect = postProcessor.effect(i);
+        if (!effect.needsStatistics()) continue;
+        effect.resetStatistics();
+        processBands(i, [&](const cv::Mat& mosaicBand, const cv::Mat& originalBand) {
+            auto statisticsStart = std::chrono::steady_clock::now();
+            effect.accumulateStatistics(mosaicBand, originalBand);
+            lastTimings.postProcessMs += elapsedMs(statisticsStart);
+        });
+    }
+
+    //обработка и запись
+    progress.stage = GenerationStage::Rendering;
+    auto writeStart = std::chrono::steady_clock::now();
+    if (!output.open(outputSize, source.type())) throw std::runtime_error("Failed to open mosaic output");
+    lastTimings.writeMs += elapsedMs(writeStart);
+    processBands(postProcessor.size(), [&](const cv::Mat& mosaicBand, const cv::Mat&) {
+        auto bandStart = std::chrono::steady_clock::now();
+        if (!output.write(mosaicBand)) throw std::runtime_error("Failed to write mosaic rows");
+        lastTimings.writeMs += elapsedMs(bandStart);
+    });
+    writeStart = std::chrono::steady_clock::now();
+    if (!output.close()) throw std::runtime_error("Failed to finish mosaic output");
+    lastTimings.writeMs += elapsedMs(writeStart);
+    progress.stage = GenerationStage::Idle;
+}
+
 //создание итоговой мозаики с постобработкой
 cv::Mat MosaicGenerator::createMosaic(const cv::Mat& source, const Config& cfg) {
     //проверка наличия загруженных тайлов
@@ -359,7 +1462,48 @@ cv::Mat MosaicGenerator::createMosaic(const cv::Mat& source, const Config& cfg)
     for (auto& tile : tiles) {
         tile.usage = 0;
     }
+    if (tileIndex) {
+        tileIndex->reset();
+    }
     //создание мозаики и применение постобработки
     cv::Mat rawMosaic = createRawMosaic(source, cfg);
-    return postProcessor.process(rawMosaic, source);
+    throwIfCancelled();
+    progress.stage = GenerationStage::PostProcessing;
+    auto postStart = std::chrono::steady_clock::now();
+    const int cellSize = outputCellSize(cfg);
+    PostProcessGridScope gridScope(postProcessor, cfg.gridStep, cellSize);
+    //мозаика обрабатывается на месте; при увеличении эффекты получают оригинал в масштабе мозаики
+    //(тот же, что и при потоковой генерации)
+    if (cellSize == cfg.gridStep) {
+        postProcessor.processInPlace(rawMosaic, source);
+    }
+    else {
+        cv::Mat original = scaleOriginalRows(source, 0, source.rows, 0, rawMosaic.rows, rawMosaic.cols, cfg.gridStep, cellSize);
+        postProcessor.processInPlace(rawMosaic, original);
+    }
+    lastTimings.postProcessMs = elapsedMs(postStart);
+    progress.stage = GenerationStage::Idle;
+    return rawMosaic;
+}
+
+//создание мозаики предпросмотра: исходное изображение уменьшается в factor раз, а шаг сетки сохраняется,
+//поэтому клетка покрывает в factor раз большую часть изображения и клеток в factor^2 раз меньше;
+//тайлы отрисовываются в клетки того же размера, что и у полной мозаики (тот же кэш отрисовок и та же сетка постобработки)
+cv::Mat MosaicGenerator::createPreview(const cv::Mat& source, const Config& cfg, int factor) {
+    if (factor <= 1) return createMosaic(source, cfg);
+    cv::Mat preview;
+    cv::resize(source, preview, cv::Size(std::max(1, source.cols / factor), std::max(1, source.rows / factor)),
+        0, 0, cv::INTER_AREA);
+    return createMosaic(preview, cfg);
+}
+
+//уменьшения предпросмотра: 4, 2 и полная мозаика (грубый уровень - если по меньшей стороне остается
+//не меньше minPreviewCells клеток)
+std::vector<int> MosaicGenerator::previewFactors(const cv::Size& size, int gridStep) {
+    std::vector<int> factors;
+    for (int factor : { 4, 2 }) {
+        if (gridStep > 0 && std::min(size.width, size.height) / factor / gridStep >= minPreviewCells) factors.push_back(factor);
+    }
+    factors.push_back(1);
+    return factors;
 }
@@ -6,33 +6,54 @@
 #include <filesystem>
 #include <opencv2/opencv.hpp>
 #include "PostProcessor.h"
+#include "FeatureStore.h"
+#include "TileAtlas.h"
+#include "TileLibrary.h"
 #include <limits>
 #include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <map>
 
 namespace fs = std::filesystem;
 
+class SourceFeatureMap;
+
 //структура для вспомогательных функций вычисления признаков
 struct FeatureUtils {
     //вычисляет стандартное отклонение (контрастность) изображения
     static cv::Scalar computeStdDev(const cv::Mat& image);
     //вычисляет истограмму градиентов (HOG-подобный признак)
-    static cv::Mat computeGradientHist(const cv::Mat& image);
+    static cv::Mat computeGradientHist(const cv::Mat& image, bool fastAtan = false);
     //вспомогательная функция для вычисления LBP-значения
     static uchar getLBPValue(const cv::Mat& gray, int r, int c);
     //вычисляет гистограмму LBP-признаков для текстуры
     static cv::Mat computeLBPFeatures(const cv::Mat& image);
+    //записывает в строку хранилища признаки изображения для видов из маски FeatureKind
+    //(значения вида не зависят от метрики, поэтому метрики с общими видами используют одни и те же признаки тайлов)
+    static void computeFeatures(const cv::Mat& image, unsigned mask, FeatureStore& store, size_t row);
 };
 //структура с параметрами тайтлов
+//признаки тайла хранятся в FeatureStore генератора в строке с тем же индексом, что и тайл
 struct Tile {
-    cv::Mat image;//изображение тайла
-    cv::Scalar color;//средний цвет
-    cv::Scalar stddev;//стандартное отклонение(контрастность)
-    cv::Mat gradientHist;//гистограмма градиентов
-    cv::Mat textureFeatures;//LBP-признаки текстуры
+    cv::Mat image;//изображение тайла (у загруженных тайлов - заголовок на память атласа генератора)
     int usage = 0;//счетчик использования тайтла
     int angle = 0;//угол повороты тайтла
     int originalIndex = -1;//индекс исходного изображения
 };
+//списки лучших тайлов-кандидатов для клеток сетки
+//кандидаты клетки - до k пар (расстояние, индекс тайла) по возрастанию расстояния, при равных расстояниях - по индексу
+struct CandidateLists {
+    int k = 0;//максимальное кол-во кандидатов клетки
+    std::vector<std::pair<double, int>> items;//кандидаты всех клеток подряд (cells * k)
+    std::vector<int> counts;//фактическое кол-во кандидатов клетки
+
+    //кол-во клеток
+    size_t size() const { return counts.size(); }
+    //кандидаты клетки
+    const std::pair<double, int>* of(size_t cell) const { return items.data() + cell * k; }
+    std::pair<double, int>* of(size_t cell) { return items.data() + cell * k; }
+};
 //структура с параметрами конфигурации
 struct Config {
     int tileSize = 30;//размер тайтла
@@ -42,75 +63,297 @@ struct Config {
     bool rotation = false;//разрешение поворота 
     int rotationAngle = 0;//угол поворота тайтла
     std::string metric = "color";//название матрики
+    bool approximateSearch = false;//приближенный поиск тайлов для гистограммных метрик (gradient/texture)
+    int searchProbes = 8;//кол-во просматриваемых кластеров при приближенном поиске (больше - точнее, но медленнее)
+    bool globalAssignment = false;//глобальное назначение тайлов (минимум суммарного расстояния) при ограниченных повторах
+    int assignmentCandidates = 16;//кол-во кандидатов клетки при глобальном назначении
+    int outputTileSize = 0;//размер клетки в итоговой мозаике (0 - gridStep, т.е. мозаика размера исходного изображения);
+                           //больше gridStep - мозаика крупнее исходного изображения и тайлы не теряют детали
+                           //(для полной детализации тайлы загружаются с tileSize не меньше этого размера)
+};
+//статистика последнего сопоставления клеток и тайлов
+struct MatchStats {
+    size_t cells = 0;//кол-во клеток сетки
+    size_t filledCells = 0;//клетки без тайла (залиты средним цветом)
+    double totalDistance = 0.0;//суммарное расстояние от клеток до назначенных тайлов
+    double assignMs = 0.0;//время назначения тайлов, мс
+    bool global = false;//аукцион глобального назначения действительно запускался (при maxRepeats не меньше кол-ва клеток - жадное)
+    size_t auctionBids = 0;//кол-во ставок аукциона (для глобального назначения)
+};
+//время этапов последней мозаики createMosaic или createMosaicStreaming, мс
+//(при потоковой генерации отрисовка и постобработка - суммы по всем проходам по полосам)
+struct GenerationTimings {
+    double tileFeaturesMs = 0.0;//досчет признаков тайлов для метрики и перестройка индекса
+    double matchMs = 0.0;//признаки клеток и назначение тайлов
+    double renderMs = 0.0;//отрисовка тайлов
+    double postProcessMs = 0.0;//постобработка
+    double readMs = 0.0;//чтение полос исходного изображения (только потоковая генерация)
+    double writeMs = 0.0;//запись полос результата (только потоковая генерация)
+};
+//этап генерации мозаики
+enum class GenerationStage {
+    Idle,//генерация не выполняется
+    LoadingTiles,//загрузка тайлов
+    Matching,//признаки клеток и назначение тайлов
+    Rendering,//отрисовка мозаики
+    PostProcessing,//постобработка
+};
+//ход генерации: счетчики обновляются рабочими потоками генератора и могут читаться из любого потока (например, GUI);
+//cancelled - запрос кооперативной отмены, проверяется во внутренних циклах загрузки и генерации
+struct GenerationProgress {
+    std::atomic<GenerationStage> stage{ GenerationStage::Idle };//текущий этап
+    std::atomic<size_t> tilesFound{ 0 };//найдено файлов тайлов (растет по мере обхода папки)
+    std::atomic<size_t> tilesLoaded{ 0 };//обработано файлов тайлов
+    std::atomic<size_t> cellsTotal{ 0 };//кол-во клеток сетки
+    std::atomic<size_t> cellsMatched{ 0 };//клетки с выполненным назначением
+    std::atomic<bool> cancelled{ false };//запрошена отмена
+
+    //сброс счетчиков и запроса отмены перед новой задачей
+    void reset();
+};
+//исключение при отмене генерации через MosaicGenerator::cancel
+class GenerationCancelled : public std::runtime_error {
+public:
+    GenerationCancelled() : std::runtime_error("Mosaic generation cancelled") {}
 };
 //родительский класс для всех метрик
 //определяет методы, которые должны реализовать все метрики
+//признаки клеток и тайлов записываются в строки FeatureStore
 class IMetric {
 public:
     virtual ~IMetric() = default;
     //вычисляет параметры клетки
-    virtual void computeCellFeatures(Tile& cell, const cv::Mat& cellImage) = 0;
+    virtual void computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const = 0;
+    //вычисляет параметры клетки по заранее построенной карте признаков исходного изображения
+    //(по умолчанию - по пикселям области, метрики переопределяют для своих плоскостей карты)
+    virtual void computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const;
     //вычисляет параметры тайтла
-    virtual void computeTileFeatures(Tile& tile, const cv::Mat& tileImage) = 0;
+    virtual void computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const = 0;
     //вычисляет расстояние между параметрами клетки и тайла
-    virtual double distance(const Tile& cell, const Tile& tile) const = 0;
+    virtual double distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const = 0;
+    //вычисляет расстояния от клетки до тайлов [begin, end) в out[0 .. end-begin)
+    //(по умолчанию - поочередные вызовы distance, метрики переопределяют векторными ядрами)
+    virtual void distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+        size_t begin, size_t end, double* out) const {
+        for (size_t i = begin; i < end; ++i) {
+            out[i - begin] = distance(cells, cell, tiles, i);
+        }
+    }
     //геттер для получения имени метрики
     virtual std::string getName() const = 0;
+    //виды признаков, используемые метрикой (маска FeatureKind)
+    virtual unsigned featureMask() const = 0;
+    //размер вектора признаков для пространственного индекса (0 - метрика не поддерживает индекс)
+    virtual int featureVectorSize() const { return 0; }
+    //запись признаков строки хранилища в вектор для индекса
+    virtual void getFeatureVector(const FeatureStore& store, size_t row, double* out) const {}
+    //расстояние между векторами признаков, совпадает с distance для соответствующих строк
+    virtual double vectorDistance(const double* a, const double* b) const {
+        return std::numeric_limits<double>::max();
+    }
 };
 //класс цветной метрики
 class ColorMetric : public IMetric {
 public:
-    void computeCellFeatures(Tile& cell, const cv::Mat& cellImage) override;
-    void computeTileFeatures(Tile& tile, const cv::Mat& tileImage) override;
-    double distance(const Tile& cell, const Tile& tile) const override;
+    void computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const override;
+    void computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const override;
+    void computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const override;
+    double distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const override;
+    void distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+        size_t begin, size_t end, double* out) const override;
     std::string getName() const override;
+    unsigned featureMask() const override;
+    int featureVectorSize() const override;
+    void getFeatureVector(const FeatureStore& store, size_t row, double* out) const override;
+    double vectorDistance(const double* a, const double* b) const override;
 };
 //класс метрики цвет+контраст
 class ColorContrastMetric : public IMetric {
 public:
-    void computeCellFeatures(Tile& cell, const cv::Mat& cellImage) override;
-    void computeTileFeatures(Tile& tile, const cv::Mat& tileImage) override;
-    double distance(const Tile& cell, const Tile& tile) const override;
+    void computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const override;
+    void computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const override;
+    void computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const override;
+    double distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const override;
+    void distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+        size_t begin, size_t end, double* out) const override;
     std::string getName() const override;
+    unsigned featureMask() const override;
+    int featureVectorSize() const override;
+    void getFeatureVector(const FeatureStore& store, size_t row, double* out) const override;
+    double vectorDistance(const double* a, const double* b) const override;
 };
 //класс метрики градиента
 class GradientMetric : public IMetric {
 public:
-    void computeCellFeatures(Tile& cell, const cv::Mat& cellImage) override;
-    void computeTileFeatures(Tile& tile, const cv::Mat& tileImage) override;
-    double distance(const Tile& cell, const Tile& tile) const override;
+    void computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const override;
+    void computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const override;
+    void computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const override;
+    double distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const override;
+    void distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+        size_t begin, size_t end, double* out) const override;
     std::string getName() const override;
+    unsigned featureMask() const override;
+    int featureVectorSize() const override;
+    void getFeatureVector(const FeatureStore& store, size_t row, double* out) const override;
+    double vectorDistance(const double* a, const double* b) const override;
 };
 //класс метрики текстуры
 class TextureMetric : public IMetric {
 public:
-    void computeCellFeatures(Tile& cell, const cv::Mat& cellImage) override;
-    void computeTileFeatures(Tile& tile, const cv::Mat& tileImage) override;
-    double distance(const Tile& cell, const Tile& tile) const override;
+    void computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const override;
+    void computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const override;
+    void computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const override;
+    double distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const override;
+    void distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+        size_t begin, size_t end, double* out) const override;
     std::string getName() const override;
+    unsigned featureMask() const override;
+    int featureVectorSize() const override;
+    void getFeatureVector(const FeatureStore& store, size_t row, double* out) const override;
+    double vectorDistance(const double* a, const double* b) const override;
 };
+//класс составной метрики: цвет и контрастность (как color_contrast) плюс гистограммы градиентов и LBP
+//с весом histogramWeight каждая; использует все виды признаков, уже посчитанные для других метрик
+class CompositeMetric : public IMetric {
+public:
+    static constexpr double histogramWeight = 250.0;//вес расстояния Бхаттачарии гистограмм (у gradient/texture - 1000)
+
+    void computeCellFeatures(const cv::Mat& cellImage, FeatureStore& cells, size_t row) const override;
+    void computeCellFeatures(const SourceFeatureMap& map, const cv::Rect& region, FeatureStore& cells, size_t row) const override;
+    void computeTileFeatures(const cv::Mat& tileImage, FeatureStore& tiles, size_t row) const override;
+    double distance(const FeatureStore& cells, size_t cell, const FeatureStore& tiles, size_t tile) const override;
+    void distanceBatch(const FeatureStore& cells, size_t cell, const FeatureStore& tiles,
+        size_t begin, size_t end, double* out) const override;
+    std::string getName() const override;
+    unsigned featureMask() const override;
+    int featureVectorSize() const override;
+    void getFeatureVector(const FeatureStore& store, size_t row, double* out) const override;
+    double vectorDistance(const double* a, const double* b) const override;
+};
+class ITileIndex;
+class TileRenderCache;
+class ImageBandReader;
+class ImageBandWriter;
+
 //класс создания мозаики
 class MosaicGenerator {
 private:
     std::vector<Tile> tiles;//тайтлы
+    TileAtlas tileAtlas;//пиксели тайлов (изображения тайлов ссылаются на его память)
+    TileLibrary tileLibrary;//открытая библиотека тайлов (изображения тайлов ссылаются на отображение ее файла)
+    FeatureStore features;//признаки тайлов (строка i - тайл i) для всех видов, понадобившихся выбранным метрикам
+    unsigned tileKinds = 0;//виды признаков, посчитанные для всех загруженных тайлов
+    fs::path tilesFolder;//папка загруженных тайлов (пусто - тайлы не из папки)
+    int tilesSize = 0;//размер загруженных тайлов
+    int tilesAngle = 0;//угол поворота загруженных тайлов
     std::unique_ptr<IMetric> metric;//текущая метрика сравнения
+    std::unique_ptr<ITileIndex> tileIndex;//индекс ближайших тайлов для текущей метрики
+    std::unique_ptr<TileRenderCache> renderCache;//отрисовки тайлов под размеры клеток (сбрасываются при смене тайлов)
+    bool indexDirty = true;//индекс не соответствует текущим тайлам/метрике
+    bool indexApproximate = false;//индекс построен в режиме приближенного поиска
     PostProcessPipeline postProcessor;//объект класса PostProcessPipeline (для постобработки)
+    bool tileCacheEnabled = true;//использование дискового кэша признаков тайлов
+    bool cacheSaveFailed = false;//последняя загрузка тайлов из папки не смогла записать дисковый кэш
+    int loadThreads = 0;//кол-во потоков загрузки тайлов (0 - по числу ядер)
+    int matchThreads = 0;//кол-во потоков сопоставления клеток (0 - по числу ядер)
+    MatchStats lastMatchStats;//статистика последнего сопоставления
+    GenerationTimings lastTimings;//время этапов последней мозаики
+    GenerationProgress progress;//ход текущей задачи и запрос отмены
+    static constexpr int matchCandidates = 8;//кол-во кандидатов клетки при ограниченных повторах
+    static constexpr int defaultBandRows = 512;//высота полосы потоковой генерации по умолчанию
+    static constexpr int minPreviewCells = 8;//минимальное кол-во клеток предпросмотра по меньшей стороне
+    //исключение GenerationCancelled, если запрошена отмена
+    void throwIfCancelled() const;
     //вычисляет параметры тайла с помощью текущей метрики
-    void computeTileFeatures(Tile& tile, const cv::Mat& image) const;
+    void computeTileFeatures(const cv::Mat& image, FeatureStore& store, size_t row) const;
+    //досчитывает для всех тайлов виды признаков текущей метрики, которых еще нет (параллельно)
+    void ensureTileFeatures();
+    //перестраивает индекс тайлов, если он устарел или изменился режим поиска
+    void prepareIndex(const Config& cfg);
+    //вычисляет признаки всех клеток сетки (параллельно)
+    void computeCellFeatures(const SourceFeatureMap& map, const std::vector<cv::Rect>& regions, FeatureStore& cells) const;
+    //находит k лучших тайлов для каждой клетки по полному набору тайлов (параллельно)
+    void findCandidates(const FeatureStore& cells, int k, CandidateLists& candidates) const;
+    //ближайший тайл с неисчерпанным лимитом повторов (distances - буфер для линейного прохода)
+    int findNearestAvailable(const FeatureStore& cells, size_t cell, int maxRepeats, std::vector<double>& distances) const;
+    //назначение тайлов клеткам в порядке строк с учетом лимита повторов (-1 - тайл не найден)
+    //totalCells - кол-во клеток всего изображения (при потоковой генерации cells - клетки одной полосы)
+    std::vector<int> assignGreedy(const FeatureStore& cells, const Config& cfg, size_t totalCells);
+    //глобальное назначение тайлов с учетом лимита повторов (аукцион по спискам кандидатов)
+    std::vector<int> assignGlobal(const FeatureStore& cells, const Config& cfg);
+    //назначение ближайших доступных тайлов клеткам без тайла в порядке строк
+    void assignRemaining(const FeatureStore& cells, int maxRepeats, std::vector<int>& assignment);
+    //отрисовка назначенных тайлов в клетки (параллельно) из кэша отрисовок, клетки без тайла заливаются средним цветом
+    //клетки regions исходного изображения; outputRegions - их области в мозаике размера outputSize
+    cv::Mat renderAssignment(const cv::Mat& source, const std::vector<cv::Rect>& regions,
+        const std::vector<cv::Rect>& outputRegions, const cv::Size& outputSize, const std::vector<int>& assignment);
     //создает мозаику без обработки
     cv::Mat createRawMosaic(const cv::Mat& source, const Config& cfg);
 
 public:
+    MosaicGenerator();
+    ~MosaicGenerator();
     //загрузка тайтлов из папки
     bool loadTiles(const fs::path& folder, int size, bool enableRotation = false, int rotation = 0);
+    //загрузка тайлов из файла библиотеки (отображается в память, тайлы читаются с диска по требованию)
+    bool loadTileLibrary(const fs::path& libraryFile);
+    //сборка файла библиотеки из папки тайлов (тайлы готовятся как в loadTiles, признаки - для текущей метрики);
+    //при неудаче файл удаляется
+    bool buildTileLibrary(const fs::path& folder, const fs::path& libraryFile, int size, bool enableRotation = false, int rotation = 0);
     //создает итоговую мозаику с постобработкой
     cv::Mat createMosaic(const cv::Mat& source, const Config& cfg);
-    //сеттер метрики сравнения по имени
+    //создает мозаику предпросмотра по исходному изображению, уменьшенному в factor раз, с той же сеткой
+    //(клеток в factor^2 раз меньше, те же метрика и эффекты, что у createMosaic; factor <= 1 - полная мозаика)
+    cv::Mat createPreview(const cv::Mat& source, const Config& cfg, int factor);
+    //уменьшения для последовательного уточнения предпросмотра от грубого к полному (последнее - 1)
+    static std::vector<int> previewFactors(const cv::Size& size, int gridStep);
+    //создает итоговую мозаику потоково: исходное изображение читается, а результат пишется горизонтальными
+    //полосами по bandRows строк результата (0 - по умолчанию), память ограничена высотой полосы, а не площадью изображения
+    //(кэш отрисовок хранит только тайлы текущей полосы, файл TIFF больше 4 ГБ пишется как BigTIFF);
+    //результат совпадает с createMosaic при жадном назначении (глобальное назначение не поддерживается - исключение),
+    //в т.ч. при увеличении (outputTileSize): тогда полосы считаются в строках результата
+    void createMosaicStreaming(ImageBandReader& source, ImageBandWriter& output, const Config& cfg, int bandRows = 0);
+    //сеттер метрики сравнения по имени; признаки тайлов для нее считаются при первом использовании
+    //и сохраняются до смены тайлов (виды, уже посчитанные для других метрик, не пересчитываются)
     bool setMetric(const std::string& metricName);
+    //имена всех метрик
+    static std::vector<std::string> metricNames();
+    //память признаков тайлов в байтах: всего и по метрикам, чьи признаки уже посчитаны
+    //(метрики с общими видами признаков делят одну память, поэтому сумма по метрикам может превышать общую)
+    size_t getFeatureMemoryBytes() const { return features.memoryBytes(); }
+    std::map<std::string, size_t> getFeatureMemoryByMetric() const;
+    //статистика последнего сопоставления клеток и тайлов
+    const MatchStats& getLastMatchStats() const { return lastMatchStats; }
+    //время этапов последней мозаики createMosaic или createMosaicStreaming
+    const GenerationTimings& getLastTimings() const { return lastTimings; }
     //считает кол-во загруженных тайтлов
     size_t getTilesCount() const { return tiles.size(); }
+    //память пикселей тайлов в байтах: атлас и отрисовки под размеры клеток
+    //(отображение библиотеки тайлов не учитывается: его страницы читаются из файла и вытесняются системой)
+    size_t getTileMemoryBytes() const;
     //удаляем тайтлы
-    void clearTiles() { tiles.clear(); }
+    void clearTiles();
+    //загружены ли тайлы из этой папки с этими параметрами (повторная загрузка не нужна)
+    bool hasTiles(const fs::path& folder, int size, bool enableRotation = false, int rotation = 0) const;
+    //включение/выключение дискового кэша тайлов
+    void setTileCacheEnabled(bool enabled) { tileCacheEnabled = enabled; }
+    //не удалось записать дисковый кэш при последней загрузке тайлов из папки (тайлы при этом загружены)
+    bool lastCacheSaveFailed() const { return cacheSaveFailed; }
+    //кол-во потоков загрузки тайлов (0 - по числу ядер)
+    void setLoadThreads(int threads) { loadThreads = threads; }
+    //кол-во потоков сопоставления клеток и тайлов, отрисовки и постобработки (0 - по числу ядер)
+    void setMatchThreads(int threads) {
+        matchThreads = threads;
+        postProcessor.setThreads(threads);
+    }
+    //ход загрузки и генерации (можно читать из другого потока во время работы генератора)
+    const GenerationProgress& getProgress() const { return progress; }
+    //запрос отмены из другого потока: загрузка тайлов возвращает false, генерация бросает GenerationCancelled
+    void cancel() { progress.cancelled = true; }
+    //сброс счетчиков хода и запроса отмены перед новой задачей
+    void resetProgress() { progress.reset(); }
+    //память, выделенная постобработкой последней мозаики (байты)
+    size_t getLastPostProcessBytes() const { return postProcessor.getLastAllocatedBytes(); }
     //настройка параметров постобработки
     void setPostProcessConfig(const PostProcessConfig& config) {
         postProcessor.setup(config);
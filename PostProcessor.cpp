@@ -1,4 +1,5 @@
 #include "PostProcessor.h"
+#include "Concurrency.h"
 #include <iostream>
 #include <algorithm>
 
@@ -6,15 +7,18 @@
 //цветокоррекция мозаики на основе оригинального изображения
 // (выравнивает средние значения цветовых каналов мозаики по оригиналу)
 cv::Mat ColorCorrectionEffect::apply(const cv::Mat& mosaic, const cv::Mat& original) {
-    cv::Mat corrected = mosaic.clone();
     cv::Mat originalResized;
 
     //приводим оригинальное изображение к размеру мозаики
     cv::resize(original, originalResized, mosaic.size());
 
     //вычисляем средние значения цветов для обоих изображений
-    cv::Scalar mosaicMean = cv::mean(mosaic);
-    cv::Scalar originalMean = cv::mean(originalResized);
+    return correct(mosaic, cv::mean(mosaic), cv::mean(originalResized));
+}
+
+//коррекция каналов мозаики по средним значениям
+cv::Mat ColorCorrectionEffect::correct(const cv::Mat& mosaic, const cv::Scalar& mosaicMean, const cv::Scalar& originalMean) const {
+    cv::Mat corrected = mosaic.clone();
 
     //разделяем изображение на цветовые каналы для независимой коррекции
     std::vector<cv::Mat> mosaicChannels, correctedChannels;
@@ -43,11 +47,53 @@ cv::Mat ColorCorrectionEffect::apply(const cv::Mat& mosaic, const cv::Mat& origi
     return corrected;
 }
 
+//статистика для потоковой обработки: суммы каналов по полосам
+//(суммы 8-битных значений в double точны, поэтому средние совпадают с cv::mean по всему изображению)
+void ColorCorrectionEffect::resetStatistics() {
+    mosaicSum = cv::Scalar::all(0);
+    originalSum = cv::Scalar::all(0);
+    pixelCount = 0;
+}
+
+void ColorCorrectionEffect::accumulateStatistics(const cv::Mat& mosaicBand, const cv::Mat& originalBand) {
+    mosaicSum += cv::sum(mosaicBand);
+    originalSum += cv::sum(originalBand);
+    pixelCount += static_cast<double>(mosaicBand.total());
+}
+
+//коррекция полосы по средним всего изображения (без собранной статистики - по средним самой полосы)
+cv::Mat ColorCorrectionEffect::applyBand(const cv::Mat& band, const cv::Mat& original, int top, const cv::Size& imageSize) {
+    if (pixelCount <= 0) return apply(band, original);
+    return correct(band, mosaicSum * (1.0 / pixelCount), originalSum * (1.0 / pixelCount));
+}
+
+//таблица коррекции: та же коррекция, примененная к строке из всех 256 значений каналов
+//(значение канала корректируется независимо от соседей, поэтому таблица дает тот же результат, что и correct)
+void ColorCorrectionEffect::beginRows(int type) {
+    cv::Mat ramp(1, 256, type);
+    const int channels = ramp.channels();
+    uchar* values = ramp.ptr<uchar>(0);
+    for (int v = 0; v < 256; ++v) {
+        for (int c = 0; c < channels; ++c) values[v * channels + c] = static_cast<uchar>(v);
+    }
+    lut = correct(ramp, mosaicSum * (1.0 / pixelCount), originalSum * (1.0 / pixelCount));
+}
+
+//коррекция строк по таблице на месте
+void ColorCorrectionEffect::applyRows(cv::Mat& rows, const cv::Mat& original) const {
+    cv::LUT(rows, lut, rows);
+}
+
 //геттер эффекта цветокоррекции
 std::string ColorCorrectionEffect::getName() const {
     return "color_correction";
 }
 
+//сеттер интенсивности коррекции
+void ColorCorrectionEffect::setIntensity(double intensity) {
+    this->intensity = std::clamp(intensity, 0.0, 1.0);
+}
+
 //класс AlphaBlendEffectс
 //смешивает мозаику с оригинальным изображением через альфа-канал
 cv::Mat AlphaBlendEffect::apply(const cv::Mat& mosaic, const cv::Mat& original) {
@@ -62,48 +108,140 @@ cv::Mat AlphaBlendEffect::apply(const cv::Mat& mosaic, const cv::Mat& original)
     return blended;
 }
 
+//смешивание строк с теми же строками оригинала на месте
+void AlphaBlendEffect::applyRows(cv::Mat& rows, const cv::Mat& original) const {
+    cv::addWeighted(rows, 1.0 - alpha, original, alpha, 0, rows);
+}
+
 //геттер эффекта альфа-смешивания
 std::string AlphaBlendEffect::getName() const {
     return "alpha_blend";
 }
 
+//сеттер коэффициента смешивания
+void AlphaBlendEffect::setIntensity(double intensity) {
+    alpha = std::clamp(intensity, 0.0, 1.0);
+}
+
 //класс SeamSmoothingEffect 
 //сглаживает видимые швы между плитками мозаики(размытием)
 cv::Mat SeamSmoothingEffect::apply(const cv::Mat& mosaic, const cv::Mat& original) {
+    return applyBand(mosaic, original, 0, mosaic.size());
+}
+
+//размер ядра размытия по интенсивности (нечетный)
+int SeamSmoothingEffect::blurKernelSize() const {
+    int blurSize = 3 + static_cast<int>(intensity * 5);
+    if (blurSize % 2 == 0) blurSize++;
+    return blurSize;
+}
+
+//сглаживание швов полосы: положение швов и ограничение ядра берутся по всему изображению,
+//размытие строк на краях полосы неточно только в пределах контекста bandHalo
+cv::Mat SeamSmoothingEffect::applyBand(const cv::Mat& mosaic, const cv::Mat& original, int top, const cv::Size& imageSize) {
     cv::Mat smoothed = mosaic.clone();
+    blendSeams(smoothed, top, imageSize);
+    return smoothed;
+}
 
-    //маска областей швов
-    cv::Mat seamMask = createSeamMask(mosaic);
+//сглаживание швов всего изображения на месте
+size_t SeamSmoothingEffect::applyInPlace(cv::Mat& image, const cv::Mat& original) {
+    return blendSeams(image, 0, image.size());
+}
 
-    //если нет швов для сглаживания, возвращаем исходное
-    if (cv::countNonZero(seamMask) == 0) {
-        return smoothed;
-    }
+//размытие полос швов и смешивание с ним пикселей швов; пиксели швов не пересекаются между собой
+//(строки горизонтальных швов - целиком, вертикальные швы - только в остальных строках), поэтому смешиваются на месте.
+//размывается не все изображение, а каждая полоса шва с контекстом радиуса ядра (вертикальная - на всю высоту,
+//горизонтальная - на всю ширину): значение размытого пикселя зависит только от соседей в пределах радиуса,
+//а на краях изображения полоса отражается так же, как изображение целиком, поэтому результат совпадает
+//с размытием всего изображения. сначала параллельно размываются все полосы, затем параллельно смешиваются швы
+size_t SeamSmoothingEffect::blendSeams(cv::Mat& image, int top, const cv::Size& imageSize) const {
+    //области швов; если нет швов для сглаживания, изображение не меняется
+    std::vector<uchar> seamRows, seamColumns;
+    if (!findSeams(image.size(), top, imageSize, seamRows, seamColumns)) return 0;
 
     //параметры размытия
-    int blurSize = 3 + static_cast<int>(intensity * 5);
-    if (blurSize % 2 == 0) blurSize++;
-    blurSize = std::max(3, std::min(blurSize, std::min(mosaic.rows, mosaic.cols)));
+    int blurSize = blurKernelSize();
+    blurSize = std::max(3, std::min(blurSize, std::min(imageSize.height, imageSize.width)));
 
-    if (blurSize < 3) return mosaic.clone();
+    if (blurSize < 3) return 0;
 
     double sigma = intensity * 2.0;
-
-    //размываем только швы
-    cv::Mat blurred;
-    cv::GaussianBlur(mosaic, blurred, cv::Size(blurSize, blurSize), sigma);
-
-    //смешиваем размытую версию с оригиналом в областях швов
     double blendFactor = intensity * 0.7;
+    const int radius = blurSize / 2;
+
+    //непрерывные отрезки флагов: [начало, конец)
+    auto findRuns = [](const std::vector<uchar>& flags, uchar value) {
+        std::vector<std::pair<int, int>> runs;
+        for (int i = 0; i < static_cast<int>(flags.size());) {
+            int end = i;
+            while (end < static_cast<int>(flags.size()) && flags[end] == flags[i]) ++end;
+            if (flags[i] == value) runs.emplace_back(i, end);
+            i = end;
+        }
+        return runs;
+    };
+    const auto columnRuns = findRuns(seamColumns, 1);//вертикальные швы
+    const auto rowRuns = findRuns(seamRows, 1);//горизонтальные швы
+    const auto freeRows = findRuns(seamRows, 0);//строки, где смешиваются вертикальные швы
+
+    //полоса шва: область смешивания вдоль всего изображения и ее размытая версия
+    struct Strip {
+        cv::Rect region;//строки горизонтального шва или столбцы вертикального
+        cv::Rect context;//область с контекстом радиуса ядра (в пределах изображения)
+        cv::Mat blurred;//размытая область context
+        bool vertical;
+    };
+    std::vector<Strip> strips;
+    for (const auto& run : rowRuns) {
+        cv::Rect region(0, run.first, image.cols, run.second - run.first);
+        int y1 = std::max(0, region.y - radius), y2 = std::min(image.rows, region.y + region.height + radius);
+        strips.push_back({ region, cv::Rect(0, y1, image.cols, y2 - y1), cv::Mat(), false });
+    }
+    if (!freeRows.empty()) {
+        for (const auto& run : columnRuns) {
+            cv::Rect region(run.first, 0, run.second - run.first, image.rows);
+            int x1 = std::max(0, region.x - radius), x2 = std::min(image.cols, region.x + region.width + radius);
+            strips.push_back({ region, cv::Rect(x1, 0, x2 - x1, image.rows), cv::Mat(), true });
+        }
+    }
 
-    //временное изображение для смешивания
-    cv::Mat blended = mosaic.clone();
-    cv::addWeighted(mosaic, 1.0 - blendFactor, blurred, blendFactor, 0, blended);
-
-    //копируем сглаженные области швов из blended в результат
-    blended.copyTo(smoothed, seamMask);
+    //размытие полос (читают исходное изображение, поэтому выполняются до смешивания);
+    //при частой сетке полосы с контекстом покрывают изображение больше одного раза - тогда размывается все изображение
+    size_t contextArea = 0;
+    for (const auto& strip : strips) contextArea += static_cast<size_t>(strip.context.area());
+    size_t bytes = 0;
+    if (contextArea >= image.total()) {
+        cv::Mat blurred;
+        cv::GaussianBlur(image, blurred, cv::Size(blurSize, blurSize), sigma, 0, cv::BORDER_DEFAULT | cv::BORDER_ISOLATED);
+        for (auto& strip : strips) strip.blurred = blurred(strip.context);
+        bytes = blurred.total() * blurred.elemSize();
+    }
+    else {
+        parallelFor(strips.size(), threads, [&](size_t i) {
+            cv::GaussianBlur(image(strips[i].context), strips[i].blurred, cv::Size(blurSize, blurSize), sigma, 0,
+                cv::BORDER_DEFAULT | cv::BORDER_ISOLATED);
+        }, 1);
+        for (const auto& strip : strips) bytes += strip.blurred.total() * strip.blurred.elemSize();
+    }
 
-    return smoothed;
+    //смешивание швов с размытыми полосами
+    parallelFor(strips.size(), threads, [&](size_t i) {
+        const Strip& strip = strips[i];
+        auto blend = [&](const cv::Rect& region) {
+            cv::Mat target = image(region);
+            cv::Rect local(region.x - strip.context.x, region.y - strip.context.y, region.width, region.height);
+            cv::addWeighted(target, 1.0 - blendFactor, strip.blurred(local), blendFactor, 0, target);
+        };
+        if (!strip.vertical) {
+            blend(strip.region);
+            return;
+        }
+        for (const auto& rows : freeRows) {
+            blend(cv::Rect(strip.region.x, rows.first, strip.region.width, rows.second - rows.first));
+        }
+    }, 1);
+    return bytes;
 }
 
 //геттер эффекта сглаживания швов
@@ -111,42 +249,50 @@ std::string SeamSmoothingEffect::getName() const {
     return "seam_smoothing";
 }
 
+//сеттер интенсивности сглаживания (от нее зависят ширина швов и размер ядра размытия)
+void SeamSmoothingEffect::setIntensity(double intensity) {
+    this->intensity = std::clamp(intensity, 0.0, 1.0);
+}
+
 //сеттер для размера сетки
 void SeamSmoothingEffect::setGridSize(int gridSize) {
     this->gridSize = gridSize;
 }
 
-//бинарная маска областей швов между плитками мозаики
+//области швов между плитками мозаики
 //определяет вертикальные и горизонтальные границы сетки мозаики
-cv::Mat SeamSmoothingEffect::createSeamMask(const cv::Mat& mosaic) const {
-    cv::Mat mask = cv::Mat::zeros(mosaic.size(), CV_8UC1);
+bool SeamSmoothingEffect::findSeams(const cv::Size& size, int top, const cv::Size& imageSize,
+    std::vector<uchar>& seamRows, std::vector<uchar>& seamColumns) const {
+    seamRows.assign(size.height, 0);
+    seamColumns.assign(size.width, 0);
 
-    if (gridSize <= 0 || intensity < 0.01) return mask;
+    if (gridSize <= 0 || intensity < 0.01 || size.area() <= 0) return false;
 
     //фиксированная ширина 1-3 пикселя
     int lineWidth = 1 + static_cast<int>(intensity * 2);
+    bool found = false;
 
     //вертикальные швы
-    for (int x = gridSize; x < mosaic.cols; x += gridSize) {
+    for (int x = gridSize; x < size.width; x += gridSize) {
         int startX = std::max(0, x - lineWidth / 2);
-        int endX = std::min(mosaic.cols, startX + lineWidth);
-
-        cv::rectangle(mask,
-            cv::Rect(startX, 0, endX - startX, mosaic.rows),
-            cv::Scalar(255), -1);
+        int endX = std::min(size.width, startX + lineWidth);
+        std::fill(seamColumns.begin() + startX, seamColumns.begin() + endX, 1);
+        found = true;
     }
 
-    //горизонтальные швы  
-    for (int y = gridSize; y < mosaic.rows; y += gridSize) {
+    //горизонтальные швы (в координатах изображения, в полосу попадает пересечение)
+    int bottom = top + size.height;
+    for (int y = std::max(gridSize, top / gridSize * gridSize); y < imageSize.height && y - lineWidth < bottom; y += gridSize) {
         int startY = std::max(0, y - lineWidth / 2);
-        int endY = std::min(mosaic.rows, startY + lineWidth);
-
-        cv::rectangle(mask,
-            cv::Rect(0, startY, mosaic.cols, endY - startY),
-            cv::Scalar(255), -1);
+        int endY = std::min(imageSize.height, startY + lineWidth);
+        startY = std::max(startY, top);
+        endY = std::min(endY, bottom);
+        if (startY >= endY) continue;
+        std::fill(seamRows.begin() + (startY - top), seamRows.begin() + (endY - top), 1);
+        found = true;
     }
 
-    return mask;
+    return found;
 }
 
 //класс EffectFactory
@@ -177,11 +323,13 @@ void PostProcessPipeline::setup(const PostProcessConfig& config) {
     for (const auto& [effectName, intensity] : config.effects) {
         auto effect = EffectFactory::createEffect(effectName);
         if (effect) {
+            effect->setIntensity(intensity);
             //для эффекта сглаживания швов дополнительно устанавливаем размер сетки
             if (auto seamEffect = dynamic_cast<SeamSmoothingEffect*>(effect.get())) {
                 seamEffect->setGridSize(gridSize);
             }
 
+            effect->setThreads(threads);
             //добавляем эффект в цепочку
             effects.push_back(std::move(effect));
         }
@@ -192,11 +340,115 @@ void PostProcessPipeline::setup(const PostProcessConfig& config) {
 //(эффекты применяются последовательно в порядке их добавления в конфигурации)
 cv::Mat PostProcessPipeline::process(const cv::Mat& mosaic, const cv::Mat& original) {
     cv::Mat result = mosaic.clone();
+    processInPlace(result, original);
+    lastAllocatedBytes += result.total() * result.elemSize();
+    return result; //возвращаем финальный результат
+}
+
+//слитая обработка: оригинал приводится к размеру мозаики один раз и используется всеми эффектами;
+//для каждой группы подряд идущих попиксельных эффектов собирается статистика входа тех, кому она нужна
+//(вход эффекта внутри группы - результат предыдущих эффектов группы, он считается по блокам строк во временный буфер),
+//затем группа применяется к строкам мозаики на месте одним параллельным проходом
+void PostProcessPipeline::processInPlace(cv::Mat& mosaic, const cv::Mat& original) {
+    lastAllocatedBytes = 0;
+    if (effects.empty() || mosaic.empty()) return;
+    //эффекты без попиксельной обработки для других типов изображений - по отдельности
+    if (mosaic.depth() != CV_8U || original.type() != mosaic.type()) {
+        for (const auto& effect : effects) {
+            lastAllocatedBytes += effect->applyInPlace(mosaic, original);
+        }
+        return;
+    }
+
+    cv::Mat originalResized = original;
+    if (original.size() != mosaic.size()) {
+        cv::resize(original, originalResized, mosaic.size());
+        lastAllocatedBytes += originalResized.total() * originalResized.elemSize();
+    }
 
-    //последовательно применяем все эффекты из цепочки
+    //блоки строк прохода (строки блока вместе с оригиналом помещаются в кэш)
+    const int blockRows = 16;
+    const size_t blocks = (mosaic.rows + blockRows - 1) / blockRows;
+    auto blockEnd = [&](int top) { return std::min(mosaic.rows, top + blockRows); };
+
+    size_t first = 0;
+    while (first < effects.size()) {
+        if (!effects[first]->isPointwise()) {
+            lastAllocatedBytes += effects[first]->applyInPlace(mosaic, originalResized);
+            ++first;
+            continue;
+        }
+        size_t last = first;
+        while (last < effects.size() && effects[last]->isPointwise()) ++last;
+
+        //статистика входа каждого эффекта группы
+        cv::Mat scratch;
+        for (size_t i = first; i < last; ++i) {
+            PostProcessEffect& effect = *effects[i];
+            if (effect.needsStatistics()) {
+                effect.resetStatistics();
+                if (i == first) {
+                    effect.accumulateStatistics(mosaic, originalResized);
+                }
+                else {
+                    if (scratch.empty()) {
+                        scratch.create(std::min(blockRows, mosaic.rows), mosaic.cols, mosaic.type());
+                        lastAllocatedBytes += scratch.total() * scratch.elemSize();
+                    }
+                    for (size_t block = 0; block < blocks; ++block) {
+                        int top = static_cast<int>(block) * blockRows, bottom = blockEnd(top);
+                        cv::Mat input = scratch.rowRange(0, bottom - top);
+                        mosaic.rowRange(top, bottom).copyTo(input);
+                        cv::Mat originalRows = originalResized.rowRange(top, bottom);
+                        for (size_t j = first; j < i; ++j) effects[j]->applyRows(input, originalRows);
+                        effect.accumulateStatistics(input, originalRows);
+                    }
+                }
+            }
+            effect.beginRows(mosaic.type());
+        }
+
+        //один проход по строкам для всей группы
+        parallelFor(blocks, threads, [&](size_t block) {
+            int top = static_cast<int>(block) * blockRows, bottom = blockEnd(top);
+            cv::Mat target = mosaic.rowRange(top, bottom);
+            cv::Mat originalRows = originalResized.rowRange(top, bottom);
+            for (size_t i = first; i < last; ++i) effects[i]->applyRows(target, originalRows);
+        }, 1);
+        first = last;
+    }
+}
+
+//изменение размера сетки у всех эффектов цепочки
+void PostProcessPipeline::setGridSize(int gridSize) {
+    this->gridSize = gridSize;
     for (const auto& effect : effects) {
-        result = effect->apply(result, original);
+        effect->setGridSize(gridSize);
     }
+}
 
-    return result; //возвращаем финальный результат
+//изменение кол-ва потоков у всех эффектов цепочки
+void PostProcessPipeline::setThreads(int threads) {
+    this->threads = threads;
+    for (const auto& effect : effects) {
+        effect->setThreads(threads);
+    }
+}
+
+//контекст полосы для цепочки эффектов
+int PostProcessPipeline::bandHalo() const {
+    int halo = 0;
+    for (const auto& effect : effects) {
+        halo += effect->bandHalo();
+    }
+    return halo;
+}
+
+//применяет первые count эффектов цепочки к полосе изображения
+cv::Mat PostProcessPipeline::processBand(const cv::Mat& band, const cv::Mat& original, int top, const cv::Size& imageSize, size_t count) {
+    cv::Mat result = band;
+    for (size_t i = 0; i < count && i < effects.size(); ++i) {
+        result = effects[i]->applyBand(result, original, top, imageSize);
+    }
+    return result;
 }
@@ -28,8 +28,42 @@ public:
     virtual cv::Mat apply(const cv::Mat& mosaic, const cv::Mat& original) = 0;
     //геттер имени эффекта
     virtual std::string getName() const = 0;
+    //сеттер интенсивности эффекта (0..1, значения вне диапазона ограничиваются)
+    virtual void setIntensity(double intensity) = 0;
     //сеттер для размера сетки
     virtual void setGridSize(int gridSize) {}
+    //кол-во потоков обработки (0 - по числу ядер)
+    virtual void setThreads(int threads) {}
+
+    //потоковая обработка горизонтальными полосами
+    //кол-во строк контекста сверху и снизу полосы, нужных эффекту (строки контекста результата не используются)
+    virtual int bandHalo() const { return 0; }
+    //эффекту нужна статистика всего изображения, собираемая по полосам до обработки
+    virtual bool needsStatistics() const { return false; }
+    //сброс собранной статистики
+    virtual void resetStatistics() {}
+    //добавление полосы мозаики и тех же строк оригинала (приведенного к размеру мозаики) к статистике
+    virtual void accumulateStatistics(const cv::Mat& mosaicBand, const cv::Mat& originalBand) {}
+    //применение к полосе: band - строки [top, top + band.rows) изображения размера imageSize,
+    //original - те же строки оригинала того же размера; по умолчанию - apply (для попиксельных эффектов)
+    virtual cv::Mat applyBand(const cv::Mat& band, const cv::Mat& original, int top, const cv::Size& imageSize) {
+        return apply(band, original);
+    }
+
+    //слитая обработка всего изображения на месте (PostProcessPipeline::process)
+    //попиксельный эффект: подряд идущие попиксельные эффекты применяются к каждой строке за один проход
+    virtual bool isPointwise() const { return false; }
+    //подготовка попиксельного эффекта к проходу по изображению типа type (после сбора статистики его входа)
+    virtual void beginRows(int type) {}
+    //применение попиксельного эффекта к строкам на месте, original - те же строки оригинала размера мозаики
+    //(вызывается параллельно для разных строк)
+    virtual void applyRows(cv::Mat& rows, const cv::Mat& original) const {}
+    //применение остальных эффектов ко всему изображению на месте, возвращает кол-во байт выделенной памяти
+    //(по умолчанию - apply с новым изображением)
+    virtual size_t applyInPlace(cv::Mat& image, const cv::Mat& original) {
+        image = apply(image, original);
+        return image.total() * image.elemSize();
+    }
 };
 
 //класс: цветокоррекция мозаики
@@ -37,10 +71,25 @@ public:
 class ColorCorrectionEffect : public PostProcessEffect {
 private:
     double intensity = 0.5; //интенсивность коррекции цвета
+    cv::Scalar mosaicSum; //сумма каналов мозаики по собранным полосам
+    cv::Scalar originalSum; //сумма каналов оригинала по собранным полосам
+    double pixelCount = 0; //кол-во пикселей в собранных полосах
+    cv::Mat lut; //таблица коррекции значений каналов для слитого прохода (1 x 256)
+
+    //коррекция по заданным средним значениям каналов мозаики и оригинала
+    cv::Mat correct(const cv::Mat& mosaic, const cv::Scalar& mosaicMean, const cv::Scalar& originalMean) const;
 
 public:
     cv::Mat apply(const cv::Mat& mosaic, const cv::Mat& original) override;
     std::string getName() const override;
+    void setIntensity(double intensity) override;
+    bool needsStatistics() const override { return true; }
+    void resetStatistics() override;
+    void accumulateStatistics(const cv::Mat& mosaicBand, const cv::Mat& originalBand) override;
+    cv::Mat applyBand(const cv::Mat& band, const cv::Mat& original, int top, const cv::Size& imageSize) override;
+    bool isPointwise() const override { return true; }
+    void beginRows(int type) override;
+    void applyRows(cv::Mat& rows, const cv::Mat& original) const override;
 };
 
 //класс: альфа-смешивание с оригинальным изображением
@@ -52,6 +101,10 @@ private:
 public:
     cv::Mat apply(const cv::Mat& mosaic, const cv::Mat& original) override;
     std::string getName() const override;
+    //интенсивность - доля оригинала в смеси
+    void setIntensity(double intensity) override;
+    bool isPointwise() const override { return true; }
+    void applyRows(cv::Mat& rows, const cv::Mat& original) const override;
 };
 
 //класс: сглаживание швов между клетками мозаики
@@ -60,15 +113,27 @@ class SeamSmoothingEffect : public PostProcessEffect {
 private:
     double intensity = 0.5; //интенсивность сглаживания
     int gridSize = 30; //размер сетки мозаики для определения положения швов
+    int threads = 0; //кол-во потоков размытия и смешивания полос швов
 
-    //создание маски областей швов для применения размытия
-    //бинарная маска (255 - области швов, 0 - остальное)
-    cv::Mat createSeamMask(const cv::Mat& mosaic) const;
+    //области швов для строк [top, top + size.height) изображения: флаги строк, целиком попадающих в горизонтальные швы,
+    //и столбцов вертикальных швов (пиксель в шве, если в шве его строка или столбец); false - швов нет
+    bool findSeams(const cv::Size& size, int top, const cv::Size& imageSize,
+        std::vector<uchar>& seamRows, std::vector<uchar>& seamColumns) const;
+    //размер ядра размытия (до ограничения размером изображения)
+    int blurKernelSize() const;
+    //смешивание швов изображения с размытой версией на месте, возвращает кол-во байт выделенной памяти;
+    //размываются только полосы швов с контекстом радиуса ядра
+    size_t blendSeams(cv::Mat& image, int top, const cv::Size& imageSize) const;
 
 public:
     cv::Mat apply(const cv::Mat& mosaic, const cv::Mat& original) override;
     std::string getName() const override;;
+    void setIntensity(double intensity) override;
     void setGridSize(int gridSize) override;
+    void setThreads(int threads) override { this->threads = threads; }
+    int bandHalo() const override { return blurKernelSize() / 2; }
+    cv::Mat applyBand(const cv::Mat& band, const cv::Mat& original, int top, const cv::Size& imageSize) override;
+    size_t applyInPlace(cv::Mat& image, const cv::Mat& original) override;
 };
 
 //создание эффектов постобработки
@@ -83,10 +148,32 @@ class PostProcessPipeline {
 private:
     std::vector<std::unique_ptr<PostProcessEffect>> effects;//эффекты
     int gridSize = 30;//размер сетки для передачи эффектам
+    int threads = 0;//кол-во потоков слитого прохода и эффектов (0 - по числу ядер)
+    size_t lastAllocatedBytes = 0;//память, выделенная последней обработкой изображения целиком
 
 public:
     //постобработка на основе параметров из PostProcessConfig
     void setup(const PostProcessConfig& config);
     //променение эффектов к изображению
     cv::Mat process(const cv::Mat& mosaic, const cv::Mat& original);
+    //применение эффектов к изображению на месте: оригинал приводится к размеру мозаики один раз,
+    //подряд идущие попиксельные эффекты выполняются одним параллельным проходом по строкам
+    void processInPlace(cv::Mat& mosaic, const cv::Mat& original);
+    //кол-во байт памяти, выделенной последним process/processInPlace (копия мозаики, оригинал, буферы эффектов)
+    size_t getLastAllocatedBytes() const { return lastAllocatedBytes; }
+    //кол-во потоков слитого прохода и эффектов
+    void setThreads(int threads);
+
+    //размер сетки мозаики для эффектов (при отрисовке с увеличением - размер клетки в результате)
+    void setGridSize(int gridSize);
+    int getGridSize() const { return gridSize; }
+    //кол-во эффектов
+    size_t size() const { return effects.size(); }
+    //эффект по номеру в цепочке
+    PostProcessEffect& effect(size_t index) { return *effects[index]; }
+    //контекст полосы для всей цепочки: контексты эффектов складываются, т.к. каждый следующий эффект
+    //читает соседние строки результата предыдущего
+    int bandHalo() const;
+    //применение первых count эффектов к полосе (см. PostProcessEffect::applyBand)
+    cv::Mat processBand(const cv::Mat& band, const cv::Mat& original, int top, const cv::Size& imageSize, size_t count);
 };
@@ -0,0 +1,19 @@
+#pragma once
+
+//общие макросы векторных ядер (подключаются только в .cpp с ядрами)
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MOSAIC_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+//векторные функции компилируются под свой набор инструкций без глобальных флагов сборки,
+//вызываются только после проверки процессора
+#if defined(MOSAIC_X86) && (defined(__GNUC__) || defined(__clang__))
+#define MOSAIC_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MOSAIC_TARGET(isa)
+#endif
@@ -0,0 +1,186 @@
+#include "SourceFeatureMap.h"
+#include "MosaicProcessor.h"
+#include "FeatureKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//класс SourceFeatureMap
+//сумма по прямоугольнику из интегрального изображения: S(y2,x2) - S(y1,x2) - S(y2,x1) + S(y1,x1)
+cv::Scalar SourceFeatureMap::rectSum(const cv::Mat& integral, const cv::Rect& region) {
+    cv::Scalar result(0, 0, 0, 0);
+    int channels = std::min(integral.channels(), 4);
+    int x1 = region.x * integral.channels(), x2 = (region.x + region.width) * integral.channels();
+    if (integral.depth() == CV_32S) {
+        const int* top = integral.ptr<int>(region.y);
+        const int* bottom = integral.ptr<int>(region.y + region.height);
+        for (int c = 0; c < channels; ++c) {
+            result[c] = static_cast<double>(bottom[x2 + c]) - top[x2 + c] - bottom[x1 + c] + top[x1 + c];
+        }
+    }
+    else {
+        const double* top = integral.ptr<double>(region.y);
+        const double* bottom = integral.ptr<double>(region.y + region.height);
+        for (int c = 0; c < channels; ++c) {
+            result[c] = bottom[x2 + c] - top[x2 + c] - bottom[x1 + c] + top[x1 + c];
+        }
+    }
+    return result;
+}
+
+//построение плоскостей
+//суммы 8-битного изображения считаются в int, если не могут переполниться, иначе в double;
+//суммы квадратов - всегда в double (целые значения до 2^53 представляются точно)
+void SourceFeatureMap::build(const cv::Mat& image, unsigned mask) {
+    clear();
+    source = image;
+    if (mask & (FeatureColor | FeatureStdDev)) {
+        double maxSum = 255.0 * image.total();
+        int sumDepth = image.depth() == CV_8U && maxSum < std::numeric_limits<int>::max() ? CV_32S : CV_64F;
+        if (mask & FeatureStdDev) {
+            cv::integral(image, sum, sqsum, sumDepth, CV_64F);
+            kinds |= FeatureColor | FeatureStdDev;
+        }
+        else {
+            cv::integral(image, sum, sumDepth);
+            kinds |= FeatureColor;
+        }
+    }
+    if (mask & (FeatureGradient | FeatureTexture)) {
+        //перевод в оттенки серого один раз для всего изображения (как в FeatureUtils)
+        if (image.channels() == 3) {
+            cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        }
+        else {
+            gray = image;
+        }
+        if (mask & FeatureGradient) {
+            buildGradientPlanes();
+            kinds |= FeatureGradient;
+        }
+        if (mask & FeatureTexture) {
+            buildLBPPlane();
+            kinds |= FeatureTexture;
+        }
+    }
+}
+
+//плоскости градиента: для 8-битной яркости - Собель, величина и бин направления за один проход по строкам,
+//иначе - Собель и перевод в полярные координаты по всему изображению
+void SourceFeatureMap::buildGradientPlanes() {
+    if (gray.type() == CV_8UC1) {
+        computeGradientPlanes(gray, gradientMagnitude, gradientBin);
+        return;
+    }
+    cv::Mat grayFloat, gradX, gradY, angle;
+    gray.convertTo(grayFloat, CV_32F);
+    cv::Sobel(grayFloat, gradX, CV_32F, 1, 0, 3);
+    cv::Sobel(grayFloat, gradY, CV_32F, 0, 1, 3);
+    cv::cartToPolar(gradX, gradY, gradientMagnitude, angle, true);
+
+    const int bins = FeatureStore::gradientBins;
+    const float angleStep = 360.0f / bins;
+    gradientBin.create(angle.rows, angle.cols, CV_8U);
+    for (int y = 0; y < angle.rows; ++y) {
+        const float* angleRow = angle.ptr<float>(y);
+        uchar* binRow = gradientBin.ptr<uchar>(y);
+        for (int x = 0; x < angle.cols; ++x) {
+            int bin = static_cast<int>(angleRow[x] / angleStep);
+            binRow[x] = static_cast<uchar>(std::max(0, std::min(bin, bins - 1)));
+        }
+    }
+}
+
+//плоскость LBP-кодов: код каждого внутреннего пикселя по 8 соседям (векторное ядро, как FeatureUtils::getLBPValue)
+void SourceFeatureMap::buildLBPPlane() {
+    lbpCodes = cv::Mat::zeros(gray.rows, gray.cols, CV_8U);
+    const FeatureKernels& kernels = featureKernels();
+    for (int y = 1; y < gray.rows - 1; ++y) {
+        kernels.lbpRow(gray.ptr<uchar>(y - 1), gray.ptr<uchar>(y), gray.ptr<uchar>(y + 1), gray.cols, lbpCodes.ptr<uchar>(y));
+    }
+}
+
+//освобождение плоскостей
+void SourceFeatureMap::clear() {
+    source.release();
+    sum.release();
+    sqsum.release();
+    gray.release();
+    gradientMagnitude.release();
+    gradientBin.release();
+    lbpCodes.release();
+    kinds = 0;
+}
+
+//средний цвет области
+cv::Scalar SourceFeatureMap::mean(const cv::Rect& region) const {
+    double area = static_cast<double>(region.area());
+    if (!has(FeatureColor) || area <= 0) return cv::mean(source(region));
+    cv::Scalar total = rectSum(sum, region);
+    for (int c = 0; c < 4; ++c) total[c] /= area;
+    return total;
+}
+
+//стандартное отклонение области: sqrt(E[x^2] - E[x]^2), как в cv::meanStdDev
+//для цветного изображения - по трем каналам, для одноканального - одно значение
+cv::Scalar SourceFeatureMap::stddev(const cv::Rect& region) const {
+    double area = static_cast<double>(region.area());
+    if (!has(FeatureStdDev) || area <= 0) return FeatureUtils::computeStdDev(source(region));
+    cv::Scalar total = rectSum(sum, region);
+    cv::Scalar squares = rectSum(sqsum, region);
+    cv::Scalar result(0, 0, 0, 0);
+    int channels = source.channels() == 3 ? 3 : 1;
+    for (int c = 0; c < channels; ++c) {
+        double m = total[c] / area;
+        result[c] = std::sqrt(std::max(squares[c] / area - m * m, 0.0));
+    }
+    return result;
+}
+
+//нормировка гистограммы на сумму модулей (как cv::normalize с NORM_L1), пустая гистограмма остается нулевой
+template <typename T>
+static void normalizeHistogram(const T* hist, int bins, float* out) {
+    double total = 0.0;
+    for (int i = 0; i < bins; ++i) total += std::fabs(static_cast<double>(hist[i]));
+    double scale = total > 0.0 ? 1.0 / total : 0.0;
+    for (int i = 0; i < bins; ++i) out[i] = static_cast<float>(hist[i] * scale);
+}
+
+//гистограмма направлений градиентов области: величины градиента суммируются по бинам в порядке строк
+void SourceFeatureMap::gradientHistogram(const cv::Rect& region, float* out) const {
+    const int bins = FeatureStore::gradientBins;
+    if (!has(FeatureGradient)) {
+        cv::Mat hist = FeatureUtils::computeGradientHist(source(region));
+        for (int i = 0; i < bins; ++i) out[i] = hist.at<float>(i);
+        return;
+    }
+    float hist[FeatureStore::gradientBins] = {};
+    for (int y = region.y; y < region.y + region.height; ++y) {
+        const float* magnitude = gradientMagnitude.ptr<float>(y);
+        const uchar* bin = gradientBin.ptr<uchar>(y);
+        for (int x = region.x; x < region.x + region.width; ++x) {
+            hist[bin[x]] += magnitude[x];
+        }
+    }
+    normalizeHistogram(hist, bins, out);
+}
+
+//гистограмма LBP-кодов области без пикселей границы изображения
+void SourceFeatureMap::textureHistogram(const cv::Rect& region, float* out) const {
+    const int bins = FeatureStore::textureBins;
+    if (!has(FeatureTexture)) {
+        cv::Mat hist = FeatureUtils::computeLBPFeatures(source(region));
+        for (int i = 0; i < bins; ++i) out[i] = hist.at<float>(i);
+        return;
+    }
+    int x1 = std::max(region.x, 1), x2 = std::min(region.x + region.width, lbpCodes.cols - 1);
+    int y1 = std::max(region.y, 1), y2 = std::min(region.y + region.height, lbpCodes.rows - 1);
+    uint32_t hist[FeatureStore::textureBins] = {};
+    for (int y = y1; y < y2; ++y) {
+        const uchar* codes = lbpCodes.ptr<uchar>(y);
+        for (int x = x1; x < x2; ++x) {
+            hist[codes[x]]++;
+        }
+    }
+    normalizeHistogram(hist, bins, out);
+}
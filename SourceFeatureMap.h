@@ -0,0 +1,52 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "FeatureStore.h"
+
+//карта признаков исходного изображения
+//строится один раз перед сопоставлением: заранее посчитанные плоскости позволяют получать признаки любой клетки
+//без повторного чтения ее пикселей (в т.ч. для перекрывающихся клеток); набор плоскостей задается маской FeatureKind,
+//метрики берут из карты то, что им нужно, и могут добавлять свои плоскости
+class SourceFeatureMap {
+private:
+    cv::Mat source;//исходное изображение (без копирования)
+    unsigned kinds = 0;//виды признаков, для которых построены плоскости
+    cv::Mat sum;//интегральное изображение сумм по каналам ((rows+1) x (cols+1), CV_32S или CV_64F)
+    cv::Mat sqsum;//интегральное изображение сумм квадратов по каналам (CV_64F)
+    cv::Mat gray;//изображение в оттенках серого (CV_8U)
+    cv::Mat gradientMagnitude;//величина градиента Собеля (CV_32F)
+    cv::Mat gradientBin;//бин направления градиента 0..35 (CV_8U)
+    cv::Mat lbpCodes;//LBP-коды пикселей (CV_8U); пиксели на границе изображения не имеют кода и не учитываются
+
+    //построение плоскостей величины и направления градиента по всему изображению
+    void buildGradientPlanes();
+    //построение плоскости LBP-кодов по всему изображению
+    void buildLBPPlane();
+
+    //сумма значений плоскости по прямоугольнику для каждого канала
+    static cv::Scalar rectSum(const cv::Mat& integral, const cv::Rect& region);
+
+public:
+    //построение плоскостей для видов признаков из маски
+    //FeatureColor - интегральное изображение сумм, FeatureStdDev - сумм и сумм квадратов,
+    //FeatureGradient - величина и бин направления градиента, FeatureTexture - LBP-коды
+    void build(const cv::Mat& image, unsigned mask);
+    //освобождение плоскостей
+    void clear();
+
+    //исходное изображение
+    const cv::Mat& image() const { return source; }
+    //проверка наличия плоскостей для всех видов из маски
+    bool has(unsigned mask) const { return (kinds & mask) == mask; }
+
+    //средний цвет области по каналам (как cv::mean), O(1)
+    cv::Scalar mean(const cv::Rect& region) const;
+    //стандартное отклонение области по каналам (как FeatureUtils::computeStdDev), O(1)
+    cv::Scalar stddev(const cv::Rect& region) const;
+    //нормированная гистограмма направлений градиентов области (FeatureStore::gradientBins значений)
+    //градиенты считаются по всему изображению, поэтому пиксели на краях клетки используют настоящих соседей
+    void gradientHistogram(const cv::Rect& region, float* out) const;
+    //нормированная гистограмма LBP-кодов области (FeatureStore::textureBins значений)
+    //учитываются все пиксели области, кроме пикселей на границе изображения
+    void textureHistogram(const cv::Rect& region, float* out) const;
+};
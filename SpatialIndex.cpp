@@ -0,0 +1,356 @@
+#include "SpatialIndex.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//класс VPTreeIndex
+//расстояние от запроса до тайла
+double VPTreeIndex::distanceTo(const double* query, int tileIndex) const {
+    return metric->vectorDistance(query, &points[static_cast<size_t>(tileIndex) * dim]);
+}
+
+//построение индекса по признакам тайлов
+void VPTreeIndex::build(const FeatureStore& tiles, const IMetric& metric) {
+    this->metric = &metric;
+    dim = metric.featureVectorSize();
+    int count = static_cast<int>(tiles.size());
+
+    //копируем векторы признаков в сплошной массив
+    points.assign(static_cast<size_t>(count) * dim, 0.0);
+    for (int i = 0; i < count; ++i) {
+        metric.getFeatureVector(tiles, i, &points[static_cast<size_t>(i) * dim]);
+    }
+
+    nodes.clear();
+    order.clear();
+    nodeOf.assign(count, -1);
+    alive.assign(count, 1);
+    if (count == 0) return;
+
+    std::vector<int> items(count);
+    for (int i = 0; i < count; ++i) items[i] = i;
+    nodes.reserve(2 * count / leafSize + 1);
+    buildNode(items, 0, count, -1);
+    recountAlive();
+}
+
+//рекурсивное построение поддерева
+//опорная точка - средний элемент диапазона, радиус - медиана расстояний до остальных точек
+int VPTreeIndex::buildNode(std::vector<int>& items, int begin, int end, int parent) {
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    nodes[nodeIndex].parent = parent;
+
+    //мало точек - лист
+    if (end - begin <= leafSize) {
+        nodes[nodeIndex].begin = static_cast<int>(order.size());
+        for (int i = begin; i < end; ++i) {
+            order.push_back(items[i]);
+            nodeOf[items[i]] = nodeIndex;
+        }
+        nodes[nodeIndex].end = static_cast<int>(order.size());
+        return nodeIndex;
+    }
+
+    std::swap(items[begin], items[begin + (end - begin) / 2]);
+    int vantage = items[begin];
+    nodeOf[vantage] = nodeIndex;
+
+    //расстояния остальных точек до опорной
+    std::vector<std::pair<double, int>> dists;
+    dists.reserve(end - begin - 1);
+    const double* vp = &points[static_cast<size_t>(vantage) * dim];
+    for (int i = begin + 1; i < end; ++i) {
+        dists.emplace_back(distanceTo(vp, items[i]), items[i]);
+    }
+    size_t median = dists.size() / 2;
+    std::nth_element(dists.begin(), dists.begin() + median, dists.end());
+    for (size_t i = 0; i < dists.size(); ++i) {
+        items[begin + 1 + i] = dists[i].second;
+    }
+
+    int middle = begin + 1 + static_cast<int>(median);
+    double radius = dists[median].first;
+    int inside = buildNode(items, begin + 1, middle, nodeIndex);
+    int outside = buildNode(items, middle, end, nodeIndex);
+
+    Node& node = nodes[nodeIndex];
+    node.vantage = vantage;
+    node.radius = radius;
+    node.inside = inside;
+    node.outside = outside;
+    return nodeIndex;
+}
+
+//пересчет счетчиков живых тайлов по всем узлам
+void VPTreeIndex::recountAlive() {
+    for (auto& node : nodes) node.alive = 0;
+    for (size_t i = 0; i < alive.size(); ++i) {
+        if (!alive[i]) continue;
+        for (int n = nodeOf[i]; n >= 0; n = nodes[n].parent) {
+            nodes[n].alive++;
+        }
+    }
+}
+
+//рекурсивный поиск k ближайших
+//best - максимальная куча пар (расстояние, индекс); поддеревья без живых тайлов и
+//поддеревья, которые по неравенству треугольника не могут содержать точку ближе текущей k-й, пропускаются
+void VPTreeIndex::search(int nodeIndex, const double* query, size_t k,
+    std::vector<std::pair<double, int>>& best) const {
+    if (nodeIndex < 0) return;
+    const Node& node = nodes[nodeIndex];
+    if (node.alive == 0) return;
+
+    auto consider = [&](int tileIndex, double dist) {
+        std::pair<double, int> candidate(dist, tileIndex);
+        if (best.size() < k) {
+            best.push_back(candidate);
+            std::push_heap(best.begin(), best.end());
+        }
+        else if (candidate < best.front()) {
+            std::pop_heap(best.begin(), best.end());
+            best.back() = candidate;
+            std::push_heap(best.begin(), best.end());
+        }
+    };
+    auto bound = [&]() {
+        return best.size() < k ? std::numeric_limits<double>::infinity() : best.front().first;
+    };
+
+    //лист: полный перебор
+    if (node.vantage < 0) {
+        for (int i = node.begin; i < node.end; ++i) {
+            int tileIndex = order[i];
+            if (alive[tileIndex]) {
+                consider(tileIndex, distanceTo(query, tileIndex));
+            }
+        }
+        return;
+    }
+
+    double dist = distanceTo(query, node.vantage);
+    if (alive[node.vantage]) {
+        consider(node.vantage, dist);
+    }
+    //небольшой допуск на погрешность округления, чтобы не потерять равные расстояния
+    double slack = 1e-9 * (1.0 + dist);
+    if (dist <= node.radius) {
+        search(node.inside, query, k, best);
+        if (dist + bound() + slack >= node.radius) {
+            search(node.outside, query, k, best);
+        }
+    }
+    else {
+        search(node.outside, query, k, best);
+        if (dist - bound() - slack <= node.radius) {
+            search(node.inside, query, k, best);
+        }
+    }
+}
+
+//ближайший неудаленный тайл
+int VPTreeIndex::nearest(const FeatureStore& cells, size_t cell) const {
+    std::vector<std::pair<double, int>> best;
+    knn(cells, cell, 1, best);
+    return best.empty() ? -1 : best.front().second;
+}
+
+//k ближайших неудаленных тайлов по возрастанию расстояния
+void VPTreeIndex::knn(const FeatureStore& cells, size_t cell, int k, std::vector<std::pair<double, int>>& result) const {
+    result.clear();
+    if (nodes.empty() || k <= 0) return;
+    std::vector<double> query(dim);
+    metric->getFeatureVector(cells, cell, query.data());
+    result.reserve(k);
+    search(0, query.data(), static_cast<size_t>(k), result);
+    std::sort_heap(result.begin(), result.end());
+}
+
+//пометка тайла как удаленного
+void VPTreeIndex::remove(int tileIndex) {
+    if (tileIndex < 0 || tileIndex >= static_cast<int>(alive.size()) || !alive[tileIndex]) return;
+    alive[tileIndex] = 0;
+    for (int n = nodeOf[tileIndex]; n >= 0; n = nodes[n].parent) {
+        nodes[n].alive--;
+    }
+}
+
+//восстановление всех удаленных тайлов
+void VPTreeIndex::reset() {
+    std::fill(alive.begin(), alive.end(), 1);
+    recountAlive();
+}
+
+//класс IVFIndex
+//построение: k-means по корням гистограмм (на подвыборке при большом числе тайлов),
+//затем каждый тайл относится к ближайшему центру
+void IVFIndex::build(const FeatureStore& tiles, const IMetric& metric) {
+    this->tiles = &tiles;
+    this->metric = &metric;
+    dim = metric.featureVectorSize();
+    int count = static_cast<int>(tiles.size());
+    lists.clear();
+    listOf.assign(count, 0);
+    alive.assign(count, 1);
+    firstAlive = 0;
+    if (count == 0 || dim == 0) {
+        listAlive.clear();
+        return;
+    }
+
+    //векторы признаков всех тайлов
+    cv::Mat points(count, dim, CV_32F);
+    std::vector<double> buffer(dim);
+    for (int i = 0; i < count; ++i) {
+        metric.getFeatureVector(tiles, i, buffer.data());
+        float* row = points.ptr<float>(i);
+        for (int d = 0; d < dim; ++d) row[d] = static_cast<float>(buffer[d]);
+    }
+
+    //кол-во кластеров ~ sqrt(N)
+    int listCount = std::max(1, static_cast<int>(std::lround(std::sqrt(static_cast<double>(count)))));
+    if (listCount == 1) {
+        centroids = cv::Mat::zeros(1, dim, CV_32F);
+    }
+    else {
+        //обучение на равномерной подвыборке (до 64 точек на кластер)
+        int sampleCount = std::min(count, listCount * 64);
+        cv::Mat samples(sampleCount, dim, CV_32F);
+        for (int i = 0; i < sampleCount; ++i) {
+            points.row(static_cast<int>(static_cast<int64_t>(i) * count / sampleCount)).copyTo(samples.row(i));
+        }
+        cv::Mat labels;
+        cv::kmeans(samples, listCount, labels,
+            cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, 1e-4),
+            1, cv::KMEANS_PP_CENTERS, centroids);
+    }
+
+    //распределение тайлов по ближайшим центрам
+    lists.assign(centroids.rows, std::vector<int>());
+    for (int i = 0; i < count; ++i) {
+        const float* p = points.ptr<float>(i);
+        int bestList = 0;
+        float bestDist = std::numeric_limits<float>::max();
+        for (int c = 0; c < centroids.rows; ++c) {
+            const float* center = centroids.ptr<float>(c);
+            float dist = 0.0f;
+            for (int d = 0; d < dim; ++d) {
+                float diff = p[d] - center[d];
+                dist += diff * diff;
+            }
+            if (dist < bestDist) {
+                bestDist = dist;
+                bestList = c;
+            }
+        }
+        listOf[i] = bestList;
+        lists[bestList].push_back(i);
+    }
+    listAlive.resize(lists.size());
+    reset();
+}
+
+//вектор признаков клетки
+bool IVFIndex::queryVector(const FeatureStore& cells, size_t cell, std::vector<float>& query) const {
+    std::vector<double> buffer(dim);
+    metric->getFeatureVector(cells, cell, buffer.data());
+    query.resize(dim);
+    bool nonZero = false;
+    for (int d = 0; d < dim; ++d) {
+        query[d] = static_cast<float>(buffer[d]);
+        if (buffer[d] != 0.0) nonZero = true;
+    }
+    return nonZero;
+}
+
+//кластеры в порядке возрастания расстояния до запроса
+std::vector<int> IVFIndex::probeOrder(const std::vector<float>& query) const {
+    std::vector<std::pair<float, int>> dists(centroids.rows);
+    for (int c = 0; c < centroids.rows; ++c) {
+        const float* center = centroids.ptr<float>(c);
+        float dist = 0.0f;
+        for (int d = 0; d < dim; ++d) {
+            float diff = query[d] - center[d];
+            dist += diff * diff;
+        }
+        dists[c] = { dist, c };
+    }
+    std::sort(dists.begin(), dists.end());
+    std::vector<int> order(dists.size());
+    for (size_t i = 0; i < dists.size(); ++i) order[i] = dists[i].second;
+    return order;
+}
+
+//ближайший неудаленный тайл (приближенно)
+int IVFIndex::nearest(const FeatureStore& cells, size_t cell) const {
+    std::vector<std::pair<double, int>> best;
+    knn(cells, cell, 1, best);
+    return best.empty() ? -1 : best.front().second;
+}
+
+//k ближайших неудаленных тайлов (приближенно)
+//просматриваются probes ближайших кластеров; если в них меньше k живых тайлов, поиск продолжается по следующим
+void IVFIndex::knn(const FeatureStore& cells, size_t cell, int k, std::vector<std::pair<double, int>>& result) const {
+    result.clear();
+    if (lists.empty() || k <= 0 || firstAlive >= static_cast<int>(alive.size())) return;
+
+    //нулевая гистограмма клетки (однотонная область) равноудалена от всех тайлов,
+    //как и при полном переборе выбираются тайлы с наименьшими индексами
+    std::vector<float> query;
+    if (!queryVector(cells, cell, query)) {
+        for (int i = firstAlive; i < static_cast<int>(alive.size()) && static_cast<int>(result.size()) < k; ++i) {
+            if (alive[i]) result.emplace_back(metric->distance(cells, cell, *tiles, i), i);
+        }
+        return;
+    }
+
+    std::vector<int> order = probeOrder(query);
+    int probed = 0;
+    for (int list : order) {
+        if (probed >= probes && static_cast<int>(result.size()) >= k) break;
+        if (listAlive[list] == 0) continue;
+        probed++;
+        for (int tileIndex : lists[list]) {
+            if (!alive[tileIndex]) continue;
+            result.emplace_back(metric->distance(cells, cell, *tiles, tileIndex), tileIndex);
+        }
+    }
+    size_t keep = std::min(result.size(), static_cast<size_t>(k));
+    std::partial_sort(result.begin(), result.begin() + keep, result.end());
+    result.resize(keep);
+}
+
+//пометка тайла как удаленного
+void IVFIndex::remove(int tileIndex) {
+    if (tileIndex < 0 || tileIndex >= static_cast<int>(alive.size()) || !alive[tileIndex]) return;
+    alive[tileIndex] = 0;
+    listAlive[listOf[tileIndex]]--;
+    while (firstAlive < static_cast<int>(alive.size()) && !alive[firstAlive]) {
+        firstAlive++;
+    }
+}
+
+//восстановление всех удаленных тайлов
+void IVFIndex::reset() {
+    std::fill(alive.begin(), alive.end(), 1);
+    for (size_t c = 0; c < lists.size(); ++c) {
+        listAlive[c] = static_cast<int>(lists[c].size());
+    }
+    firstAlive = 0;
+}
+
+//создание индекса, подходящего для метрики
+std::unique_ptr<ITileIndex> createTileIndex(const IMetric& metric, bool approximate, int probes) {
+    int dim = metric.featureVectorSize();
+    if (dim <= 0) {
+        return nullptr;
+    }
+    if (dim <= VPTreeIndex::maxDimension) {
+        return std::make_unique<VPTreeIndex>();
+    }
+    if (approximate) {
+        return std::make_unique<IVFIndex>(probes);
+    }
+    return nullptr;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "MosaicProcessor.h"
+
+//родительский класс индексов поиска ближайшего тайла
+//индекс строится один раз по признакам тайлов; израсходованные тайлы помечаются удаленными без перестройки
+class ITileIndex {
+public:
+    virtual ~ITileIndex() = default;
+    //построение индекса по признакам тайлов текущей метрики
+    virtual void build(const FeatureStore& tiles, const IMetric& metric) = 0;
+    //индекс ближайшего неудаленного тайла для клетки (-1, если все тайлы удалены)
+    //при равных расстояниях выбирается тайл с меньшим индексом, как при линейном проходе
+    virtual int nearest(const FeatureStore& cells, size_t cell) const = 0;
+    //k ближайших неудаленных тайлов (расстояние, индекс) по возрастанию расстояния
+    virtual void knn(const FeatureStore& cells, size_t cell, int k, std::vector<std::pair<double, int>>& result) const = 0;
+    //пометка тайла как удаленного (израсходован лимит повторов)
+    virtual void remove(int tileIndex) = 0;
+    //восстановление всех удаленных тайлов
+    virtual void reset() = 0;
+    //кол-во тайлов в индексе
+    virtual size_t size() const = 0;
+};
+
+//VP-дерево (дерево опорных точек) для метрик с вектором признаков
+//работает с любым расстоянием, удовлетворяющим неравенству треугольника,
+//поэтому подходит и для цвета (L2), и для цвета+контраста (сумма двух L2)
+class VPTreeIndex : public ITileIndex {
+private:
+    //узел дерева: опорная точка и радиус разбиения, либо лист со списком точек
+    struct Node {
+        int vantage = -1;//индекс опорного тайла (-1 для листа)
+        double radius = 0.0;//медианное расстояние до опорной точки
+        int inside = -1;//поддерево точек с расстоянием <= radius
+        int outside = -1;//поддерево точек с расстоянием >= radius
+        int begin = 0, end = 0;//диапазон точек листа в order
+        int parent = -1;//родительский узел
+        int alive = 0;//кол-во неудаленных тайлов в поддереве
+    };
+
+    static constexpr int leafSize = 8;//максимальное кол-во точек в листе
+
+    const IMetric* metric = nullptr;//метрика, задающая расстояние между векторами
+    int dim = 0;//размер вектора признаков
+    std::vector<double> points;//векторы признаков тайлов подряд (size * dim)
+    std::vector<Node> nodes;//узлы дерева, nodes[0] - корень
+    std::vector<int> order;//индексы тайлов листьев
+    std::vector<int> nodeOf;//узел, содержащий тайл
+    std::vector<char> alive;//флаги неудаленных тайлов
+
+    //расстояние от запроса до тайла
+    double distanceTo(const double* query, int tileIndex) const;
+    //рекурсивное построение поддерева по диапазону items
+    int buildNode(std::vector<int>& items, int begin, int end, int parent);
+    //пересчет счетчиков живых тайлов
+    void recountAlive();
+    //рекурсивный поиск k ближайших с максимальной кучей best
+    void search(int nodeIndex, const double* query, size_t k,
+        std::vector<std::pair<double, int>>& best) const;
+
+public:
+    static constexpr int maxDimension = 16;//размерность, выше которой дерево вырождается в полный перебор
+
+    void build(const FeatureStore& tiles, const IMetric& metric) override;
+    int nearest(const FeatureStore& cells, size_t cell) const override;
+    void knn(const FeatureStore& cells, size_t cell, int k, std::vector<std::pair<double, int>>& result) const override;
+    void remove(int tileIndex) override;
+    void reset() override;
+    size_t size() const override { return alive.size(); }
+};
+
+//инвертированный файл (IVF) для приближенного поиска по гистограммным метрикам
+//векторы признаков (корни из бинов гистограмм) разбиваются k-means на кластеры; запрос просматривает
+//только probes ближайших кластеров и переранжирует найденные тайлы точным расстоянием метрики
+class IVFIndex : public ITileIndex {
+private:
+    const FeatureStore* tiles = nullptr;//признаки тайлов генератора (для точного переранжирования)
+    const IMetric* metric = nullptr;//метрика сравнения
+    int dim = 0;//размер вектора признаков
+    int probes = 8;//кол-во просматриваемых кластеров
+    cv::Mat centroids;//центры кластеров (nlist x dim, CV_32F)
+    std::vector<std::vector<int>> lists;//индексы тайлов каждого кластера по возрастанию
+    std::vector<int> listOf;//кластер каждого тайла
+    std::vector<int> listAlive;//кол-во неудаленных тайлов в кластере
+    std::vector<char> alive;//флаги неудаленных тайлов
+    int firstAlive = 0;//наименьший индекс неудаленного тайла
+
+    //вектор признаков клетки в float, false если гистограмма клетки нулевая
+    bool queryVector(const FeatureStore& cells, size_t cell, std::vector<float>& query) const;
+    //кластеры в порядке возрастания расстояния от центра до запроса
+    std::vector<int> probeOrder(const std::vector<float>& query) const;
+
+public:
+    explicit IVFIndex(int probes = 8) : probes(std::max(1, probes)) {}
+
+    //кол-во просматриваемых кластеров (точность/скорость)
+    void setProbes(int value) { probes = std::max(1, value); }
+    //кол-во кластеров
+    int listCount() const { return static_cast<int>(lists.size()); }
+
+    void build(const FeatureStore& tiles, const IMetric& metric) override;
+    int nearest(const FeatureStore& cells, size_t cell) const override;
+    void knn(const FeatureStore& cells, size_t cell, int k, std::vector<std::pair<double, int>>& result) const override;
+    void remove(int tileIndex) override;
+    void reset() override;
+    size_t size() const override { return alive.size(); }
+};
+
+//создание индекса, подходящего для метрики (nullptr - поиск линейным проходом)
+//метрики с коротким вектором признаков получают точное VP-дерево, гистограммные метрики -
+//приближенный IVF, если он включен в настройках
+std::unique_ptr<ITileIndex> createTileIndex(const IMetric& metric, bool approximate = false, int probes = 8);
@@ -0,0 +1,104 @@
+#include "TileAssignment.h"
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+namespace {
+
+//порядок мин-кучи мест по цене
+bool slotAfter(const std::pair<double, int>& a, const std::pair<double, int>& b) {
+    return a.first > b.first;
+}
+
+}
+
+//класс AuctionAssignment
+//аукцион Берцекаса с копиями объектов: тайл с емкостью capacity - capacity одинаковых мест,
+//клетка ставит на самое дешевое место выбранного тайла и вытесняет его владельца;
+//ставка = разница между лучшим и вторым вариантом + epsilon (второй вариант может быть другим местом
+//того же тайла); цены стартуют с нуля, поэтому места, на которые никто не ставил, остаются бесплатными
+//и итог отличается от оптимума не более чем на epsilon на клетку; epsilon задается долей стоимости
+//запасного варианта, что ограничивает длину "ценовых войн" за место примерно 1/relativeEpsilon ставками
+//(масштабирование epsilon с сохранением цен здесь не применяется: при числе мест больше числа клеток
+//оно требует обратного аукциона, а ограничение ставок и так ограничивает время)
+std::vector<int> AuctionAssignment::solve(const CandidateLists& candidates, size_t tileCount, int capacity, double fallbackCost) {
+    const size_t cellCount = candidates.size();
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<int> result(cellCount, -1);
+    bidCount = 0;
+    complete = true;
+    if (cellCount == 0 || capacity <= 0) return result;
+
+    //занятые места тайлов: мин-куча пар (цена, клетка-владелец)
+    std::vector<std::vector<std::pair<double, int>>> heaps(tileCount);
+    //цена самого дешевого и второго по дешевизне места тайла (свободное место бесплатно)
+    auto minPrice = [&](int tile) {
+        const auto& heap = heaps[tile];
+        return static_cast<int>(heap.size()) < capacity ? 0.0 : heap.front().first;
+    };
+    auto secondMinPrice = [&](int tile) {
+        const auto& heap = heaps[tile];
+        int used = static_cast<int>(heap.size());
+        if (capacity < 2) return infinity;
+        if (used + 2 <= capacity) return 0.0;
+        if (used + 1 == capacity) return heap.front().first;
+        double second = heap[1].first;
+        if (used > 2) second = std::min(second, heap[2].first);
+        return second;
+    };
+
+    const double epsilon = relativeEpsilon * fallbackCost;
+    const size_t bidBudget = bidsPerCell * cellCount;
+    std::deque<int> queue;
+    for (size_t cell = 0; cell < cellCount; ++cell) queue.push_back(static_cast<int>(cell));
+
+    while (!queue.empty()) {
+        if (bidCount >= bidBudget) {
+            complete = false;
+            break;
+        }
+        int cell = queue.front();
+        queue.pop_front();
+
+        //лучший и второй по выгоде вариант (выгода = -стоимость - цена), запасной вариант бесплатен
+        int best = -1;
+        double bestCost = fallbackCost;
+        double first = -fallbackCost;
+        double second = -infinity;
+        const auto* list = candidates.of(cell);
+        for (int j = 0; j < candidates.counts[cell]; ++j) {
+            int tile = list[j].second;
+            double value = -list[j].first - minPrice(tile);
+            if (value > first) {
+                second = std::max({ second, first, -list[j].first - secondMinPrice(tile) });
+                first = value;
+                best = tile;
+                bestCost = list[j].first;
+            }
+            else {
+                second = std::max(second, value);
+            }
+        }
+        //запасной вариант не ограничен по емкости и ставки не требует
+        if (best == -1) {
+            result[cell] = -1;
+            continue;
+        }
+
+        //ставка на самое дешевое место тайла: новая цена оставляет клетке выгоду second - epsilon
+        double bid = -bestCost - second + epsilon;
+        auto& heap = heaps[best];
+        if (static_cast<int>(heap.size()) == capacity) {
+            std::pop_heap(heap.begin(), heap.end(), slotAfter);
+            int evicted = heap.back().second;
+            result[evicted] = -1;
+            queue.push_back(evicted);
+            heap.pop_back();
+        }
+        heap.emplace_back(bid, cell);
+        std::push_heap(heap.begin(), heap.end(), slotAfter);
+        result[cell] = best;
+        bidCount++;
+    }
+    return result;
+}
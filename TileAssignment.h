@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "MosaicProcessor.h"
+
+//глобальное назначение тайлов клеткам аукционным алгоритмом (минимум суммарного расстояния)
+//клетка выбирает тайл из своего списка кандидатов; у тайла capacity мест (лимит повторов),
+//у каждой клетки есть запасной вариант "без тайла" со стоимостью fallbackCost и неограниченной емкостью,
+//поэтому аукцион всегда завершается
+class AuctionAssignment {
+private:
+    double relativeEpsilon;//шаг ставки в долях fallbackCost: решение отличается от оптимума не более чем на шаг на клетку
+    size_t bidsPerCell;//ограничение кол-ва ставок на клетку (ограничивает время решения)
+    size_t bidCount = 0;//кол-во ставок последнего решения
+    bool complete = true;//последнее решение завершилось без ограничения ставок
+
+public:
+    explicit AuctionAssignment(double relativeEpsilon = 1e-3, size_t bidsPerCell = 1000)
+        : relativeEpsilon(relativeEpsilon), bidsPerCell(bidsPerCell) {}
+
+    //решение задачи: индекс тайла для каждой клетки, -1 - клетке достался запасной вариант
+    //(или решение остановлено ограничением ставок до ее назначения)
+    std::vector<int> solve(const CandidateLists& candidates, size_t tileCount, int capacity, double fallbackCost);
+
+    //кол-во ставок последнего решения
+    size_t getBidCount() const { return bidCount; }
+    //последнее решение завершилось без ограничения ставок
+    bool isComplete() const { return complete; }
+};
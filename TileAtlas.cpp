@@ -0,0 +1,48 @@
+#include "TileAtlas.h"
+#include <algorithm>
+#include <cstring>
+
+//класс TileAtlas
+//место ищется в последнем блоке того же формата (формат тайлов при загрузке почти всегда один)
+cv::Mat TileAtlas::add(const cv::Mat& image) {
+    if (image.empty()) return cv::Mat();
+    Chunk* chunk = nullptr;
+    size_t sameFormat = 0;
+    for (auto& candidate : chunks) {
+        if (candidate.tileSize != image.size() || candidate.type != image.type()) continue;
+        sameFormat++;
+        if (candidate.used < candidate.capacity) chunk = &candidate;
+    }
+    if (!chunk) {
+        Chunk created;
+        created.tileSize = image.size();
+        created.type = image.type();
+        created.capacity = std::min(tilesPerChunk, static_cast<size_t>(64) << std::min<size_t>(sameFormat, 16));
+        created.pixels.create(static_cast<int>(created.capacity) * image.rows, image.cols, image.type());
+        chunks.push_back(std::move(created));
+        chunk = &chunks.back();
+    }
+
+    int firstRow = static_cast<int>(chunk->used) * image.rows;
+    const size_t rowBytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        std::memcpy(chunk->pixels.ptr<uchar>(firstRow + y), image.ptr<uchar>(y), rowBytes);
+    }
+    chunk->used++;
+    tileCount++;
+    //заголовок на строки тайла без счетчика ссылок (строки блока идут подряд, поэтому тайл непрерывен)
+    return cv::Mat(image.rows, image.cols, image.type(), chunk->pixels.ptr<uchar>(firstRow), rowBytes);
+}
+
+void TileAtlas::clear() {
+    chunks.clear();
+    tileCount = 0;
+}
+
+size_t TileAtlas::getMemoryBytes() const {
+    size_t bytes = 0;
+    for (const auto& chunk : chunks) {
+        bytes += chunk.pixels.total() * chunk.pixels.elemSize();
+    }
+    return bytes;
+}
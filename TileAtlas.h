@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+//хранилище пикселей тайлов в нескольких больших блоках (арена)
+//изображение тайла копируется в свободное место блока, тайл получает заголовок cv::Mat на эту память без владения
+//(без своего буфера и счетчика ссылок), поэтому атлас должен жить дольше заголовков; блок хранит тайлы одного
+//размера и типа подряд по строкам, емкость новых блоков растет вдвое до tilesPerChunk
+class TileAtlas {
+private:
+    //блок атласа
+    struct Chunk {
+        cv::Mat pixels;//тайлы подряд по строкам (capacity * height x width)
+        cv::Size tileSize;//размер тайлов блока
+        int type = -1;//тип тайлов блока
+        size_t capacity = 0;//кол-во мест
+        size_t used = 0;//кол-во занятых мест
+    };
+
+    size_t tilesPerChunk;//максимальная емкость блока
+    std::vector<Chunk> chunks;//блоки атласа
+    size_t tileCount = 0;//кол-во тайлов в атласе
+
+public:
+    explicit TileAtlas(size_t tilesPerChunk = 1024) : tilesPerChunk(tilesPerChunk) {}
+
+    //копирование изображения в атлас, возвращает заголовок без владения памятью атласа
+    cv::Mat add(const cv::Mat& image);
+    //освобождение всех блоков (заголовки, выданные add, становятся недействительными)
+    void clear();
+
+    //кол-во тайлов в атласе
+    size_t size() const { return tileCount; }
+    //кол-во блоков
+    size_t getChunkCount() const { return chunks.size(); }
+    //память блоков в байтах (включая свободные места)
+    size_t getMemoryBytes() const;
+};
@@ -0,0 +1,268 @@
+#include "TileCache.h"
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+//вспомогательные функции бинарного чтения/записи
+namespace {
+
+template <typename T>
+void writeValue(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::ifstream& in, T& value) {
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return static_cast<bool>(in);
+}
+
+void writeString(std::ofstream& out, const std::string& str) {
+    writeValue(out, static_cast<uint32_t>(str.size()));
+    out.write(str.data(), str.size());
+}
+
+bool readString(std::ifstream& in, std::string& str) {
+    uint32_t length = 0;
+    if (!readValue(in, length) || length > 4096) return false;
+    str.resize(length);
+    in.read(&str[0], length);
+    return static_cast<bool>(in);
+}
+
+//копирование видов из маски между строками хранилищ (остальные виды строки назначения не меняются)
+void copyKinds(const FeatureStore& source, size_t sourceRow, FeatureStore& target, size_t row, unsigned mask) {
+    for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+        if (!(mask & bit)) continue;
+        FeatureKind kind = static_cast<FeatureKind>(bit);
+        std::memcpy(target.data(kind, row), source.data(kind, sourceRow), FeatureStore::strideOf(kind) * sizeof(float));
+    }
+}
+
+//признаки строки записываются по видам из маски, без выравнивающих нулей
+void writeFeatures(std::ofstream& out, const FeatureStore& store, size_t row, unsigned mask) {
+    for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+        if (!(mask & bit)) continue;
+        FeatureKind kind = static_cast<FeatureKind>(bit);
+        out.write(reinterpret_cast<const char*>(store.data(kind, row)), FeatureStore::sizeOf(kind) * sizeof(float));
+    }
+}
+
+bool readFeatures(std::ifstream& in, FeatureStore& store, size_t row, unsigned mask) {
+    for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+        if (!(mask & bit)) continue;
+        FeatureKind kind = static_cast<FeatureKind>(bit);
+        in.read(reinterpret_cast<char*>(store.data(kind, row)), FeatureStore::sizeOf(kind) * sizeof(float));
+        if (!in) return false;
+    }
+    return true;
+}
+
+//матрица записывается как заголовок (строки, столбцы, тип) и сплошной блок данных
+void writeMat(std::ofstream& out, const cv::Mat& mat) {
+    cv::Mat data = mat.isContinuous() ? mat : mat.clone();
+    writeValue(out, static_cast<int32_t>(data.rows));
+    writeValue(out, static_cast<int32_t>(data.cols));
+    writeValue(out, static_cast<int32_t>(data.type()));
+    if (!data.empty()) {
+        out.write(reinterpret_cast<const char*>(data.data), data.total() * data.elemSize());
+    }
+}
+
+//матрица читается, только если ее размер size x size и тип type совпадают с ожидаемыми
+//(проверка до выделения памяти: поврежденный заголовок не приводит к огромному выделению)
+bool readMat(std::ifstream& in, cv::Mat& mat, int size, int type) {
+    int32_t rows = 0, cols = 0, fileType = 0;
+    if (!readValue(in, rows) || !readValue(in, cols) || !readValue(in, fileType)) return false;
+    if (rows != size || cols != size || fileType != type) return false;
+    mat.create(rows, cols, type);
+    in.read(reinterpret_cast<char*>(mat.data), mat.total() * mat.elemSize());
+    return static_cast<bool>(in);
+}
+
+}
+
+//структура FileStamp
+//получение отметки для файла (ошибки файловой системы дают невалидную отметку)
+FileStamp FileStamp::of(const fs::path& file) {
+    FileStamp stamp;
+    std::error_code ec;
+    auto time = fs::last_write_time(file, ec);
+    if (ec) return stamp;
+    auto size = fs::file_size(file, ec);
+    if (ec) return stamp;
+    stamp.mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    stamp.fileSize = static_cast<uint64_t>(size);
+    stamp.valid = true;
+    return stamp;
+}
+
+//класс TileCache
+TileCache::TileCache(const fs::path& folder, int tileSize, int angle)
+    : cacheFile(cachePathFor(folder)), tileSize(tileSize), angle(angle) {}
+
+//файл кэша кладется рядом с папкой: <родитель>/<имя папки>.mosaiccache
+fs::path TileCache::cachePathFor(const fs::path& folder) {
+    fs::path dir = folder;
+    if (!dir.has_filename()) {
+        dir = dir.parent_path();
+    }
+    return dir.parent_path() / (dir.filename().string() + ".mosaiccache");
+}
+
+//чтение кэша с диска
+//ошибка чтения (в т.ч. нехватка памяти) не мешает загрузке тайлов: кэш считается устаревшим и перезаписывается
+bool TileCache::load() {
+    try {
+        return readFile();
+    }
+    catch (const std::exception&) {
+        entries.clear();
+        features.clear();
+        dirty = true;
+        return false;
+    }
+}
+
+bool TileCache::readFile() {
+    entries.clear();
+    features.resize(0);
+    std::ifstream in(cacheFile, std::ios::binary);
+    if (!in) return false;
+
+    //проверка заголовка: при несовпадении весь кэш считается устаревшим
+    uint32_t fileMagic = 0, fileVersion = 0;
+    int32_t fileTileSize = 0, fileAngle = 0;
+    uint64_t count = 0;
+    if (!readValue(in, fileMagic) || fileMagic != magic ||
+        !readValue(in, fileVersion) || fileVersion != version ||
+        !readValue(in, fileTileSize) || fileTileSize != tileSize ||
+        !readValue(in, fileAngle) || fileAngle != angle ||
+        !readValue(in, count)) {
+        dirty = true;
+        return false;
+    }
+
+    //чтение записей; поврежденный хвост файла отбрасывается
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string name;
+        Entry entry;
+        uint32_t kinds = 0;
+        entry.row = features.addRow();
+        bool valid = readString(in, name) &&
+            readValue(in, entry.stamp.mtime) &&
+            readValue(in, entry.stamp.fileSize) &&
+            readMat(in, entry.tile.image, tileSize, CV_8UC3) &&
+            readValue(in, kinds) && (kinds & ~FeatureAll) == 0;
+        if (valid) {
+            features.require(kinds);
+            valid = readFeatures(in, features, entry.row, kinds);
+        }
+        if (!valid) {
+            features.resize(entry.row);
+            dirty = true;
+            break;
+        }
+        entry.kinds = kinds;
+        entry.stamp.valid = true;
+        entry.tile.angle = angle;
+        entries[name] = std::move(entry);
+    }
+    return true;
+}
+
+//запись кэша на диск
+//сохраняются только записи, затребованные при последней загрузке (удаленные файлы выпадают из кэша)
+bool TileCache::save() {
+    for (const auto& [name, entry] : entries) {
+        if (!entry.used) {
+            dirty = true;
+            break;
+        }
+    }
+    if (!dirty) return true;
+
+    //запись во временный файл с последующим переименованием, чтобы не оставить поврежденный кэш
+    fs::path tempFile = cacheFile;
+    tempFile += ".tmp";
+    {
+        std::ofstream out(tempFile, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+
+        uint64_t count = 0;
+        for (const auto& [name, entry] : entries) {
+            if (entry.used) count++;
+        }
+        writeValue(out, magic);
+        writeValue(out, version);
+        writeValue(out, static_cast<int32_t>(tileSize));
+        writeValue(out, static_cast<int32_t>(angle));
+        writeValue(out, count);
+
+        for (const auto& [name, entry] : entries) {
+            if (!entry.used) continue;
+            writeString(out, name);
+            writeValue(out, entry.stamp.mtime);
+            writeValue(out, entry.stamp.fileSize);
+            writeMat(out, entry.tile.image);
+            writeValue(out, static_cast<uint32_t>(entry.kinds));
+            writeFeatures(out, features, entry.row, entry.kinds);
+        }
+        if (!out) return false;
+    }
+
+    std::error_code ec;
+    fs::rename(tempFile, cacheFile, ec);
+    if (ec) {
+        fs::remove(tempFile, ec);
+        return false;
+    }
+    dirty = false;
+    return true;
+}
+
+//поиск актуальной записи для файла
+bool TileCache::find(const fs::path& file, const FileStamp& stamp, Tile& tile, FeatureStore& store, size_t row, unsigned& kinds) {
+    if (!stamp.valid) return false;
+    auto it = entries.find(file.filename().string());
+    if (it == entries.end()) return false;
+
+    Entry& entry = it->second;
+    if (entry.stamp.mtime != stamp.mtime || entry.stamp.fileSize != stamp.fileSize) {
+        return false;
+    }
+    entry.used = true;
+    tile = entry.tile;
+    kinds = entry.kinds & store.allocatedKinds();
+    copyKinds(features, entry.row, store, row, kinds);
+    return true;
+}
+
+//добавление записи для файла или дополнение ее новыми видами признаков
+void TileCache::store(const fs::path& file, const FileStamp& stamp, const Tile& tile, const FeatureStore& store, size_t row, unsigned kinds) {
+    if (!stamp.valid) return;
+    auto [it, inserted] = entries.try_emplace(file.filename().string());
+    Entry& entry = it->second;
+    if (inserted) {
+        entry.row = features.addRow();
+    }
+    //файл изменился - прежние виды признаков относятся к старой версии и отбрасываются
+    if (entry.stamp.mtime != stamp.mtime || entry.stamp.fileSize != stamp.fileSize) {
+        entry.kinds = 0;
+    }
+    entry.stamp = stamp;
+    entry.tile = tile;
+    entry.tile.usage = 0;
+    entry.used = true;
+    features.require(kinds);
+    copyKinds(store, row, features, entry.row, kinds);
+    entry.kinds |= kinds;
+    dirty = true;
+}
+
+//замена изображения записи заголовком на общие пиксели
+void TileCache::share(const fs::path& file, const cv::Mat& image) {
+    auto it = entries.find(file.filename().string());
+    if (it == entries.end()) return;
+    it->second.tile.image = image;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <filesystem>
+#include <opencv2/opencv.hpp>
+#include "MosaicProcessor.h"
+
+namespace fs = std::filesystem;
+
+//отметка состояния файла тайла (время изменения и размер)
+//по ней определяется, устарела ли запись кэша
+struct FileStamp {
+    int64_t mtime = 0;//время последнего изменения файла
+    uint64_t fileSize = 0;//размер файла в байтах
+    bool valid = false;//удалось ли получить отметку
+
+    //получение отметки для файла
+    static FileStamp of(const fs::path& file);
+};
+
+//класс дискового кэша признаков тайлов
+//хранит уменьшенные изображения тайлов и их признаки в одном бинарном файле рядом с папкой тайлов,
+//ключ записи - имя файла; запись сбрасывается при изменении времени модификации или размера файла,
+//весь кэш сбрасывается при смене версии формата, размера тайла или угла поворота.
+//признаки вида не зависят от метрики, поэтому запись хранит маску посчитанных видов: загрузка с другой метрикой
+//берет из кэша изображение и имеющиеся виды, досчитывает недостающие и дописывает их в ту же запись
+class TileCache {
+private:
+    //запись кэша для одного файла
+    struct Entry {
+        FileStamp stamp;//отметка файла на момент записи
+        Tile tile;//изображение тайла
+        size_t row = 0;//строка признаков тайла в features
+        unsigned kinds = 0;//посчитанные виды признаков
+        bool used = false;//запись затребована в текущем проходе
+    };
+
+    fs::path cacheFile;//путь к файлу кэша
+    int tileSize;//размер тайла
+    int angle;//угол поворота тайла
+    std::unordered_map<std::string, Entry> entries;//записи по имени файла
+    FeatureStore features;//признаки тайлов всех записей (выделены виды, встречающиеся в записях)
+    bool dirty = false;//кэш изменился и требует сохранения
+
+    //чтение записей файла кэша (может бросить исключение, load его перехватывает)
+    bool readFile();
+
+public:
+    static constexpr uint32_t magic = 0x43534F4D;//сигнатура файла "MOSC"
+    static constexpr uint32_t version = 3;//версия формата файла
+
+    TileCache(const fs::path& folder, int tileSize, int angle);
+
+    //путь к файлу кэша для папки тайлов (файл лежит рядом с папкой)
+    static fs::path cachePathFor(const fs::path& folder);
+
+    //чтение кэша с диска, false если файла нет, он не подходит или поврежден (записи тайлов - только 8UC3 размера тайла)
+    bool load();
+    //запись кэша на диск (только затребованные записи), false при ошибке записи
+    bool save();
+
+    //поиск актуальной записи для файла: тайл и имеющиеся у записи признаки копируются в tile и строку row
+    //хранилища store, в kinds - виды признаков записи; false если записи нет или она устарела
+    bool find(const fs::path& file, const FileStamp& stamp, Tile& tile, FeatureStore& store, size_t row, unsigned& kinds);
+    //добавление записи для файла или дополнение ее видами kinds (признаки берутся из строки row хранилища store);
+    //виды, посчитанные раньше для той же версии файла, сохраняются
+    void store(const fs::path& file, const FileStamp& stamp, const Tile& tile, const FeatureStore& store, size_t row, unsigned kinds);
+    //замена изображения записи заголовком на те же пиксели в другом хранилище (атласе тайлов):
+    //собственный буфер записи освобождается, пиксели не хранятся дважды; содержимое кэша не меняется
+    void share(const fs::path& file, const cv::Mat& image);
+
+    //кол-во записей в кэше
+    size_t size() const { return entries.size(); }
+};
@@ -0,0 +1,189 @@
+#include "TileLibrary.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//класс MappedFile
+bool MappedFile::open(const fs::path& path) {
+    close();
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(handle);
+        return false;
+    }
+    HANDLE view = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!view) {
+        CloseHandle(handle);
+        return false;
+    }
+    void* address = MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+    if (!address) {
+        CloseHandle(view);
+        CloseHandle(handle);
+        return false;
+    }
+    file = handle;
+    mapping = view;
+    bytes = static_cast<const uchar*>(address);
+    length = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    descriptor = fd;
+    bytes = static_cast<const uchar*>(address);
+    length = static_cast<size_t>(info.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+    if (!bytes) return;
+#ifdef _WIN32
+    UnmapViewOfFile(bytes);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    mapping = nullptr;
+    file = nullptr;
+#else
+    munmap(const_cast<uchar*>(bytes), length);
+    ::close(descriptor);
+    descriptor = -1;
+#endif
+    bytes = nullptr;
+    length = 0;
+}
+
+//класс TileLibraryWriter
+bool TileLibraryWriter::open(const fs::path& path, int tileSize, int angle, const std::string& metricName, unsigned featureMask) {
+    this->path = path;
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    header = TileLibraryHeader();
+    header.magic = TileLibrary::magic;
+    header.version = TileLibrary::version;
+    header.tileSize = tileSize;
+    header.angle = angle;
+    header.featureMask = featureMask;
+    header.pixelOffset = TileLibrary::pageAlignment;
+    std::strncpy(header.metric, metricName.c_str(), sizeof(header.metric) - 1);
+    features.clear();
+    features.require(featureMask);
+
+    //заглушка заголовка и выравнивание начала изображений до границы страницы
+    std::vector<char> padding(TileLibrary::pageAlignment, 0);
+    out.write(padding.data(), padding.size());
+    return static_cast<bool>(out);
+}
+
+bool TileLibraryWriter::add(const cv::Mat& image, const FeatureStore& store, size_t row) {
+    if (image.type() != CV_8UC3 || image.rows != header.tileSize || image.cols != header.tileSize) return false;
+    const size_t rowBytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        out.write(reinterpret_cast<const char*>(image.ptr<uchar>(y)), rowBytes);
+    }
+    features.copyRow(store, row, features.addRow());
+    header.tileCount++;
+    return static_cast<bool>(out);
+}
+
+//таблица признаков: по видам из маски, все тайлы подряд без выравнивающих нулей
+bool TileLibraryWriter::finish() {
+    header.featureOffset = header.pixelOffset + header.tileCount * header.tileSize * header.tileSize * 3;
+    for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+        if (!(header.featureMask & bit)) continue;
+        FeatureKind kind = static_cast<FeatureKind>(bit);
+        for (size_t i = 0; i < features.size(); ++i) {
+            out.write(reinterpret_cast<const char*>(features.data(kind, i)), FeatureStore::sizeOf(kind) * sizeof(float));
+        }
+    }
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    return !out.fail();
+}
+
+void TileLibraryWriter::discard() {
+    if (out.is_open()) out.close();
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+//класс TileLibrary
+//проверяются сигнатура, версия и то, что изображения и таблица признаков целиком лежат в файле
+bool TileLibrary::open(const fs::path& path) {
+    close();
+    if (!file.open(path)) return false;
+    if (file.size() < sizeof(TileLibraryHeader)) {
+        close();
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    uint64_t tileBytes = static_cast<uint64_t>(header.tileSize) * header.tileSize * 3;
+    uint64_t featureBytes = 0;
+    for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+        if (header.featureMask & bit) featureBytes += FeatureStore::sizeOf(static_cast<FeatureKind>(bit)) * sizeof(float);
+    }
+    bool valid = header.magic == magic && header.version == version &&
+        header.tileSize > 0 && header.tileSize <= 4096 && (header.featureMask & ~FeatureAll) == 0 &&
+        header.pixelOffset >= sizeof(TileLibraryHeader) && header.pixelOffset <= file.size() &&
+        header.tileCount <= (file.size() - header.pixelOffset) / tileBytes &&
+        header.featureOffset == header.pixelOffset + header.tileCount * tileBytes &&
+        header.tileCount * featureBytes <= file.size() - header.featureOffset;
+    if (!valid) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TileLibrary::close() {
+    file.close();
+    header = TileLibraryHeader();
+}
+
+std::string TileLibrary::metricName() const {
+    return std::string(header.metric, strnlen(header.metric, sizeof(header.metric)));
+}
+
+cv::Mat TileLibrary::tile(size_t index) const {
+    size_t tileBytes = static_cast<size_t>(header.tileSize) * header.tileSize * 3;
+    const uchar* pixels = file.data() + header.pixelOffset + index * tileBytes;
+    return cv::Mat(header.tileSize, header.tileSize, CV_8UC3, const_cast<uchar*>(pixels), header.tileSize * 3);
+}
+
+//признаки вида kind всех тайлов лежат подряд, поэтому строка тайла находится по смещению вида и индексу
+void TileLibrary::readFeatures(size_t index, FeatureStore& store, size_t row) const {
+    const uchar* table = file.data() + header.featureOffset;
+    for (unsigned bit = FeatureColor; bit <= FeatureTexture; bit <<= 1) {
+        if (!(header.featureMask & bit)) continue;
+        FeatureKind kind = static_cast<FeatureKind>(bit);
+        size_t rowBytes = FeatureStore::sizeOf(kind) * sizeof(float);
+        if (store.has(kind)) std::memcpy(store.data(kind, row), table + index * rowBytes, rowBytes);
+        table += header.tileCount * rowBytes;
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "FeatureStore.h"
+
+namespace fs = std::filesystem;
+
+//файл, отображенный в память только для чтения (mmap / MapViewOfFile)
+//страницы подгружаются системой по мере обращения и могут вытесняться без записи в файл подкачки
+class MappedFile {
+private:
+    const uchar* bytes = nullptr;//начало отображения
+    size_t length = 0;//размер файла
+#ifdef _WIN32
+    void* file = nullptr;//дескриптор файла
+    void* mapping = nullptr;//объект отображения
+#else
+    int descriptor = -1;//дескриптор файла
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    //отображение файла целиком, false при ошибке или пустом файле
+    bool open(const fs::path& path);
+    //снятие отображения
+    void close();
+
+    const uchar* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool isOpen() const { return bytes != nullptr; }
+};
+
+//заголовок файла библиотеки тайлов
+//файл: заголовок, изображения тайлов (сырые BGR, tileSize x tileSize, подряд, с границы страницы),
+//таблица признаков (по видам из маски: все тайлы подряд, FeatureStore::sizeOf(kind) float на тайл)
+struct TileLibraryHeader {
+    uint32_t magic = 0;//сигнатура
+    uint32_t version = 0;//версия формата
+    int32_t tileSize = 0;//размер стороны тайла
+    int32_t angle = 0;//угол поворота тайлов
+    uint32_t featureMask = 0;//виды признаков в таблице
+    uint32_t reserved = 0;//выравнивание
+    uint64_t tileCount = 0;//кол-во тайлов
+    uint64_t pixelOffset = 0;//смещение изображений от начала файла
+    uint64_t featureOffset = 0;//смещение таблицы признаков
+    char metric[32] = {};//имя метрики, для которой посчитаны признаки
+};
+
+//запись библиотеки тайлов: изображения пишутся сразу по мере добавления,
+//признаки накапливаются в памяти и дописываются в конце вместе с окончательным заголовком
+class TileLibraryWriter {
+private:
+    std::ofstream out;//выходной файл
+    fs::path path;//путь к выходному файлу
+    TileLibraryHeader header;//заголовок (дописывается в finish)
+    FeatureStore features;//признаки добавленных тайлов
+
+public:
+    //создание файла и запись заглушки заголовка, false при ошибке
+    bool open(const fs::path& path, int tileSize, int angle, const std::string& metricName, unsigned featureMask);
+    //добавление тайла (CV_8UC3, tileSize x tileSize) и его признаков из строки row хранилища store
+    bool add(const cv::Mat& image, const FeatureStore& store, size_t row);
+    //запись таблицы признаков и заголовка, false при ошибке записи
+    bool finish();
+    //закрытие и удаление файла (сборка не удалась, недописанная библиотека не остается на диске)
+    void discard();
+
+    //кол-во добавленных тайлов
+    size_t size() const { return header.tileCount; }
+};
+
+//библиотека тайлов, открытая для чтения: изображения читаются прямо из отображения файла
+class TileLibrary {
+private:
+    MappedFile file;//отображение файла
+    TileLibraryHeader header;//заголовок открытого файла
+
+public:
+    static constexpr uint32_t magic = 0x4C534F4D;//сигнатура файла "MOSL"
+    static constexpr uint32_t version = 1;//версия формата файла
+    static constexpr size_t pageAlignment = 4096;//выравнивание начала изображений
+
+    //открытие и проверка файла, false если файл не библиотека тайлов или поврежден
+    bool open(const fs::path& path);
+    //закрытие (изображения, выданные tile, становятся недействительными)
+    void close();
+
+    bool isOpen() const { return file.isOpen(); }
+    size_t size() const { return isOpen() ? static_cast<size_t>(header.tileCount) : 0; }
+    int tileSize() const { return header.tileSize; }
+    int angle() const { return header.angle; }
+    unsigned featureMask() const { return header.featureMask; }
+    std::string metricName() const;
+    //размер отображения в байтах
+    size_t mappedBytes() const { return file.size(); }
+
+    //изображение тайла: заголовок cv::Mat без владения на память отображения
+    cv::Mat tile(size_t index) const;
+    //копирование признаков тайла в строку row хранилища store (виды, выделенные в store и имеющиеся в файле)
+    void readFeatures(size_t index, FeatureStore& store, size_t row) const;
+};
@@ -0,0 +1,122 @@
+#include "TileRenderCache.h"
+#include "Concurrency.h"
+#include <algorithm>
+#include <cstring>
+
+//класс TileRenderCache
+void TileRenderCache::clear() {
+    atlases.clear();
+    tileCount = 0;
+    tileType = -1;
+}
+
+const TileRenderCache::Atlas* TileRenderCache::find(const cv::Size& size) const {
+    for (const auto& atlas : atlases) {
+        if (atlas.size == size) return &atlas;
+    }
+    return nullptr;
+}
+
+//подготовка отрисовок: атлас размера хранит только тайлы текущего назначения (слот на тайл, подряд по строкам),
+//поэтому память ограничена различными парами (тайл, размер клетки) назначения - при потоковой генерации
+//одной полосой, а не всеми тайлами; атласы размеров, которых нет в назначении, освобождаются.
+//отрисовки тайлов, оставшихся в назначении, копируются из прежнего атласа, недостающие масштабируются параллельно
+void TileRenderCache::prepare(const std::vector<Tile>& tiles, const std::vector<cv::Rect>& regions,
+    const std::vector<int>& assignment, int threads) {
+    if (tiles.empty()) return;
+    if (tiles.size() != tileCount || tiles.front().image.type() != tileType) {
+        clear();
+        tileCount = tiles.size();
+        tileType = tiles.front().image.type();
+    }
+
+    //тайлы назначения по размерам клеток, каждый один раз (слоты - в порядке первого появления)
+    std::vector<Atlas> next;
+    std::vector<std::vector<int>> slotTiles;
+    for (size_t cell = 0; cell < regions.size(); ++cell) {
+        int tile = assignment[cell];
+        if (tile < 0) continue;
+        const cv::Mat& image = tiles[tile].image;
+        cv::Size size = regions[cell].size();
+        if (image.type() != tileType || image.size() == size || size.area() <= 0) continue;
+        size_t index = 0;
+        while (index < next.size() && next[index].size != size) ++index;
+        if (index == next.size()) {
+            Atlas atlas;
+            atlas.size = size;
+            atlas.slot.assign(tileCount, -1);
+            next.push_back(std::move(atlas));
+            slotTiles.emplace_back();
+        }
+        int& slot = next[index].slot[tile];
+        if (slot >= 0) continue;
+        slot = static_cast<int>(slotTiles[index].size());
+        slotTiles[index].push_back(tile);
+    }
+
+    //недостающие пары (атлас, тайл); уже готовые отрисовки переносятся из прежних атласов
+    std::vector<std::pair<size_t, int>> pending;
+    for (size_t index = 0; index < next.size(); ++index) {
+        Atlas& atlas = next[index];
+        Atlas* previous = nullptr;
+        for (auto& candidate : atlases) {
+            if (candidate.size == atlas.size) previous = &candidate;
+        }
+        //те же тайлы в тех же слотах (повторная отрисовка того же назначения) - атлас остается как есть
+        if (previous && previous->slot == atlas.slot) {
+            atlas.pixels = previous->pixels;
+            continue;
+        }
+        const int height = atlas.size.height;
+        atlas.pixels.create(static_cast<int>(slotTiles[index].size()) * height, atlas.size.width, tileType);
+        for (size_t slot = 0; slot < slotTiles[index].size(); ++slot) {
+            int tile = slotTiles[index][slot];
+            if (previous && previous->slot[tile] >= 0) {
+                int from = previous->slot[tile] * height, to = static_cast<int>(slot) * height;
+                previous->pixels.rowRange(from, from + height).copyTo(atlas.pixels.rowRange(to, to + height));
+            }
+            else {
+                pending.emplace_back(index, tile);
+            }
+        }
+    }
+    atlases = std::move(next);
+
+    parallelFor(pending.size(), threads, [&](size_t i) {
+        Atlas& atlas = atlases[pending[i].first];
+        int tile = pending[i].second;
+        cv::Mat slot = atlas.pixels(cv::Rect(0, atlas.slot[tile] * atlas.size.height, atlas.size.width, atlas.size.height));
+        cv::Mat rendered;
+        cv::resize(tiles[tile].image, rendered, atlas.size, 0, 0, cv::INTER_CUBIC);
+        rendered.copyTo(slot);
+    }, 4);
+}
+
+//размещение: строки отрисовки копируются в строки целевой области
+bool TileRenderCache::place(const std::vector<Tile>& tiles, int tile, cv::Mat& target, const cv::Rect& region) const {
+    const cv::Mat& image = tiles[tile].image;
+    if (image.type() != target.type()) return false;
+    //отрисовка - сам тайл, если размер совпадает с клеткой, иначе - его строки в атласе
+    const cv::Mat* source = &image;
+    int firstRow = 0;
+    if (image.size() != region.size()) {
+        const Atlas* atlas = image.type() == tileType ? find(region.size()) : nullptr;
+        if (!atlas || atlas->slot[tile] < 0) return false;
+        source = &atlas->pixels;
+        firstRow = atlas->slot[tile] * atlas->size.height;
+    }
+    const size_t pixelBytes = target.elemSize();
+    const size_t rowBytes = static_cast<size_t>(region.width) * pixelBytes;
+    for (int y = 0; y < region.height; ++y) {
+        std::memcpy(target.ptr<uchar>(region.y + y) + region.x * pixelBytes, source->ptr<uchar>(firstRow + y), rowBytes);
+    }
+    return true;
+}
+
+size_t TileRenderCache::getMemoryBytes() const {
+    size_t bytes = 0;
+    for (const auto& atlas : atlases) {
+        bytes += atlas.pixels.total() * atlas.pixels.elemSize() + atlas.slot.size() * sizeof(int);
+    }
+    return bytes;
+}
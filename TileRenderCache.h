@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "MosaicProcessor.h"
+
+//кэш отрисовок тайлов под размеры клеток мозаики
+//почти все клетки сетки имеют размер gridStep x gridStep, остальные - несколько краевых размеров, поэтому
+//каждый тайл масштабируется (INTER_CUBIC) не более одного раза на размер, а размещение в мозаике - копирование строк;
+//отрисовки одного размера лежат в общем атласе: одна матрица, тайл в слоте s занимает строки [s * h, (s + 1) * h);
+//в атласе только тайлы последнего назначения, поэтому память растет с числом различных тайлов назначения
+//(при потоковой генерации - полосы), а не с числом загруженных тайлов;
+//тайлы, размер которых уже совпадает с клеткой, не копируются в атлас и размещаются напрямую
+class TileRenderCache {
+private:
+    //атлас отрисовок одного размера
+    struct Atlas {
+        cv::Size size;//размер отрисовки
+        cv::Mat pixels;//отрисовки тайлов назначения подряд по строкам (слоты * height x width)
+        std::vector<int> slot;//слот тайла в pixels (-1 - тайла нет в атласе)
+    };
+
+    std::vector<Atlas> atlases;//атласы по размерам (их немного, поиск линейный)
+    size_t tileCount = 0;//кол-во тайлов, под которое выделены атласы
+    int tileType = -1;//тип изображений тайлов
+
+    //атлас заданного размера (nullptr, если его нет)
+    const Atlas* find(const cv::Size& size) const;
+
+public:
+    //сброс всех отрисовок (при смене набора тайлов)
+    void clear();
+
+    //отрисовка недостающих пар (тайл, размер клетки) для назначения (параллельно);
+    //клетки без тайла (-1) и тайлы другого типа, чем первый тайл, пропускаются;
+    //отрисовки тайлов и размеров, которых нет в назначении, освобождаются
+    void prepare(const std::vector<Tile>& tiles, const std::vector<cv::Rect>& regions,
+        const std::vector<int>& assignment, int threads);
+    //размещение тайла в области изображения копированием строк;
+    //false - для тайла нет подходящей отрисовки (тип или размер не подготовлены)
+    bool place(const std::vector<Tile>& tiles, int tile, cv::Mat& target, const cv::Rect& region) const;
+
+    //кол-во размеров с атласами
+    size_t getSizeCount() const { return atlases.size(); }
+    //память, занятая атласами, в байтах
+    size_t getMemoryBytes() const;
+};